@@ -4,13 +4,16 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
-../gen_c0.c 
+../gen_c0.c \
+../c0_pixel.c 
 
 OBJS += \
-./gen_c0.o 
+./gen_c0.o \
+./c0_pixel.o 
 
 C_DEPS += \
-./gen_c0.d 
+./gen_c0.d \
+./c0_pixel.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
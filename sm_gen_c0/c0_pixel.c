@@ -0,0 +1,280 @@
+/*
+ * c0_pixel.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  The c0 estimate of a single pixel, split out of gen_c0.c so that
+ *  sm_pipeline can run it on the time series it holds in memory.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "c0_pixel.h"
+
+#define YEAR_START 2009
+#define YEAR_END 2014
+
+typedef struct {
+    float a;
+    float b;
+} sigma0_value;
+
+int wetcmpfunc (const void * a, const void * b)
+{
+   float result = ( *(float*)a - *(float*)b );
+   if (result > 0)
+       return 1;
+   else if (result == 0)
+       return 0;
+   else
+       return -1;
+}
+
+int drycmpfunc (const void * a, const void * b)
+{
+   float result = ( (*(sigma0_value*)a).a - (*(sigma0_value*)b).a );
+   if (result > 0)
+       return 1;
+   else if (result == 0)
+       return 0;
+   else
+       return -1;
+}
+
+float mean(float *arr, int size) {
+    int i;
+    float avg = 0;
+    for (i = 0; i < size; i++) {
+        avg += arr[i];
+    }
+    avg = avg / size;
+    return avg;
+}
+
+float dry_mean(sigma0_value *arr, int size, int opt) {
+    int i;
+    float avg = 0;
+    if (opt == 0) {
+        for (i = 0; i < size; i++) {
+            avg += arr[i].a;
+        }
+    }
+    else {
+        for (i = 0; i < size; i++) {
+            avg += arr[i].b;
+        }
+    }
+    avg = avg / size;
+    return avg;
+}
+
+/* c0 dry, c0 wet and the dry slope of one pixel from its a and b time
+ * series, [year][day] like the ts files */
+void find_min_max(const float *ts_a, const float *ts_b, float *min, float *max, float *slope, char *type) {
+    int i, year, day;
+    int cur_ind = 0;
+    int num_days = 365*(YEAR_END-YEAR_START+1);
+    float cur_data, cur_slope;
+    float dry_iqr, wet_iqr, dry_min, dry_max, wet_min, wet_max;
+    int q1_loc,q3_loc, dry_start, dry_stop, wet_start, wet_stop;
+    int found_dry_start, found_wet_start;
+
+    /* Allocate memory for the filtered, ordered array */
+    float *filt_tseries = (float*)malloc(num_days*sizeof(float));
+    if (!filt_tseries) {
+            fprintf(stderr, "Memory Error!\n");
+            exit(-1);
+    }
+    memset(filt_tseries,0,num_days*sizeof(float));
+
+    /* Allocate memory for the array adjusted to 25 deg. inc angle for theta dry */
+    sigma0_value *tseries_dry = (sigma0_value*)malloc(num_days*sizeof(sigma0_value));
+
+    if (!tseries_dry) {
+            fprintf(stderr, "Memory Error!\n");
+            exit(-1);
+    }
+    memset(tseries_dry,0,num_days*sizeof(sigma0_value));
+
+    year = -1;
+    day = 0;
+    for (i = 0; i < num_days; i++) {
+        day = i%366;
+        if (day == 0) {
+            year++;
+        }
+
+        cur_data = ts_a[year*365 + day];
+        cur_slope = ts_b[year*365 + day];
+
+        if (!strcmp(type,"a")) {
+            if (cur_data != 0 &&
+                    abs(abs(cur_data) - 33) > .01) {
+                filt_tseries[cur_ind] = cur_data;
+
+                /* Fill in the 25 deg reference values */
+                /* sigma0_25 = A + B * (25 - 40)  where 25 is theta_dry, 40 is current inc angle*/
+                tseries_dry[cur_ind].a = cur_data + cur_slope * (-15);
+                tseries_dry[cur_ind].b = cur_slope;
+                cur_ind++;
+            }
+        } else {
+            if (cur_slope != 0 &&
+                    abs(abs(cur_slope) - 3) > .01) {
+                filt_tseries[cur_ind] = cur_slope;
+                tseries_dry[cur_ind].b = cur_slope;
+                cur_ind++;
+            }
+        }
+    }
+
+    if (cur_ind == 0) {
+        *min = 0;
+        *max = 0;
+        *slope = 0;
+        free(filt_tseries);
+        free(tseries_dry);
+        return;
+    }
+    qsort(filt_tseries,cur_ind,sizeof(float),wetcmpfunc);
+    qsort(tseries_dry,cur_ind,sizeof(sigma0_value),drycmpfunc);
+
+    /* use filt_tseries to get c0wet, tseries_dry for c0dry */
+    /* c0wet from max values, c0dry from min values*/
+    /* First find interquartile range -- q1_loc = (N+1)/4 */
+    q1_loc = (cur_ind + 1) / 4;
+    q3_loc = 3*(cur_ind + 1) / 4;
+
+    wet_iqr = filt_tseries[q3_loc] - filt_tseries[q1_loc];
+    dry_iqr = tseries_dry[q3_loc].a - tseries_dry[q1_loc].a;
+
+    /* remove values greater than 3*IQR away from mean */
+    /* values must be greater than dry cap and less than wet cap */
+    wet_min = mean(filt_tseries, cur_ind) - (3 * wet_iqr);
+    wet_max = mean(filt_tseries, cur_ind) + (3 * wet_iqr);
+
+    dry_min = dry_mean(tseries_dry, cur_ind, 0) - (3 * dry_iqr);
+    dry_max = dry_mean(tseries_dry, cur_ind, 0) + (3 * dry_iqr);
+
+    dry_start = 0;
+    dry_stop = 0;
+    wet_start = 0;
+    wet_stop = 0;
+    found_dry_start = 0;
+    found_wet_start = 0;
+
+    for (i = 0; i < cur_ind; i++) {
+        if (!found_dry_start && tseries_dry[i].a > dry_min) {
+            dry_start = i;
+            found_dry_start = 1;
+        }
+        if (!found_wet_start && filt_tseries[i] > wet_min) {
+            wet_start = i;
+            found_wet_start = 1;
+        }
+        if (found_dry_start && tseries_dry[i].a < dry_max) {
+            dry_stop = i;
+        }
+        if (found_wet_start && filt_tseries[i] < wet_max) {
+            wet_stop = i;
+        }
+    }
+
+    // now calculate the mean again and remove any outliers 1.5 IQR away from mean
+    // before I used an alternate more ad hoc method, I think this is the actual method
+    // described in naeimi2009, but their description is somewhat ambiguous.
+    q1_loc = (wet_stop - wet_start + 1) / 4 + wet_start;
+    q3_loc = 3*(wet_stop - wet_start + 1) / 4 + wet_start;
+    wet_iqr = filt_tseries[q3_loc] - filt_tseries[q1_loc];
+
+    q1_loc = (dry_stop - dry_start + 1) / 4 + dry_start;
+    q3_loc = 3*(dry_stop - dry_start + 1) / 4 + dry_start;
+    dry_iqr = tseries_dry[q3_loc].a - tseries_dry[q1_loc].a;
+
+    /* remove values greater than 1.5*IQR away from mean */
+    /* values must be greater than dry cap and less than wet cap */
+    wet_min = mean(filt_tseries+wet_start, wet_stop - wet_start + 1) - (1.5 * wet_iqr);
+    wet_max = mean(filt_tseries+wet_start, wet_stop - wet_start + 1) + (1.5 * wet_iqr);
+
+    dry_min = dry_mean(tseries_dry+dry_start, dry_stop - dry_start + 1, 0) - (1.5 * dry_iqr);
+    dry_max = dry_mean(tseries_dry+dry_start, dry_stop - dry_start + 1, 0) + (1.5 * dry_iqr);
+
+    dry_start = 0;
+    dry_stop = 0;
+    wet_start = 0;
+    wet_stop = 0;
+    found_dry_start = 0;
+    found_wet_start = 0;
+
+    for (i = 0; i < cur_ind; i++) {
+        if (!found_dry_start && tseries_dry[i].a > dry_min) {
+            dry_start = i;
+            found_dry_start = 1;
+        }
+        if (!found_wet_start && filt_tseries[i] > wet_min) {
+            wet_start = i;
+            found_wet_start = 1;
+        }
+        if (found_dry_start && tseries_dry[i].a < dry_max) {
+            dry_stop = i;
+        }
+        if (found_wet_start && filt_tseries[i] < wet_max) {
+            wet_stop = i;
+        }
+    }
+
+    /* Now average top/bottom 10% values minus what we skimmed off */
+    int num_dry_avg = (cur_ind-dry_start)*.05;
+    int num_wet_avg = wet_stop*.05;
+    *min = dry_mean(tseries_dry + dry_start, num_dry_avg, 0);
+    // There are wet_stop total measurements used, so avg top 10% of those
+    *max = mean(filt_tseries + wet_stop - (num_wet_avg-1), num_wet_avg);
+    *slope = dry_mean(tseries_dry + dry_start, num_dry_avg,1);
+
+
+//    This is the old method where I used the separate groups of high/low values
+//    dry_size = 50;
+//    wet_size = 20;
+//
+//    q1_loc = (dry_size + 1) / 4;
+//    q3_loc = 3*(dry_size + 1) / 4;
+//    dry_iqr = tseries_dry[q3_loc + dry_start].a - tseries_dry[q1_loc + dry_start].a;
+//
+//    q1_loc = (wet_size + 1) / 4;
+//    q3_loc = 3*(wet_size + 1) / 4;
+//    wet_iqr = filt_tseries[q3_loc + wet_stop - wet_size] - filt_tseries[q1_loc + wet_stop - wet_size];
+//
+//    /* now take the top and bottom values, get rid of 1.5 irq away from mean, take avg */
+//    /* take 50 for dry and 20 for wet */
+//    /* now take the average and remove values greater than 1.5 IQR away from mean */
+//    dry_min = dry_mean(tseries_dry + dry_start, dry_size, 0) - (1.5 * dry_iqr);
+//    wet_max = mean(filt_tseries + wet_stop - (wet_size - 1), wet_size) + (1.5 * wet_iqr);
+//
+//    dry_stop = dry_start + dry_size - 1;
+//    dry_start = 0;
+//    wet_start = wet_stop - wet_size + 1;
+//    wet_stop = 0;
+//    found_dry_start = 0;
+//    found_wet_start = 0;
+//
+//    for (i = 0; i < cur_ind; i++) {
+//        if (!found_dry_start && tseries_dry[i].a > dry_min) {
+//            dry_start = i;
+//            found_dry_start = 1;
+//        }
+//        if (filt_tseries[i] < wet_max) {
+//            wet_stop = i;
+//        }
+//    }
+//
+//    /* Now average the 50 and 20 values minus what we skimmed off */
+//    *min = dry_mean(tseries_dry + dry_start, dry_stop-dry_start+1, 0);
+//    *max = mean(filt_tseries + wet_start, wet_stop-wet_start+1);
+//    *slope = dry_mean(tseries_dry, cur_ind,1);
+
+    free(filt_tseries);
+    free(tseries_dry);
+    return;
+}
@@ -0,0 +1,13 @@
+/*
+ * c0_pixel.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef C0_PIXEL_H_
+#define C0_PIXEL_H_
+
+void find_min_max(const float *ts_a, const float *ts_b, float *min, float *max, float *slope, char *type);
+
+#endif /* C0_PIXEL_H_ */
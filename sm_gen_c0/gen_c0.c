@@ -17,6 +17,8 @@
 
 #include <netcdf.h>
 
+#include "c0_pixel.h"
+
 #define NUM_TS_DAYS 2500
 #define NUM_THREADS 24
 #define NUM_YEARS 6
@@ -45,6 +47,7 @@ static char args_doc[] = "Region Image_type";
 static struct argp_option options[] = {
   {"verbose",  'v', 0,      0,  "Produce verbose output" },
   {"grd",  'g', 0,      0,  "Generate c0 over grd files" },
+  {"rows",  'r', "START:END", 0,  "Only process rows START to END (1-based) into a shard file" },
   { 0 }
 };
 
@@ -55,6 +58,8 @@ struct arguments
   char *type;
   int grd;
   int verbose;
+  int row_start;
+  int row_end;
 };
 
 /* Parse a single option. */
@@ -73,6 +78,11 @@ parse_opt (int key, char *arg, struct argp_state *state)
     case 'g':
       arguments->grd = 1;
       break;
+    case 'r':
+      if (sscanf(arg, "%d:%d", &arguments->row_start, &arguments->row_end) != 2 ||
+              arguments->row_start < 1 || arguments->row_end < arguments->row_start)
+          argp_failure(state, 1, 0, "ERROR, could not parse row range %s!", arg);
+      break;
     case ARGP_KEY_ARG:
       if (state->arg_num >= 2) {
         /* Too many arguments. */
@@ -147,264 +157,6 @@ void checkdir(char* dirname) {
     return;
 }
 
-typedef struct {
-    float a;
-    float b;
-} sigma0_value;
-
-int wetcmpfunc (const void * a, const void * b)
-{
-   float result = ( *(float*)a - *(float*)b );
-   if (result > 0)
-       return 1;
-   else if (result == 0)
-       return 0;
-   else
-       return -1;
-}
-
-int drycmpfunc (const void * a, const void * b)
-{
-   float result = ( (*(sigma0_value*)a).a - (*(sigma0_value*)b).a );
-   if (result > 0)
-       return 1;
-   else if (result == 0)
-       return 0;
-   else
-       return -1;
-}
-
-float mean(float *arr, int size) {
-    int i;
-    float avg = 0;
-    for (i = 0; i < size; i++) {
-        avg += arr[i];
-    }
-    avg = avg / size;
-    return avg;
-}
-
-float dry_mean(sigma0_value *arr, int size, int opt) {
-    int i;
-    float avg = 0;
-    if (opt == 0) {
-        for (i = 0; i < size; i++) {
-            avg += arr[i].a;
-        }
-    }
-    else {
-        for (i = 0; i < size; i++) {
-            avg += arr[i].b;
-        }
-    }
-    avg = avg / size;
-    return avg;
-}
-
-void find_min_max(float ****tseries, float ****tseriesb, int row, int col , float *min, float *max, float *slope, char *type) {
-    int i, year, day;
-    int cur_ind = 0;
-    int num_days = 365*(YEAR_END-YEAR_START+1);
-    float cur_data, cur_slope;
-    float dry_iqr, wet_iqr, dry_min, dry_max, wet_min, wet_max;
-    int q1_loc,q3_loc, dry_start, dry_stop, wet_start, wet_stop;
-    int found_dry_start, found_wet_start;
-
-    /* Allocate memory for the filtered, ordered array */
-    float *filt_tseries = (float*)malloc(num_days*sizeof(float));
-    if (!filt_tseries) {
-            fprintf(stderr, "Memory Error!\n");
-            exit(-1);
-    }
-    memset(filt_tseries,0,num_days*sizeof(float));
-
-    /* Allocate memory for the array adjusted to 25 deg. inc angle for theta dry */
-    sigma0_value *tseries_dry = (sigma0_value*)malloc(num_days*sizeof(sigma0_value));
-
-    if (!tseries_dry) {
-            fprintf(stderr, "Memory Error!\n");
-            exit(-1);
-    }
-    memset(tseries_dry,0,num_days*sizeof(sigma0_value));
-
-    year = -1;
-    day = 0;
-    for (i = 0; i < num_days; i++) {
-        day = i%366;
-        if (day == 0) {
-            year++;
-        }
-
-        cur_data = tseries[row][col][year][day];
-        cur_slope = tseriesb[row][col][year][day];
-
-        if (!strcmp(type,"a")) {
-            if (cur_data != 0 &&
-                    abs(abs(cur_data) - 33) > .01) {
-                filt_tseries[cur_ind] = cur_data;
-
-                /* Fill in the 25 deg reference values */
-                /* sigma0_25 = A + B * (25 - 40)  where 25 is theta_dry, 40 is current inc angle*/
-                tseries_dry[cur_ind].a = cur_data + cur_slope * (-15);
-                tseries_dry[cur_ind].b = cur_slope;
-                cur_ind++;
-            }
-        } else {
-            if (cur_slope != 0 &&
-                    abs(abs(cur_slope) - 3) > .01) {
-                filt_tseries[cur_ind] = cur_slope;
-                tseries_dry[cur_ind].b = cur_slope;
-                cur_ind++;
-            }
-        }
-    }
-
-    if (cur_ind == 0) {
-        *min = 0;
-        *max = 0;
-        return;
-    }
-    qsort(filt_tseries,cur_ind,sizeof(float),wetcmpfunc);
-    qsort(tseries_dry,cur_ind,sizeof(sigma0_value),drycmpfunc);
-
-    /* use filt_tseries to get c0wet, tseries_dry for c0dry */
-    /* c0wet from max values, c0dry from min values*/
-    /* First find interquartile range -- q1_loc = (N+1)/4 */
-    q1_loc = (cur_ind + 1) / 4;
-    q3_loc = 3*(cur_ind + 1) / 4;
-
-    wet_iqr = filt_tseries[q3_loc] - filt_tseries[q1_loc];
-    dry_iqr = tseries_dry[q3_loc].a - tseries_dry[q1_loc].a;
-
-    /* remove values greater than 3*IQR away from mean */
-    /* values must be greater than dry cap and less than wet cap */
-    wet_min = mean(filt_tseries, cur_ind) - (3 * wet_iqr);
-    wet_max = mean(filt_tseries, cur_ind) + (3 * wet_iqr);
-
-    dry_min = dry_mean(tseries_dry, cur_ind, 0) - (3 * dry_iqr);
-    dry_max = dry_mean(tseries_dry, cur_ind, 0) + (3 * dry_iqr);
-
-    dry_start = 0;
-    dry_stop = 0;
-    wet_start = 0;
-    wet_stop = 0;
-    found_dry_start = 0;
-    found_wet_start = 0;
-
-    for (i = 0; i < cur_ind; i++) {
-        if (!found_dry_start && tseries_dry[i].a > dry_min) {
-            dry_start = i;
-            found_dry_start = 1;
-        }
-        if (!found_wet_start && filt_tseries[i] > wet_min) {
-            wet_start = i;
-            found_wet_start = 1;
-        }
-        if (found_dry_start && tseries_dry[i].a < dry_max) {
-            dry_stop = i;
-        }
-        if (found_wet_start && filt_tseries[i] < wet_max) {
-            wet_stop = i;
-        }
-    }
-
-    // now calculate the mean again and remove any outliers 1.5 IQR away from mean
-    // before I used an alternate more ad hoc method, I think this is the actual method
-    // described in naeimi2009, but their description is somewhat ambiguous.
-    q1_loc = (wet_stop - wet_start + 1) / 4 + wet_start;
-    q3_loc = 3*(wet_stop - wet_start + 1) / 4 + wet_start;
-    wet_iqr = filt_tseries[q3_loc] - filt_tseries[q1_loc];
-
-    q1_loc = (dry_stop - dry_start + 1) / 4 + dry_start;
-    q3_loc = 3*(dry_stop - dry_start + 1) / 4 + dry_start;
-    dry_iqr = tseries_dry[q3_loc].a - tseries_dry[q1_loc].a;
-
-    /* remove values greater than 1.5*IQR away from mean */
-    /* values must be greater than dry cap and less than wet cap */
-    wet_min = mean(filt_tseries+wet_start, wet_stop - wet_start + 1) - (1.5 * wet_iqr);
-    wet_max = mean(filt_tseries+wet_start, wet_stop - wet_start + 1) + (1.5 * wet_iqr);
-
-    dry_min = dry_mean(tseries_dry+dry_start, dry_stop - dry_start + 1, 0) - (1.5 * dry_iqr);
-    dry_max = dry_mean(tseries_dry+dry_start, dry_stop - dry_start + 1, 0) + (1.5 * dry_iqr);
-
-    dry_start = 0;
-    dry_stop = 0;
-    wet_start = 0;
-    wet_stop = 0;
-    found_dry_start = 0;
-    found_wet_start = 0;
-
-    for (i = 0; i < cur_ind; i++) {
-        if (!found_dry_start && tseries_dry[i].a > dry_min) {
-            dry_start = i;
-            found_dry_start = 1;
-        }
-        if (!found_wet_start && filt_tseries[i] > wet_min) {
-            wet_start = i;
-            found_wet_start = 1;
-        }
-        if (found_dry_start && tseries_dry[i].a < dry_max) {
-            dry_stop = i;
-        }
-        if (found_wet_start && filt_tseries[i] < wet_max) {
-            wet_stop = i;
-        }
-    }
-
-    /* Now average top/bottom 10% values minus what we skimmed off */
-    int num_dry_avg = (cur_ind-dry_start)*.05;
-    int num_wet_avg = wet_stop*.05;
-    *min = dry_mean(tseries_dry + dry_start, num_dry_avg, 0);
-    // There are wet_stop total measurements used, so avg top 10% of those
-    *max = mean(filt_tseries + wet_stop - (num_wet_avg-1), num_wet_avg);
-    *slope = dry_mean(tseries_dry + dry_start, num_dry_avg,1);
-
-
-//    This is the old method where I used the separate groups of high/low values
-//    dry_size = 50;
-//    wet_size = 20;
-//
-//    q1_loc = (dry_size + 1) / 4;
-//    q3_loc = 3*(dry_size + 1) / 4;
-//    dry_iqr = tseries_dry[q3_loc + dry_start].a - tseries_dry[q1_loc + dry_start].a;
-//
-//    q1_loc = (wet_size + 1) / 4;
-//    q3_loc = 3*(wet_size + 1) / 4;
-//    wet_iqr = filt_tseries[q3_loc + wet_stop - wet_size] - filt_tseries[q1_loc + wet_stop - wet_size];
-//
-//    /* now take the top and bottom values, get rid of 1.5 irq away from mean, take avg */
-//    /* take 50 for dry and 20 for wet */
-//    /* now take the average and remove values greater than 1.5 IQR away from mean */
-//    dry_min = dry_mean(tseries_dry + dry_start, dry_size, 0) - (1.5 * dry_iqr);
-//    wet_max = mean(filt_tseries + wet_stop - (wet_size - 1), wet_size) + (1.5 * wet_iqr);
-//
-//    dry_stop = dry_start + dry_size - 1;
-//    dry_start = 0;
-//    wet_start = wet_stop - wet_size + 1;
-//    wet_stop = 0;
-//    found_dry_start = 0;
-//    found_wet_start = 0;
-//
-//    for (i = 0; i < cur_ind; i++) {
-//        if (!found_dry_start && tseries_dry[i].a > dry_min) {
-//            dry_start = i;
-//            found_dry_start = 1;
-//        }
-//        if (filt_tseries[i] < wet_max) {
-//            wet_stop = i;
-//        }
-//    }
-//
-//    /* Now average the 50 and 20 values minus what we skimmed off */
-//    *min = dry_mean(tseries_dry + dry_start, dry_stop-dry_start+1, 0);
-//    *max = mean(filt_tseries + wet_start, wet_stop-wet_start+1);
-//    *slope = dry_mean(tseries_dry, cur_ind,1);
-
-    free(filt_tseries);
-    free(tseries_dry);
-    return;
-}
-
 typedef struct {
     float ****tseries;
     float ****tseriesb;
@@ -440,7 +192,7 @@ void *mthreadGenC0(void *arg) {
         for (j = 0; j < num_columns-1; j++) {
 
             /* find min and max */
-            find_min_max(tseries, tseriesb, i,j, &min, &max, &slope, type);
+            find_min_max(&tseries[i][j][0][0], &tseriesb[i][j][0][0], &min, &max, &slope, type);
 
             /* store in 2d array */
             c0_dry[i][j] = min;
@@ -462,6 +214,8 @@ int main (int argc, char **argv)
     arguments.grd = 0;
     arguments.region = NULL;
     arguments.type = NULL;
+    arguments.row_start = 0;
+    arguments.row_end = 0;
     static const int NUM_DAYS = 365;
 
     /* Parse our arguments; every option seen by parse_opt will
@@ -482,6 +236,7 @@ int main (int argc, char **argv)
     int retval;
     char FILE_NAME[100];
     int dimids[NDIMS];
+    size_t start[4], count[4];
 
     /* multithread args */
     thread_args t_args[NUM_THREADS];
@@ -546,6 +301,20 @@ int main (int argc, char **argv)
         }
     }
 
+    /* only process a shard of the rows if asked */
+    int total_rows = num_rows;
+    int row_start = 1;
+    if (arguments.row_start) {
+        if (arguments.row_end > total_rows) {
+            printf("ERROR, row range %d:%d outside of image with %d rows!\n",
+                    arguments.row_start, arguments.row_end, total_rows);
+            exit(-1);
+        }
+        row_start = arguments.row_start;
+        num_rows = arguments.row_end - arguments.row_start + 1;
+        printf("Processing rows %04d-%04d\n", arguments.row_start, arguments.row_end);
+    }
+
     /* allocate memory for 2d arrays */
     printf("Allocating Memory...");
     float **c0_dry = (float**)malloc(sizeof(float *)*num_rows);
@@ -609,8 +378,16 @@ int main (int argc, char **argv)
     if ((retval = nc_inq_varid(ncid, "data", &varid)))
         ERR(retval);
 
-    /* read values from netCDF variable */
-    if ((retval = nc_get_var_float(ncid, varid, &tseries[0][0][0][0])))
+    /* read this shard's rows from the netCDF variable */
+    start[0] = row_start - 1;
+    start[1] = 0;
+    start[2] = 0;
+    start[3] = 0;
+    count[0] = num_rows;
+    count[1] = num_columns;
+    count[2] = NUM_YEARS;
+    count[3] = NUM_DAYS;
+    if ((retval = nc_get_vara_float(ncid, varid, start, count, &tseries[0][0][0][0])))
        ERR(retval);
 
     /* Open the netCDF time series b file*/
@@ -622,8 +399,8 @@ int main (int argc, char **argv)
     if ((retval = nc_inq_varid(ncid, "data", &varid)))
         ERR(retval);
 
-    /* read values from netCDF variable */
-    if ((retval = nc_get_var_float(ncid, varid, &tseriesb[0][0][0][0])))
+    /* read this shard's rows from the netCDF variable */
+    if ((retval = nc_get_vara_float(ncid, varid, start, count, &tseriesb[0][0][0][0])))
        ERR(retval);
 
     printf("done\n");
@@ -666,10 +443,24 @@ int main (int argc, char **argv)
 
     /* save min/max 2d arrays to netcdf file */
     /* Create the file. */
-    sprintf(FILE_NAME,"/auto/temp/lindell/soilmoisture/c0/c0_%s.nc",region);
+    if (arguments.row_start)
+        sprintf(FILE_NAME,"/auto/temp/lindell/soilmoisture/c0/c0_%s.r%04d-%04d.nc",
+                region,arguments.row_start,arguments.row_end);
+    else
+        sprintf(FILE_NAME,"/auto/temp/lindell/soilmoisture/c0/c0_%s.nc",region);
     if ((retval = nc_create(FILE_NAME, NC_NETCDF4, &ncid)))
         ERR(retval);
 
+    /* shard files record where they go, for sm_merge_shards */
+    if (arguments.row_start) {
+        if ((retval = nc_put_att_int(ncid, NC_GLOBAL, "shard_row_start", NC_INT, 1, &arguments.row_start)))
+            ERR(retval);
+        if ((retval = nc_put_att_int(ncid, NC_GLOBAL, "shard_row_end", NC_INT, 1, &arguments.row_end)))
+            ERR(retval);
+        if ((retval = nc_put_att_int(ncid, NC_GLOBAL, "shard_total_rows", NC_INT, 1, &total_rows)))
+            ERR(retval);
+    }
+
     /* Define the dimensions. */
     if ((retval = nc_def_dim(ncid, "row", num_rows, &row_dimid)))
         ERR(retval);
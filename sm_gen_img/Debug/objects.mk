@@ -4,5 +4,5 @@
 
 USER_OBJS :=
 
-LIBS := -lnetcdf
+LIBS := -lnetcdf -lz
 
@@ -4,20 +4,35 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
-../sm_gen_img.c 
+../sm_gen_img.c \
+../transpose.c \
+../day_writer.c \
+../zarr_store.c \
+../overview.c \
+../reader_pool.c 
 
 OBJS += \
-./sm_gen_img.o 
+./sm_gen_img.o \
+./transpose.o \
+./day_writer.o \
+./zarr_store.o \
+./overview.o \
+./reader_pool.o 
 
 C_DEPS += \
-./sm_gen_img.d 
+./sm_gen_img.d \
+./transpose.d \
+./day_writer.d \
+./zarr_store.d \
+./overview.d \
+./reader_pool.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
 %.o: ../%.c
 	@echo 'Building file: $<'
 	@echo 'Invoking: GCC C Compiler'
-	gcc -O3 -g3 -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$(@:%.o=%.d)" -o "$@" "$<"
+	gcc -O3 -march=native -g3 -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$(@:%.o=%.d)" -o "$@" "$<"
 	@echo 'Finished building: $<'
 	@echo ' '
 
@@ -0,0 +1,236 @@
+/*
+ * day_writer.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Pool of writer processes for the daily image files. NetCDF/HDF5 can't
+ *  be used from several threads at once, but separate processes each have
+ *  their own copy of the library, so each writer creates and writes whole
+ *  files on its own. The images are handed over through slots in shared
+ *  memory: the main process fills a free slot, submits it with the year
+ *  and day, and goes on with its work while a writer writes the file and
+ *  frees the slot again. The writers are forked when the pool is started,
+ *  so start it early, before the big arrays are allocated and before any
+ *  threads or NetCDF files are opened.
+ *
+ *  With 0 writers the files are written by the main process on submit, the
+ *  same way as before the pool.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "day_writer.h"
+
+typedef struct {
+    int year;
+    int doy;
+    int slot;
+} day_job;
+
+/* lives in shared memory, seen by every process */
+typedef struct {
+    sem_t free_slots;       /* slots that can be filled */
+    sem_t jobs;             /* submitted days and stop requests */
+    pthread_mutex_t lock;   /* free list and queue */
+    int free_list[MAX_WRITER_SLOTS];
+    int num_free;
+    day_job queue[MAX_WRITER_SLOTS];
+    int head;
+    int tail;
+    int stop;
+} pool_shared;
+
+struct day_writer {
+    pool_shared *shared;
+    float *slots;
+    size_t slot_len;
+    size_t map_len;
+    int num_slots;
+    int num_writers;
+    int cur_slot;
+    pid_t pids[MAX_WRITERS];
+    day_write_fn write_fn;
+    void *ctx;
+};
+
+/* Take days off the queue until told to stop and the queue is empty */
+static void writer_loop(day_writer *w) {
+    pool_shared *sh = w->shared;
+    day_job job;
+
+    for (;;) {
+        while (sem_wait(&sh->jobs) && errno == EINTR);
+        pthread_mutex_lock(&sh->lock);
+        if (sh->head == sh->tail) {
+            /* only a stop request wakes us with nothing queued */
+            pthread_mutex_unlock(&sh->lock);
+            return;
+        }
+        job = sh->queue[sh->head % MAX_WRITER_SLOTS];
+        sh->head++;
+        pthread_mutex_unlock(&sh->lock);
+
+        w->write_fn(w->ctx, job.year, job.doy, w->slots + job.slot * w->slot_len);
+
+        pthread_mutex_lock(&sh->lock);
+        sh->free_list[sh->num_free++] = job.slot;
+        pthread_mutex_unlock(&sh->lock);
+        sem_post(&sh->free_slots);
+    }
+}
+
+day_writer *day_writer_start(int num_writers, int num_slots, size_t slot_len,
+        day_write_fn write_fn, void *ctx) {
+    day_writer *w = (day_writer*)calloc(1, sizeof(day_writer));
+    pthread_mutexattr_t attr;
+    pool_shared *sh;
+    int i;
+
+    if (!w) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+    if (num_writers > MAX_WRITERS)
+        num_writers = MAX_WRITERS;
+    if (num_writers == 0)
+        num_slots = 1;
+    if (num_slots > MAX_WRITER_SLOTS)
+        num_slots = MAX_WRITER_SLOTS;
+    if (num_slots < 1)
+        num_slots = 1;
+    w->num_writers = num_writers;
+    w->num_slots = num_slots;
+    w->slot_len = slot_len;
+    w->write_fn = write_fn;
+    w->ctx = ctx;
+    w->cur_slot = -1;
+
+    /* the control block followed by the slots, shared with the writers */
+    w->map_len = sizeof(pool_shared) + 64 + sizeof(float) * slot_len * num_slots;
+    sh = (pool_shared*)mmap(NULL, w->map_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sh == MAP_FAILED) {
+        perror("Error mapping writer slots");
+        exit(-1);
+    }
+    w->shared = sh;
+    w->slots = (float*)((char*)sh + (sizeof(pool_shared) + 63) / 64 * 64);
+
+    sem_init(&sh->free_slots, 1, num_slots);
+    sem_init(&sh->jobs, 1, 0);
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&sh->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    for (i = 0; i < num_slots; i++)
+        sh->free_list[i] = i;
+    sh->num_free = num_slots;
+
+    fflush(stdout);
+    for (i = 0; i < num_writers; i++) {
+        w->pids[i] = fork();
+        if (w->pids[i] < 0) {
+            perror("Error starting writer");
+            exit(-1);
+        }
+        if (w->pids[i] == 0) {
+            writer_loop(w);
+            _exit(0);
+        }
+    }
+    return w;
+}
+
+/* A free slot to put the next day in, waits for one if they are all taken */
+float *day_writer_slot(day_writer *w) {
+    pool_shared *sh = w->shared;
+    struct timespec ts;
+    int i, status;
+
+    for (;;) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        if (sem_timedwait(&sh->free_slots, &ts) == 0)
+            break;
+        if (errno != ETIMEDOUT && errno != EINTR) {
+            perror("Error waiting for a writer");
+            exit(-1);
+        }
+        /* a writer that died holds its slot forever, don't wait on it */
+        for (i = 0; i < w->num_writers; i++) {
+            if (w->pids[i] > 0 && waitpid(w->pids[i], &status, WNOHANG) == w->pids[i]) {
+                fprintf(stderr, "ERROR, writer process %d stopped!\n", (int)w->pids[i]);
+                exit(-1);
+            }
+        }
+    }
+    pthread_mutex_lock(&sh->lock);
+    w->cur_slot = sh->free_list[--sh->num_free];
+    pthread_mutex_unlock(&sh->lock);
+    return w->slots + w->cur_slot * w->slot_len;
+}
+
+/* Hand the slot from day_writer_slot to the writers */
+void day_writer_submit(day_writer *w, int year, int doy) {
+    pool_shared *sh = w->shared;
+    day_job job;
+
+    job.year = year;
+    job.doy = doy;
+    job.slot = w->cur_slot;
+    w->cur_slot = -1;
+
+    if (w->num_writers == 0) {
+        w->write_fn(w->ctx, year, doy, w->slots + job.slot * w->slot_len);
+        pthread_mutex_lock(&sh->lock);
+        sh->free_list[sh->num_free++] = job.slot;
+        pthread_mutex_unlock(&sh->lock);
+        sem_post(&sh->free_slots);
+        return;
+    }
+
+    pthread_mutex_lock(&sh->lock);
+    sh->queue[sh->tail % MAX_WRITER_SLOTS] = job;
+    sh->tail++;
+    pthread_mutex_unlock(&sh->lock);
+    sem_post(&sh->jobs);
+}
+
+/* Wait for every submitted day to be written and stop the writers.
+ * Returns the number of writers that failed. */
+int day_writer_finish(day_writer *w) {
+    pool_shared *sh = w->shared;
+    int i, status, failed = 0;
+
+    pthread_mutex_lock(&sh->lock);
+    sh->stop = 1;
+    pthread_mutex_unlock(&sh->lock);
+    for (i = 0; i < w->num_writers; i++)
+        sem_post(&sh->jobs);
+
+    for (i = 0; i < w->num_writers; i++) {
+        while (waitpid(w->pids[i], &status, 0) < 0 && errno == EINTR);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "ERROR, writer process %d failed!\n", (int)w->pids[i]);
+            failed++;
+        }
+    }
+
+    sem_destroy(&sh->free_slots);
+    sem_destroy(&sh->jobs);
+    pthread_mutex_destroy(&sh->lock);
+    munmap(sh, w->map_len);
+    free(w);
+    return failed;
+}
@@ -0,0 +1,29 @@
+/*
+ * day_writer.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef DAY_WRITER_H_
+#define DAY_WRITER_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* most days waiting to be written at once */
+#define MAX_WRITER_SLOTS 64
+#define MAX_WRITERS 32
+
+/* Writes the file of one day from the slot data, runs in a writer process */
+typedef void (*day_write_fn)(void *ctx, int year, int doy, const float *data);
+
+typedef struct day_writer day_writer;
+
+day_writer *day_writer_start(int num_writers, int num_slots, size_t slot_len,
+        day_write_fn write_fn, void *ctx);
+float *day_writer_slot(day_writer *w);
+void day_writer_submit(day_writer *w, int year, int doy);
+int day_writer_finish(day_writer *w);
+
+#endif /* DAY_WRITER_H_ */
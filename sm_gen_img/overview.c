@@ -0,0 +1,158 @@
+/*
+ * overview.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Downsampled overviews of the day images, for browsing a season without
+ *  loading every full resolution image. Each level halves the one before
+ *  it with a 2x2 box filter. NaN pixels (ocean, no data) are left out of
+ *  the mean instead of making the whole box NaN, and a count of the valid
+ *  full resolution pixels is carried along, so the 4x and 8x levels are
+ *  the true mean of their 16 or 64 pixels and not a mean of means. With
+ *  AVX2, 16 columns of two rows are done at a time: the valid pixels are
+ *  masked and weighted, the rows added, and neighbouring columns summed
+ *  with a horizontal add. The scalar code adds in the same order, so both
+ *  give the same result.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "overview.h"
+
+/* weighted value of one input pixel, 0 if it is outside or has no data */
+static inline void pixel(const float *src, const float *src_w, int rows, int cols,
+        int r, int c, float *val, float *w) {
+    size_t i = (size_t)r*cols + c;
+
+    *val = 0;
+    *w = 0;
+    if (r >= rows || c >= cols)
+        return;
+    if (src_w)
+        *w = src_w[i];
+    else
+        *w = isnan(src[i]) ? 0 : 1;
+    if (*w > 0)
+        *val = src[i] * *w;
+    return;
+}
+
+/* Plain 2x2 box for output pixels (i, j0..j1-1), also does the edges */
+static void down2_span(const float *src, const float *src_w, int rows, int cols,
+        float *dst, float *dst_w, int dst_cols, int i, int j0, int j1) {
+    float a0, a1, b0, b1, wa0, wa1, wb0, wb1;
+    float sum, n;
+    int j;
+
+    for (j = j0; j < j1; j++) {
+        pixel(src, src_w, rows, cols, 2*i, 2*j, &a0, &wa0);
+        pixel(src, src_w, rows, cols, 2*i, 2*j+1, &a1, &wa1);
+        pixel(src, src_w, rows, cols, 2*i+1, 2*j, &b0, &wb0);
+        pixel(src, src_w, rows, cols, 2*i+1, 2*j+1, &b1, &wb1);
+        sum = (a0 + b0) + (a1 + b1);
+        n = (wa0 + wb0) + (wa1 + wb1);
+        dst[(size_t)i*dst_cols + j] = sum / n;     /* 0/0 without data, like the AVX2 code */
+        dst_w[(size_t)i*dst_cols + j] = n;
+    }
+    return;
+}
+
+#ifdef __AVX2__
+
+/* weight of 8 pixels and the weighted values, NaN and empty pixels are 0 */
+static inline __m256 weigh8(const float *p, const float *pw, __m256 *w) {
+    __m256 v = _mm256_loadu_ps(p);
+    __m256 valid;
+
+    if (pw) {
+        *w = _mm256_loadu_ps(pw);
+        valid = _mm256_cmp_ps(*w, _mm256_setzero_ps(), _CMP_GT_OQ);
+    } else {
+        valid = _mm256_cmp_ps(v, v, _CMP_ORD_Q);
+        *w = _mm256_and_ps(valid, _mm256_set1_ps(1.0f));
+    }
+    return _mm256_and_ps(_mm256_mul_ps(v, *w), valid);
+}
+
+/* sums of neighbouring pairs of 16 floats, in order */
+static inline __m256 pair_sums(__m256 lo, __m256 hi) {
+    __m256 h = _mm256_hadd_ps(lo, hi);
+    return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(h), _MM_SHUFFLE(3,1,2,0)));
+}
+
+/* 8 output pixels from 16 columns of rows 2i and 2i+1 */
+static inline void down2_8(const float *src, const float *src_w, int cols,
+        float *dst, float *dst_w, int i, int j) {
+    size_t r0 = (size_t)2*i*cols + 2*j;
+    size_t r1 = r0 + cols;
+    const float *w0 = src_w ? src_w + r0 : NULL;
+    const float *w1 = src_w ? src_w + r1 : NULL;
+    __m256 a0, a1, b0, b1, wa0, wa1, wb0, wb1;
+    __m256 sum, n, out;
+
+    a0 = weigh8(src + r0, w0, &wa0);
+    a1 = weigh8(src + r0 + 8, w0 ? w0 + 8 : NULL, &wa1);
+    b0 = weigh8(src + r1, w1, &wb0);
+    b1 = weigh8(src + r1 + 8, w1 ? w1 + 8 : NULL, &wb1);
+
+    sum = pair_sums(_mm256_add_ps(a0, b0), _mm256_add_ps(a1, b1));
+    n = pair_sums(_mm256_add_ps(wa0, wb0), _mm256_add_ps(wa1, wb1));
+
+    /* boxes without data are 0/0 */
+    out = _mm256_div_ps(sum, n);
+    _mm256_storeu_ps(dst, out);
+    _mm256_storeu_ps(dst_w, n);
+    return;
+}
+
+#endif
+
+void overview_down2(const float *src, const float *src_w, int rows, int cols,
+        float *dst, float *dst_w) {
+    int dst_rows = (rows + 1) / 2;
+    int dst_cols = (cols + 1) / 2;
+    int i, j;
+
+    for (i = 0; i < dst_rows; i++) {
+        j = 0;
+#ifdef __AVX2__
+        if (2*i + 1 < rows) {
+            for (; 2*j + 16 <= cols; j += 8)
+                down2_8(src, src_w, cols, dst + (size_t)i*dst_cols + j,
+                        dst_w + (size_t)i*dst_cols + j, i, j);
+        }
+#endif
+        down2_span(src, src_w, rows, cols, dst, dst_w, dst_cols, i, j, dst_cols);
+    }
+    return;
+}
+
+void overview_build(const float *img, int rows, int cols, float **levels) {
+    size_t w_len = (size_t)OVERVIEW_LEN(rows, 0) * OVERVIEW_LEN(cols, 0);
+    float *w[2];
+    int k;
+
+    w[0] = (float*)malloc(sizeof(float)*w_len);
+    w[1] = (float*)malloc(sizeof(float)*w_len);
+    if (!w[0] || !w[1]) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+
+    overview_down2(img, NULL, rows, cols, levels[0], w[0]);
+    for (k = 1; k < OVERVIEW_LEVELS; k++) {
+        overview_down2(levels[k-1], w[(k-1)%2], OVERVIEW_LEN(rows, k-1), OVERVIEW_LEN(cols, k-1),
+                levels[k], w[k%2]);
+    }
+
+    free(w[0]);
+    free(w[1]);
+    return;
+}
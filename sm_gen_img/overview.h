@@ -0,0 +1,27 @@
+/*
+ * overview.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef OVERVIEW_H_
+#define OVERVIEW_H_
+
+/* 2x, 4x and 8x overviews */
+#define OVERVIEW_LEVELS 3
+#define OVERVIEW_FACTOR(k) (2 << (k))
+#define OVERVIEW_LEN(n, k) (((n) + OVERVIEW_FACTOR(k) - 1) / OVERVIEW_FACTOR(k))
+
+/* Halve an image with a 2x2 box filter that skips NaN pixels. src_w holds
+ * the pixel counts behind each src pixel, NULL for a full resolution image
+ * (1, or 0 for NaN). dst_w gets the counts of the output pixels. */
+void overview_down2(const float *src, const float *src_w, int rows, int cols,
+        float *dst, float *dst_w);
+
+/* Every overview level of an image, levels[k] is OVERVIEW_LEN(rows, k) x
+ * OVERVIEW_LEN(cols, k). Each pixel is the mean of the valid full
+ * resolution pixels under it, NaN if there are none. */
+void overview_build(const float *img, int rows, int cols, float **levels);
+
+#endif /* OVERVIEW_H_ */
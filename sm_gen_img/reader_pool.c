@@ -0,0 +1,256 @@
+/*
+ * reader_pool.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Pool of reader processes for the input NetCDF files. NetCDF/HDF5 isn't
+ *  thread safe, so the threads used to take turns with a global lock held
+ *  from nc_open to nc_close, and only one file was read and decompressed
+ *  at a time no matter how many threads there were. Forked readers each
+ *  have their own copy of the library and read at the same time. A thread
+ *  asks for a read with a small request (which row or file, which days),
+ *  the next free reader reads it into a slot in shared memory, and the
+ *  thread works on the slot and releases it. The readers are forked when
+ *  the pool is started, so start it early, before the big arrays are
+ *  allocated and before any threads or NetCDF files are opened.
+ *
+ *  With 0 readers the threads read themselves, one at a time, the same way
+ *  as before the pool. A program that also reads files outside the pool
+ *  passes its own lock, so those reads take turns with the pool's.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "reader_pool.h"
+
+/* lives in shared memory, seen by every process */
+typedef struct {
+    sem_t free_slots;                   /* slots that can be asked for */
+    sem_t jobs;                         /* requested reads and stop requests */
+    sem_t done[MAX_READER_SLOTS];       /* the read of a slot is finished */
+    pthread_mutex_t lock;               /* free list and queue */
+    int free_list[MAX_READER_SLOTS];
+    int num_free;
+    int queue[MAX_READER_SLOTS];
+    int head;
+    int tail;
+    int stop;
+    int status[MAX_READER_SLOTS];
+    char req[MAX_READER_SLOTS][READER_MAX_REQ];
+} pool_shared;
+
+struct reader_pool {
+    pool_shared *shared;
+    char *slots;
+    size_t slot_len;
+    size_t slot_stride;
+    size_t map_len;
+    int num_slots;
+    int num_readers;
+    pid_t pids[MAX_READERS];
+    pthread_mutex_t own_lock;
+    pthread_mutex_t *read_lock;         /* reads without readers */
+    reader_read_fn read_fn;
+    void *ctx;
+};
+
+/* Take reads off the queue until told to stop and the queue is empty */
+static void reader_loop(reader_pool *p) {
+    pool_shared *sh = p->shared;
+    int slot;
+
+    for (;;) {
+        while (sem_wait(&sh->jobs) && errno == EINTR);
+        pthread_mutex_lock(&sh->lock);
+        if (sh->head == sh->tail) {
+            /* only a stop request wakes us with nothing queued */
+            pthread_mutex_unlock(&sh->lock);
+            return;
+        }
+        slot = sh->queue[sh->head % MAX_READER_SLOTS];
+        sh->head++;
+        pthread_mutex_unlock(&sh->lock);
+
+        sh->status[slot] = p->read_fn(p->ctx, sh->req[slot],
+                p->slots + slot * p->slot_stride, p->slot_len);
+        sem_post(&sh->done[slot]);
+    }
+}
+
+reader_pool *reader_pool_start(int num_readers, int num_slots, size_t slot_len,
+        reader_read_fn read_fn, void *ctx, pthread_mutex_t *read_lock) {
+    reader_pool *p = (reader_pool*)calloc(1, sizeof(reader_pool));
+    pthread_mutexattr_t attr;
+    pool_shared *sh;
+    int i;
+
+    if (!p) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+    if (num_readers > MAX_READERS)
+        num_readers = MAX_READERS;
+    if (num_slots > MAX_READER_SLOTS)
+        num_slots = MAX_READER_SLOTS;
+    if (num_slots < 1)
+        num_slots = 1;
+    p->num_readers = num_readers;
+    p->num_slots = num_slots;
+    p->slot_len = slot_len;
+    p->slot_stride = (slot_len + 63) / 64 * 64;
+    p->read_fn = read_fn;
+    p->ctx = ctx;
+    pthread_mutex_init(&p->own_lock, NULL);
+    p->read_lock = read_lock ? read_lock : &p->own_lock;
+
+    /* the control block followed by the slots, shared with the readers */
+    p->map_len = (sizeof(pool_shared) + 63) / 64 * 64 + p->slot_stride * num_slots;
+    sh = (pool_shared*)mmap(NULL, p->map_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sh == MAP_FAILED) {
+        perror("Error mapping reader slots");
+        exit(-1);
+    }
+    p->shared = sh;
+    p->slots = (char*)sh + (sizeof(pool_shared) + 63) / 64 * 64;
+
+    sem_init(&sh->free_slots, 1, num_slots);
+    sem_init(&sh->jobs, 1, 0);
+    for (i = 0; i < num_slots; i++)
+        sem_init(&sh->done[i], 1, 0);
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&sh->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    for (i = 0; i < num_slots; i++)
+        sh->free_list[i] = i;
+    sh->num_free = num_slots;
+
+    fflush(stdout);
+    for (i = 0; i < num_readers; i++) {
+        p->pids[i] = fork();
+        if (p->pids[i] < 0) {
+            perror("Error starting reader");
+            exit(-1);
+        }
+        if (p->pids[i] == 0) {
+            reader_loop(p);
+            _exit(0);
+        }
+    }
+    return p;
+}
+
+/* Wait on a semaphore the readers post, and give up if one of them died
+ * since it would never post it */
+static void wait_readers(reader_pool *p, sem_t *sem) {
+    struct timespec ts;
+    int i, status;
+
+    for (;;) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        if (sem_timedwait(sem, &ts) == 0)
+            return;
+        if (errno != ETIMEDOUT && errno != EINTR) {
+            perror("Error waiting for a reader");
+            exit(-1);
+        }
+        for (i = 0; i < p->num_readers; i++) {
+            if (p->pids[i] > 0 && waitpid(p->pids[i], &status, WNOHANG) == p->pids[i]) {
+                fprintf(stderr, "ERROR, reader process %d stopped!\n", (int)p->pids[i]);
+                exit(-1);
+            }
+        }
+    }
+}
+
+/* Read what req asks for and return the slot holding it, status gets the
+ * return value of the read function. Can be called from any number of
+ * threads at once, each has to release its slot when done with it. */
+void *reader_pool_read(reader_pool *p, const void *req, size_t req_len, int *status) {
+    pool_shared *sh = p->shared;
+    char *data;
+    int slot;
+
+    if (req_len > READER_MAX_REQ) {
+        fprintf(stderr, "ERROR, read request of %zu bytes is too long!\n", req_len);
+        exit(-1);
+    }
+
+    wait_readers(p, &sh->free_slots);
+    pthread_mutex_lock(&sh->lock);
+    slot = sh->free_list[--sh->num_free];
+    pthread_mutex_unlock(&sh->lock);
+    data = p->slots + slot * p->slot_stride;
+    memcpy(sh->req[slot], req, req_len);
+
+    if (p->num_readers == 0) {
+        pthread_mutex_lock(p->read_lock);
+        *status = p->read_fn(p->ctx, sh->req[slot], data, p->slot_len);
+        pthread_mutex_unlock(p->read_lock);
+        return data;
+    }
+
+    pthread_mutex_lock(&sh->lock);
+    sh->queue[sh->tail % MAX_READER_SLOTS] = slot;
+    sh->tail++;
+    pthread_mutex_unlock(&sh->lock);
+    sem_post(&sh->jobs);
+
+    wait_readers(p, &sh->done[slot]);
+    *status = sh->status[slot];
+    return data;
+}
+
+/* Give back a slot from reader_pool_read */
+void reader_pool_release(reader_pool *p, void *slot) {
+    pool_shared *sh = p->shared;
+
+    pthread_mutex_lock(&sh->lock);
+    sh->free_list[sh->num_free++] = (int)(((char*)slot - p->slots) / p->slot_stride);
+    pthread_mutex_unlock(&sh->lock);
+    sem_post(&sh->free_slots);
+}
+
+/* Stop the readers, once every read has been released. Returns the number
+ * of readers that failed. */
+int reader_pool_finish(reader_pool *p) {
+    pool_shared *sh = p->shared;
+    int i, status, failed = 0;
+
+    pthread_mutex_lock(&sh->lock);
+    sh->stop = 1;
+    pthread_mutex_unlock(&sh->lock);
+    for (i = 0; i < p->num_readers; i++)
+        sem_post(&sh->jobs);
+
+    for (i = 0; i < p->num_readers; i++) {
+        while (waitpid(p->pids[i], &status, 0) < 0 && errno == EINTR);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "ERROR, reader process %d failed!\n", (int)p->pids[i]);
+            failed++;
+        }
+    }
+
+    sem_destroy(&sh->free_slots);
+    sem_destroy(&sh->jobs);
+    for (i = 0; i < p->num_slots; i++)
+        sem_destroy(&sh->done[i]);
+    pthread_mutex_destroy(&sh->lock);
+    pthread_mutex_destroy(&p->own_lock);
+    munmap(sh, p->map_len);
+    free(p);
+    return failed;
+}
@@ -0,0 +1,34 @@
+/*
+ * reader_pool.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef READER_POOL_H_
+#define READER_POOL_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+/* most reads in flight at once */
+#define MAX_READER_SLOTS 64
+#define MAX_READERS 32
+
+/* bytes describing one read, copied to the reader */
+#define READER_MAX_REQ 64
+
+/* Reads what req asks for into the slot, runs in a reader process.
+ * Returns 0, or an error for the thread that asked. */
+typedef int (*reader_read_fn)(void *ctx, const void *req, void *slot, size_t slot_len);
+
+typedef struct reader_pool reader_pool;
+
+reader_pool *reader_pool_start(int num_readers, int num_slots, size_t slot_len,
+        reader_read_fn read_fn, void *ctx, pthread_mutex_t *read_lock);
+void *reader_pool_read(reader_pool *p, const void *req, size_t req_len, int *status);
+void reader_pool_release(reader_pool *p, void *slot);
+int reader_pool_finish(reader_pool *p);
+
+#endif /* READER_POOL_H_ */
@@ -15,9 +15,17 @@
 #include <unistd.h>
 
 #include <pthread.h>
+#include <time.h>
+#include <math.h>
 
 #include <netcdf.h>
 
+#include "transpose.h"
+#include "day_writer.h"
+#include "zarr_store.h"
+#include "overview.h"
+#include "reader_pool.h"
+
 #define NUM_DAYS 365
 #define YEAR_START 2009
 
@@ -32,7 +40,6 @@
 #define ERR(e) {printf("Error: %s\n", nc_strerror(e)); exit(2);}
 
 // some global mutexes
-pthread_mutex_t fopen_lock;
 pthread_mutex_t fclose_lock;
 pthread_mutex_t netcdfop_lock;
 
@@ -48,6 +55,15 @@ static char args_doc[] = "Region";
 static struct argp_option options[] = {
   {"verbose",  'v', 0,      0,  "Produce verbose output" },
   {"grd",  'g', 0,      0,  "Generate grd images" },
+  {"rows",  'r', "START:END", 0,  "Only compile rows START to END (1-based) into shard images" },
+  {"bench",  'b', 0,      0,  "Time the row scatter against the old rearrange loop and exit" },
+  {"memory",  'm', "GB",   0,  "Build the images a block of days at a time to stay under GB of memory" },
+  {"writers",  'w', "N",    0,  "Processes writing the daily files (default 8, 0 to write them in this one)" },
+  {"cube",  'c', 0,      0,  "Write one time-chunked file per year (swi_<region>_<year>.nc) instead of one per day" },
+  {"deflate",  'z', "LEVEL", 0,  "Deflate level of the images, 0 to 9 (default 1, 0 for no compression)" },
+  {"zarr",  'Z', 0,      0,  "Write one Zarr store per year (swi_<region>_<year>.zarr) instead of NetCDF files" },
+  {"overviews",  'o', 0,      0,  "Also save 2x, 4x and 8x downsampled swi and ms images for browsing" },
+  {"readers",  'R', "N",    0,  "Processes reading the row files (default 8, 0 to read them in the threads one at a time)" },
   { 0 }
 };
 
@@ -57,6 +73,16 @@ struct arguments
   char *region;                /* Region */
   int verbose;
   int grd;
+  int row_start;
+  int row_end;
+  int bench;
+  double memory;               /* GB, 0 for all days at once */
+  int writers;
+  int cube;
+  int deflate;
+  int zarr;
+  int overviews;
+  int readers;
 };
 
 /* Parse a single option. */
@@ -75,6 +101,43 @@ parse_opt (int key, char *arg, struct argp_state *state)
     case 'g':
       arguments->grd = 1;
       break;
+    case 'b':
+      arguments->bench = 1;
+      break;
+    case 'c':
+      arguments->cube = 1;
+      break;
+    case 'Z':
+      arguments->zarr = 1;
+      break;
+    case 'o':
+      arguments->overviews = 1;
+      break;
+    case 'z':
+      arguments->deflate = atoi(arg);
+      if (arguments->deflate < 0 || arguments->deflate > 9)
+          argp_failure(state, 1, 0, "ERROR, deflate level must be 0 to 9!");
+      break;
+    case 'w':
+      arguments->writers = atoi(arg);
+      if (arguments->writers < 0 || arguments->writers > MAX_WRITERS)
+          argp_failure(state, 1, 0, "ERROR, number of writers must be 0 to %d!", MAX_WRITERS);
+      break;
+    case 'R':
+      arguments->readers = atoi(arg);
+      if (arguments->readers < 0 || arguments->readers > MAX_READERS)
+          argp_failure(state, 1, 0, "ERROR, number of readers must be 0 to %d!", MAX_READERS);
+      break;
+    case 'm':
+      arguments->memory = atof(arg);
+      if (arguments->memory <= 0)
+          argp_failure(state, 1, 0, "ERROR, memory budget must be positive!");
+      break;
+    case 'r':
+      if (sscanf(arg, "%d:%d", &arguments->row_start, &arguments->row_end) != 2 ||
+              arguments->row_start < 1 || arguments->row_end < arguments->row_start)
+          argp_failure(state, 1, 0, "ERROR, could not parse row range %s!", arg);
+      break;
     case ARGP_KEY_ARG:
       if (state->arg_num >= 1) {
         /* Too many arguments. */
@@ -151,135 +214,718 @@ void checkdir(char* dirname) {
     return;
 }
 
+/* only every other day is written */
+#define NUM_OUT_DAYS ((NUM_DAYS+1)/2)
+
+/* floats between day images, padded so every image starts on a cache line
+ * and the transpose can write whole lines */
+#define PLANE_LEN(rows, cols) (((size_t)(rows)*(cols) + TRANSPOSE_TILE-1) / TRANSPOSE_TILE * TRANSPOSE_TILE)
+
+/* rows of images moved by --bench */
+#define BENCH_ROWS 128
+#define BENCH_REPS 3
+
+/* writer processes, and days waiting for them per writer */
+#define DEFAULT_WRITERS 8
+#define SLOTS_PER_WRITER 2
+
+/* reader processes, and row files read or being scattered per reader */
+#define DEFAULT_READERS 8
+#define SLOTS_PER_READER 2
+
+/* Chunks of the yearly cube files: 64 x 64 pixels x 16 days (256 KB).
+ * A day map reads 16 days worth of chunks and a pixel's year reads 12
+ * chunks, instead of one file per day or the whole year of a map. */
+#define CUBE_CHUNK_PIX 64
+#define CUBE_CHUNK_DAYS 16
+
+/* Most of an image is ocean or unobserved, so a fast deflate level with
+ * the byte shuffle shrinks the files a lot without slowing the writes */
+#define DEFAULT_DEFLATE 1
+
+/* Chunks of the Zarr stores: one day x 128 rows x 512 columns (256 KB).
+ * Shards written with --zarr have to start on a chunk row. */
+#define ZARR_CHUNK_ROWS 128
+#define ZARR_CHUNK_COLS 512
+
+/* swi and ms get overviews, they are the first two images of a slot */
+#define NUM_OV_VARS 2
+static const char *ov_names[NUM_OV_VARS] = {"swi", "ms"};
+
+/* Days put into the images in one pass over the row files: either some
+ * whole years, or part of one year. day0 is always even. */
+typedef struct {
+    int year0;
+    int num_years;
+    int day0;
+    int num_days;       /* days read from the row files */
+} day_block;
+
+#define BLOCK_OUT_DAYS(b) (((b)->num_days + 1) / 2)
+
+/* A row file read for a block, what the threads ask the readers for */
+typedef struct {
+    int row;            /* 1-based row of the whole image */
+    day_block block;
+} row_request;
+
+/* What the readers need to read a row file */
+typedef struct {
+    char *region;
+    int num_columns;
+} reader_ctx;
+
 typedef struct {
-    float ****swi_ts;
-    float ****ms_ts;
-    float ****dry_ts;
-    float ****tmp;
+    day_block *block;
+    float ****swi_img;
+    float ****ms_img;
+    float ****dry_img;
+    reader_pool *readers;
     int start_i;
     int stop_i;
+    int num_rows;       /* rows in the image arrays */
     int num_columns;
+    int row_offset;     /* first row of the shard, 0 for the whole image */
     char *region;
-    pthread_mutex_t *fopen_lock;
     pthread_mutex_t *fclose_lock;
     pthread_mutex_t *netcdfop_lock;
 } thread_args;
 
+/* Day-major [year][day][row][col] array of written days. The rows of one
+ * day are contiguous, the days are PLANE_LEN apart. */
+float ****alloc_day_cube(int num_years, int num_days, int num_rows, int num_columns) {
+    size_t plane_len = PLANE_LEN(num_rows, num_columns);
+    float ****year_ptr = (float****)malloc(sizeof(float ***)*num_years);
+    float ***day_ptr = (float***)malloc(sizeof(float **)*num_years*num_days);
+    float **row_ptr = (float**)malloc(sizeof(float *)*num_days*num_years*num_rows);
+    float *column_ptr = NULL;
+    float ****cube = year_ptr;
+    int i, j, k;
+
+    if (posix_memalign((void**)&column_ptr, 64, sizeof(float)*num_days*num_years*plane_len))
+        column_ptr = NULL;
+    if (!year_ptr || !day_ptr || !row_ptr || !column_ptr) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+    for (i = 0; i < num_years; i++, day_ptr += num_days) {
+        cube[i] = day_ptr;
+        for (j = 0; j < num_days; j++, row_ptr += num_rows) {
+            cube[i][j] = row_ptr;
+            for (k = 0; k < num_rows; k++) {
+                cube[i][j][k] = column_ptr + k*num_columns;
+            }
+            column_ptr += plane_len;
+        }
+    }
+    return cube;
+}
+
+void free_day_cube(float ****cube) {
+    free(cube[0][0][0]);
+    free(cube[0][0]);
+    free(cube[0]);
+    free(cube);
+    return;
+}
+
+/* Scatter the block of one row file, [col][year][day], into row i of the
+ * day images */
+void scatter_row(float *row_buf, float ****img, int i, int num_rows, int num_columns,
+        day_block *block) {
+    int k;
+
+    /* the days of a year are PLANE_LEN apart in the cube */
+    for (k = 0; k < block->num_years; k++) {
+        transpose_f32(row_buf + k*block->num_days, block->num_years*block->num_days, 2,
+                &img[k][0][i][0], PLANE_LEN(num_rows, num_columns), num_columns,
+                BLOCK_OUT_DAYS(block));
+    }
+    return;
+}
+
+/* The rearrange loop sm_gen_img used to have, for --bench */
+void scatter_row_naive(float *row_buf, float ****img, int i, int num_columns) {
+    int j, k, m;
+
+    for (j = 0; j < num_columns; j++) {
+        for (k = 0; k < NUM_YEARS; k++) {
+            for (m = 0; m < NUM_DAYS; m += 2) {
+                img[k][m/2][i][j] = row_buf[((size_t)j*NUM_YEARS + k)*NUM_DAYS + m];
+            }
+        }
+    }
+    return;
+}
+
+double elapsed(struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/* Time the scatter of BENCH_ROWS synthetic rows with the old loop and
+ * with the tiled transpose, in GB/s of image data written */
+void bench_scatter(int num_columns) {
+    size_t row_len = (size_t)num_columns*NUM_YEARS*NUM_DAYS;
+    double bytes = (double)BENCH_ROWS*num_columns*NUM_YEARS*NUM_OUT_DAYS*sizeof(float);
+    float *row_buf = (float*)malloc(sizeof(float)*row_len);
+    float ****img = alloc_day_cube(NUM_YEARS, NUM_OUT_DAYS, BENCH_ROWS, num_columns);
+    day_block all = {0, NUM_YEARS, 0, NUM_DAYS};
+    double t_naive = 1e30, t_tiled = 1e30, t;
+    struct timespec t0;
+    size_t n;
+    int i, rep;
+
+    if (!row_buf) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+    for (n = 0; n < row_len; n++)
+        row_buf[n] = (float)n;
+    /* touch the images once so page faults aren't timed */
+    memset(img[0][0][0], 0, sizeof(float)*NUM_YEARS*NUM_OUT_DAYS*PLANE_LEN(BENCH_ROWS, num_columns));
+
+    for (rep = 0; rep < BENCH_REPS; rep++) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (i = 0; i < BENCH_ROWS; i++)
+            scatter_row_naive(row_buf, img, i, num_columns);
+        t = elapsed(&t0);
+        t_naive = t < t_naive ? t : t_naive;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (i = 0; i < BENCH_ROWS; i++)
+            scatter_row(row_buf, img, i, BENCH_ROWS, num_columns, &all);
+        t = elapsed(&t0);
+        t_tiled = t < t_tiled ? t : t_tiled;
+    }
+
+    printf("Scatter of %d rows x %d columns, best of %d:\n", BENCH_ROWS, num_columns, BENCH_REPS);
+    printf("    old loop:  %7.3f s  %6.2f GB/s\n", t_naive, bytes / t_naive / 1e9);
+    printf("    transpose: %7.3f s  %6.2f GB/s\n", t_tiled, bytes / t_tiled / 1e9);
+
+    free(row_buf);
+    free_day_cube(img);
+    return;
+}
+
+/* Reader process side, reads swi, ms and dry of the block from one row
+ * file into the slot, one after the other */
+int read_row_file(void *ctx, const void *req, void *slot, size_t slot_len) {
+    reader_ctx *r = (reader_ctx*)ctx;
+    const row_request *rq = (const row_request*)req;
+    const day_block *block = &rq->block;
+    static const char *var_names[3] = {"swi", "ms", "dry"};
+    size_t row_len = (size_t)r->num_columns*block->num_years*block->num_days;
+    size_t start[4] = {0, 0, block->year0, block->day0};
+    size_t count[4] = {1, r->num_columns, block->num_years, block->num_days};
+    float *row_buf = (float*)slot;
+    char fname[100];
+    int v;
+    int retval, ncid1, varid;
+
+    if (sizeof(float)*3*row_len > slot_len)
+        return NC_ENOMEM;
+
+    sprintf(fname,"/auto/temp/lindell/soilmoisture/swi/swi_%s_%04d.nc",r->region,rq->row);
+    if ((retval = nc_open(fname, NC_NOWRITE, &ncid1)))
+        return retval;
+
+    /* read values from netCDF variables */
+    for (v = 0; v < 3; v++) {
+        if ((retval = nc_inq_varid(ncid1, var_names[v], &varid)) ||
+                (retval = nc_get_vara_float(ncid1, varid, start, count, row_buf + v*row_len))) {
+            nc_close(ncid1);
+            return retval;
+        }
+    }
+
+    return nc_close(ncid1);
+}
+
+/* Have each row file read and put it straight into the day images */
 void *mthreadGetImgData(void *arg) {
     thread_args *t_args = (thread_args*)arg;
-    float ****swi_ts = t_args->swi_ts;
-    float ****ms_ts = t_args->ms_ts;
-    float ****dry_ts = t_args->dry_ts;
+    float ****img[3] = {t_args->swi_img, t_args->ms_img, t_args->dry_img};
     int start_row = t_args->start_i;
     int stop_row = t_args->stop_i;
-    char *region = t_args->region;
-    pthread_mutex_t *fopen_lock = t_args->fopen_lock;
-    char fname[100];
-    int i;
-    int retval, ncid1, swi_varid, ms_varid, dry_varid;
+    int num_rows = t_args->num_rows;
+    int num_columns = t_args->num_columns;
+    int row_offset = t_args->row_offset;
+    day_block *block = t_args->block;
+    size_t row_len = (size_t)num_columns*block->num_years*block->num_days;
+    row_request req;
+    float *row_buf;
+    int i, v;
+    int retval;
+
+    req.block = *block;
 
     // for all pixel files, grab the value and store in the image arrays
     for (i = start_row; i <= stop_row; i++) {
         setvbuf (stdout, NULL, _IONBF, 0);
-        printf("Processing Row: %04d\n",i+1);
+        printf("Processing Row: %04d\n",i+row_offset+1);
+
+        /* read by the next free reader while the other threads scatter */
+        req.row = i+row_offset+1;
+        row_buf = (float*)reader_pool_read(t_args->readers, &req, sizeof(req), &retval);
+        if (retval)
+            ERR(retval);
+
+        for (v = 0; v < 3; v++)
+            scatter_row(row_buf + v*row_len, img[v], i, num_rows, num_columns, block);
 
-        /* Open netcdf file */
-        pthread_mutex_lock(fopen_lock);
-        sprintf(fname,"/auto/temp/lindell/soilmoisture/swi/swi_%s_%04d.nc",region,i+1);
+        reader_pool_release(t_args->readers, row_buf);
+    }
+
+    return NULL;
+}
 
-        if ((retval = nc_open(fname, NC_NOWRITE, &ncid1)))
+/* NaN marks pixels without data, tell readers with _FillValue and
+ * compress the variable */
+void def_image_storage(int ncid, int varid, int deflate) {
+    float fill = NAN;
+    int retval;
+
+    if ((retval = nc_def_var_fill(ncid, varid, 0, &fill)))
+        ERR(retval);
+    if (deflate > 0) {
+        if ((retval = nc_def_var_deflate(ncid, varid, 1, 1, deflate)))
             ERR(retval);
+    }
+    return;
+}
+
+/* 1 if the image has no data at all */
+int empty_image(const float *img, size_t len) {
+    size_t i;
 
-        /* Get the varid of the data variable, based on its name. */
-        if ((retval = nc_inq_varid(ncid1, "swi", &swi_varid)))
+    for (i = 0; i < len; i++) {
+        if (!isnan(img[i]))
+            return 0;
+    }
+    return 1;
+}
+
+/* Overviews of the swi and ms images at the start of a slot, all in one
+ * buffer (free it when done): ov[v][k] is level k of variable v */
+float *build_overviews(const float *data, int num_rows, int num_columns,
+        float *ov[NUM_OV_VARS][OVERVIEW_LEVELS]) {
+    size_t img_len = (size_t)num_rows*num_columns;
+    size_t ov_len = 0;
+    float *buf;
+    int v, k;
+
+    for (k = 0; k < OVERVIEW_LEVELS; k++)
+        ov_len += (size_t)OVERVIEW_LEN(num_rows, k)*OVERVIEW_LEN(num_columns, k);
+    buf = (float*)malloc(sizeof(float)*NUM_OV_VARS*ov_len);
+    if (!buf) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+    for (v = 0; v < NUM_OV_VARS; v++) {
+        ov[v][0] = buf + v*ov_len;
+        for (k = 1; k < OVERVIEW_LEVELS; k++)
+            ov[v][k] = ov[v][k-1] + (size_t)OVERVIEW_LEN(num_rows, k-1)*OVERVIEW_LEN(num_columns, k-1);
+        overview_build(data + v*img_len, num_rows, num_columns, ov[v]);
+    }
+    return buf;
+}
+
+/* Write the images of one day, and their overviews unless ov is NULL */
+void write_day(struct arguments *arguments, int year, int doy, const float *swi,
+        const float *ms, const float *dry, float *ov[NUM_OV_VARS][OVERVIEW_LEVELS],
+        int num_rows, int num_columns, int total_rows) {
+    char *region = arguments->region;
+    char swi_fname[100];
+    char name[NC_MAX_NAME+1];
+    int ncid, row_dimid, col_dimid;
+    int swi_varid, ms_varid, dry_varid;
+    int ov_varids[NUM_OV_VARS][OVERVIEW_LEVELS];
+    int retval, v, k;
+    int dimids[NDIMS];
+
+    if (arguments->row_start)
+        sprintf(swi_fname,"/auto/temp/lindell/soilmoisture/swi/combined/swi_%s_%04d_%03d.r%04d-%04d.nc",
+                region,year,doy,arguments->row_start,arguments->row_end);
+    else
+        sprintf(swi_fname,"/auto/temp/lindell/soilmoisture/swi/combined/swi_%s_%04d_%03d.nc",region,year,doy);
+    if ((retval = nc_create(swi_fname, NC_NETCDF4, &ncid)))
+        ERR(retval);
+
+    /* shard files record where they go, for sm_merge_shards */
+    if (arguments->row_start) {
+        if ((retval = nc_put_att_int(ncid, NC_GLOBAL, "shard_row_start", NC_INT, 1, &arguments->row_start)))
             ERR(retval);
-        if ((retval = nc_inq_varid(ncid1, "dry", &dry_varid)))
+        if ((retval = nc_put_att_int(ncid, NC_GLOBAL, "shard_row_end", NC_INT, 1, &arguments->row_end)))
             ERR(retval);
-        if ((retval = nc_inq_varid(ncid1, "ms", &ms_varid)))
+        if ((retval = nc_put_att_int(ncid, NC_GLOBAL, "shard_total_rows", NC_INT, 1, &total_rows)))
             ERR(retval);
+    }
 
-        /* read values from netCDF variable */
-        if ((retval = nc_get_var_float(ncid1, swi_varid, &swi_ts[i][0][0][0])))
+    /* Define the dimensions. */
+    if ((retval = nc_def_dim(ncid, "row", num_rows, &row_dimid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(ncid, "column", num_columns, &col_dimid)))
+        ERR(retval);
+
+    /* Define the netCDF variables. The dimids array is used to pass
+        the dimids of the dimensions of the variables.*/
+    dimids[0] = row_dimid;
+    dimids[1] = col_dimid;
+
+    /* define the variable */
+    if ((retval = nc_def_var(ncid, "swi", NC_FLOAT, NDIMS, dimids, &swi_varid)))
+        ERR(retval);
+    def_image_storage(ncid, swi_varid, arguments->deflate);
+
+    if ((retval = nc_def_var(ncid, "ms", NC_FLOAT, NDIMS, dimids, &ms_varid)))
+        ERR(retval);
+    def_image_storage(ncid, ms_varid, arguments->deflate);
+
+    if ((retval = nc_def_var(ncid, "dry", NC_FLOAT, NDIMS, dimids, &dry_varid)))
+        ERR(retval);
+    def_image_storage(ncid, dry_varid, arguments->deflate);
+
+    /* the overviews have their own smaller dimensions, e.g. swi_4x is
+     * row_4x x column_4x */
+    for (k = 0; ov && k < OVERVIEW_LEVELS; k++) {
+        sprintf(name, "row_%dx", OVERVIEW_FACTOR(k));
+        if ((retval = nc_def_dim(ncid, name, OVERVIEW_LEN(num_rows, k), &dimids[0])))
             ERR(retval);
-
-        /* read values from netCDF variable */
-        if ((retval = nc_get_var_float(ncid1, ms_varid, &ms_ts[i][0][0][0])))
+        sprintf(name, "column_%dx", OVERVIEW_FACTOR(k));
+        if ((retval = nc_def_dim(ncid, name, OVERVIEW_LEN(num_columns, k), &dimids[1])))
             ERR(retval);
+        for (v = 0; v < NUM_OV_VARS; v++) {
+            sprintf(name, "%s_%dx", ov_names[v], OVERVIEW_FACTOR(k));
+            if ((retval = nc_def_var(ncid, name, NC_FLOAT, NDIMS, dimids, &ov_varids[v][k])))
+                ERR(retval);
+            def_image_storage(ncid, ov_varids[v][k], arguments->deflate);
+        }
+    }
 
-        /* read values from netCDF variable */
-        if ((retval = nc_get_var_float(ncid1, dry_varid, &dry_ts[i][0][0][0])))
-            ERR(retval);
+    /* End define mode. */
+    if ((retval = nc_enddef(ncid)))
+        ERR(retval);
 
-        if ((retval = nc_close(ncid1)))
+    /* Write the data. */
+    if ((retval = nc_put_var_float(ncid, swi_varid, swi)))
+        ERR(retval);
+
+    if ((retval = nc_put_var_float(ncid, ms_varid, ms)))
+        ERR(retval);
+
+    if ((retval = nc_put_var_float(ncid, dry_varid, dry)))
+        ERR(retval);
+
+    for (k = 0; ov && k < OVERVIEW_LEVELS; k++) {
+        for (v = 0; v < NUM_OV_VARS; v++) {
+            if ((retval = nc_put_var_float(ncid, ov_varids[v][k], ov[v][k])))
+                ERR(retval);
+        }
+    }
+
+    /* Close the file. */
+    if ((retval = nc_close(ncid)))
+        ERR(retval);
+    return;
+}
+
+/* What the writer processes need to write a day */
+typedef struct {
+    struct arguments *arguments;
+    int num_rows;
+    int num_columns;
+    int total_rows;
+    /* the cube file being filled, only used by the one cube writer */
+    int cube_year;
+    int cube_ncid;
+    int cube_varids[3];
+    int cube_ov_varids[NUM_OV_VARS][OVERVIEW_LEVELS];
+    /* swi, ms and dry of every year for --zarr */
+    int row_offset;
+    zarr_array zarr[NUM_YEARS][3];
+    zarr_array zarr_ov[NUM_YEARS][NUM_OV_VARS][OVERVIEW_LEVELS];
+} writer_ctx;
+
+/* One image variable of a cube, rows x columns x time */
+void def_cube_var(writer_ctx *w, const char *name, const int *dimids, int rows,
+        int columns, int *varid) {
+    size_t chunks[3];
+    size_t num_chunks, cache_bytes;
+    int retval;
+
+    chunks[0] = rows < CUBE_CHUNK_PIX ? rows : CUBE_CHUNK_PIX;
+    chunks[1] = columns < CUBE_CHUNK_PIX ? columns : CUBE_CHUNK_PIX;
+    chunks[2] = CUBE_CHUNK_DAYS;
+
+    /* the days come in one at a time, so keep every chunk of the current
+     * 16 days in the cache until they are full */
+    num_chunks = ((rows + chunks[0] - 1) / chunks[0]) * ((columns + chunks[1] - 1) / chunks[1]);
+    cache_bytes = num_chunks * chunks[0] * chunks[1] * chunks[2] * sizeof(float);
+    if ((retval = nc_def_var(w->cube_ncid, name, NC_FLOAT, 3, dimids, varid)))
+        ERR(retval);
+    if ((retval = nc_def_var_chunking(w->cube_ncid, *varid, NC_CHUNKED, chunks)))
+        ERR(retval);
+    def_image_storage(w->cube_ncid, *varid, w->arguments->deflate);
+    if ((retval = nc_set_var_chunk_cache(w->cube_ncid, *varid, cache_bytes, 2*num_chunks + 1, 1.0)))
+        ERR(retval);
+    return;
+}
+
+/* Create the cube file of one year: swi, ms and dry over (row, column,
+ * time), with the days written as time coordinates */
+void create_cube(writer_ctx *w, int year) {
+    struct arguments *arguments = w->arguments;
+    char cube_fname[100];
+    char units[50];
+    char name[NC_MAX_NAME+1];
+    int row_dimid, col_dimid, time_dimid, time_varid;
+    int dimids[3];
+    int days[NUM_OUT_DAYS];
+    int retval, i, k;
+    const char *names[3] = {"swi", "ms", "dry"};
+
+    if (arguments->row_start)
+        sprintf(cube_fname,"/auto/temp/lindell/soilmoisture/swi/combined/swi_%s_%04d.r%04d-%04d.nc",
+                arguments->region,year,arguments->row_start,arguments->row_end);
+    else
+        sprintf(cube_fname,"/auto/temp/lindell/soilmoisture/swi/combined/swi_%s_%04d.nc",arguments->region,year);
+    if ((retval = nc_create(cube_fname, NC_NETCDF4, &w->cube_ncid)))
+        ERR(retval);
+
+    /* shard files record where they go, for sm_merge_shards */
+    if (arguments->row_start) {
+        if ((retval = nc_put_att_int(w->cube_ncid, NC_GLOBAL, "shard_row_start", NC_INT, 1, &arguments->row_start)))
+            ERR(retval);
+        if ((retval = nc_put_att_int(w->cube_ncid, NC_GLOBAL, "shard_row_end", NC_INT, 1, &arguments->row_end)))
             ERR(retval);
+        if ((retval = nc_put_att_int(w->cube_ncid, NC_GLOBAL, "shard_total_rows", NC_INT, 1, &w->total_rows)))
+            ERR(retval);
+    }
 
-        pthread_mutex_unlock(fopen_lock);
+    /* rows first like the row files, so sm_merge_shards can put shards
+     * of the cube together */
+    if ((retval = nc_def_dim(w->cube_ncid, "row", w->num_rows, &row_dimid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(w->cube_ncid, "column", w->num_columns, &col_dimid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(w->cube_ncid, "time", NUM_OUT_DAYS, &time_dimid)))
+        ERR(retval);
+
+    if ((retval = nc_def_var(w->cube_ncid, "time", NC_INT, 1, &time_dimid, &time_varid)))
+        ERR(retval);
+    sprintf(units, "days since %04d-01-01 00:00:00", year);
+    if ((retval = nc_put_att_text(w->cube_ncid, time_varid, "units", strlen(units), units)))
+        ERR(retval);
+    if ((retval = nc_put_att_text(w->cube_ncid, time_varid, "calendar", strlen("standard"), "standard")))
+        ERR(retval);
+
+    dimids[0] = row_dimid;
+    dimids[1] = col_dimid;
+    dimids[2] = time_dimid;
+    for (i = 0; i < 3; i++)
+        def_cube_var(w, names[i], dimids, w->num_rows, w->num_columns, &w->cube_varids[i]);
+
+    for (k = 0; arguments->overviews && k < OVERVIEW_LEVELS; k++) {
+        sprintf(name, "row_%dx", OVERVIEW_FACTOR(k));
+        if ((retval = nc_def_dim(w->cube_ncid, name, OVERVIEW_LEN(w->num_rows, k), &dimids[0])))
+            ERR(retval);
+        sprintf(name, "column_%dx", OVERVIEW_FACTOR(k));
+        if ((retval = nc_def_dim(w->cube_ncid, name, OVERVIEW_LEN(w->num_columns, k), &dimids[1])))
+            ERR(retval);
+        for (i = 0; i < NUM_OV_VARS; i++) {
+            sprintf(name, "%s_%dx", ov_names[i], OVERVIEW_FACTOR(k));
+            def_cube_var(w, name, dimids, OVERVIEW_LEN(w->num_rows, k),
+                    OVERVIEW_LEN(w->num_columns, k), &w->cube_ov_varids[i][k]);
+        }
     }
 
-    return NULL;
+    if ((retval = nc_enddef(w->cube_ncid)))
+        ERR(retval);
+
+    for (i = 0; i < NUM_OUT_DAYS; i++)
+        days[i] = 2*i;
+    if ((retval = nc_put_var_int(w->cube_ncid, time_varid, days)))
+        ERR(retval);
+    w->cube_year = year;
+    return;
 }
 
-void *mthreadSwiRearrArray(void *arg) {
-    thread_args *t_args = (thread_args*)arg;
-    float ****swi_ts = t_args->swi_ts;
-    float ****tmp = t_args->tmp;
-    int start_row = t_args->start_i;
-    int stop_row = t_args->stop_i;
-    int num_columns = t_args->num_columns;
-    int i,j,k,m;
+void close_cube(writer_ctx *w) {
+    int retval;
 
-    for (i = start_row; i <= stop_row; i++) {
-        for (j = 0; j < num_columns; j++) {
-            for (k = 0; k < NUM_YEARS; k++) {
-                for (m = 0; m < NUM_DAYS; m++) {
-                    tmp[k][m][i][j] = swi_ts[i][j][k][m];
-                }
+    if (w->cube_ncid < 0)
+        return;
+    if ((retval = nc_close(w->cube_ncid)))
+        ERR(retval);
+    w->cube_ncid = -1;
+    w->cube_year = -1;
+    return;
+}
+
+/* Writer process side for --cube, puts the day into its year's file. The
+ * days arrive in order, so the file is closed after the last day. */
+void write_cube_slot(void *ctx, int year, int doy, const float *data) {
+    writer_ctx *w = (writer_ctx*)ctx;
+    size_t img_len = (size_t)w->num_rows*w->num_columns;
+    size_t start[3] = {0, 0, (doy-1)/2};
+    size_t count[3] = {w->num_rows, w->num_columns, 1};
+    float *ov[NUM_OV_VARS][OVERVIEW_LEVELS];
+    float *ov_buf;
+    int retval, i, k;
+
+    printf("    Day: %03d Year: %04d\n", doy, year);
+    if (w->cube_year != year) {
+        close_cube(w);
+        create_cube(w, year);
+    }
+    for (i = 0; i < 3; i++) {
+        if ((retval = nc_put_vara_float(w->cube_ncid, w->cube_varids[i], start, count, data + i*img_len)))
+            ERR(retval);
+    }
+    if (w->arguments->overviews) {
+        ov_buf = build_overviews(data, w->num_rows, w->num_columns, ov);
+        for (k = 0; k < OVERVIEW_LEVELS; k++) {
+            count[0] = OVERVIEW_LEN(w->num_rows, k);
+            count[1] = OVERVIEW_LEN(w->num_columns, k);
+            for (i = 0; i < NUM_OV_VARS; i++) {
+                if ((retval = nc_put_vara_float(w->cube_ncid, w->cube_ov_varids[i][k], start, count, ov[i][k])))
+                    ERR(retval);
             }
         }
+        free(ov_buf);
     }
-    return NULL;
+    if ((doy-1)/2 == NUM_OUT_DAYS-1)
+        close_cube(w);
+    return;
 }
 
-void *mthreadMsRearrArray(void *arg) {
-    thread_args *t_args = (thread_args*)arg;
-    float ****ms_ts = t_args->ms_ts;
-    float ****tmp = t_args->tmp;
-    int start_row = t_args->start_i;
-    int stop_row = t_args->stop_i;
-    int num_columns = t_args->num_columns;
-    int i,j,k,m;
+/* Writer process side, the slot holds the swi, ms and dry images */
+void write_day_slot(void *ctx, int year, int doy, const float *data) {
+    writer_ctx *w = (writer_ctx*)ctx;
+    size_t img_len = (size_t)w->num_rows*w->num_columns;
+    float *ov[NUM_OV_VARS][OVERVIEW_LEVELS];
+    float *ov_buf = NULL;
+
+    printf("    Day: %03d Year: %04d\n", doy, year);
+    if (w->arguments->overviews)
+        ov_buf = build_overviews(data, w->num_rows, w->num_columns, ov);
+    write_day(w->arguments, year, doy, data, data + img_len, data + 2*img_len,
+            ov_buf ? ov : NULL, w->num_rows, w->num_columns, w->total_rows);
+    free(ov_buf);
+    return;
+}
 
-    for (i = start_row; i <= stop_row; i++) {
-        for (j = 0; j < num_columns; j++) {
-            for (k = 0; k < NUM_YEARS; k++) {
-                for (m = 0; m < NUM_DAYS; m++) {
-                    tmp[k][m][i][j] = ms_ts[i][j][k][m];
-                }
-            }
+/* List the days that were skipped because they had no data */
+void write_empty_index(char *region, char empty[NUM_YEARS][NUM_OUT_DAYS], int num_empty) {
+    char index_fname[100];
+    FILE *fid;
+    int i, j;
+
+    sprintf(index_fname,"/auto/temp/lindell/soilmoisture/swi/combined/swi_%s_empty.txt",region);
+    fid = fopen(index_fname, "w");
+    if (fid == NULL) {
+        fprintf(stderr,"*** could not write empty day index %s\n",index_fname);
+        return;
+    }
+    fprintf(fid, "# %d day(s) without data, not written (year doy)\n", num_empty);
+    for (i = 0; i < NUM_YEARS; i++) {
+        for (j = 0; j < NUM_OUT_DAYS; j++) {
+            if (empty[i][j])
+                fprintf(fid, "%04d %03d\n", i+YEAR_START, 2*j+1);
         }
     }
-    return NULL;
+    fclose(fid);
+    return;
 }
 
-void *mthreadRearrDryArray(void *arg) {
-    thread_args *t_args = (thread_args*)arg;
-    float ****dry_ts = t_args->dry_ts;
-    float ****tmp = t_args->tmp;
-    int start_row = t_args->start_i;
-    int stop_row = t_args->stop_i;
-    int num_columns = t_args->num_columns;
-    int i,j,k,m;
+/* Create the Zarr store of every year before the writers start: a group
+ * with swi, ms and dry over (time, row, column) and the time coordinate.
+ * Shards write the same metadata and only their own chunks. */
+void create_zarr_stores(writer_ctx *w) {
+    struct arguments *arguments = w->arguments;
+    const char *names[3] = {"swi", "ms", "dry"};
+    const char *dim_names[3] = {"time", "row", "column"};
+    const char *ov_dim_names[3];
+    char row_name[20], col_name[20];
+    char store[200], path[250], attrs[150];
+    size_t shape[3] = {NUM_OUT_DAYS, w->total_rows, w->num_columns};
+    size_t chunks[3] = {1, ZARR_CHUNK_ROWS, ZARR_CHUNK_COLS};
+    size_t ov_shape[3];
+    size_t time_len = NUM_OUT_DAYS;
+    int days[NUM_OUT_DAYS];
+    zarr_array time_arr;
+    size_t time_chunk = 0;
+    int year, k, v;
+
+    for (k = 0; k < NUM_OUT_DAYS; k++)
+        days[k] = 2*k;
+
+    for (year = 0; year < NUM_YEARS; year++) {
+        sprintf(store,"/auto/temp/lindell/soilmoisture/swi/combined/swi_%s_%04d.zarr",
+                arguments->region,year+YEAR_START);
+        if (zarr_create_group(store))
+            exit(2);
+        for (k = 0; k < 3; k++) {
+            sprintf(path, "%s/%s", store, names[k]);
+            zarr_init_array(&w->zarr[year][k], path, 3, shape, chunks, arguments->deflate);
+            if (zarr_create_array(&w->zarr[year][k], "<f4", "\"NaN\"", dim_names, NULL))
+                exit(2);
+        }
+        for (k = 0; arguments->overviews && k < OVERVIEW_LEVELS; k++) {
+            sprintf(row_name, "row_%dx", OVERVIEW_FACTOR(k));
+            sprintf(col_name, "column_%dx", OVERVIEW_FACTOR(k));
+            ov_dim_names[0] = "time";
+            ov_dim_names[1] = row_name;
+            ov_dim_names[2] = col_name;
+            ov_shape[0] = NUM_OUT_DAYS;
+            ov_shape[1] = OVERVIEW_LEN(w->total_rows, k);
+            ov_shape[2] = OVERVIEW_LEN(w->num_columns, k);
+            for (v = 0; v < NUM_OV_VARS; v++) {
+                sprintf(path, "%s/%s_%dx", store, ov_names[v], OVERVIEW_FACTOR(k));
+                zarr_init_array(&w->zarr_ov[year][v][k], path, 3, ov_shape, chunks, arguments->deflate);
+                if (zarr_create_array(&w->zarr_ov[year][v][k], "<f4", "\"NaN\"", ov_dim_names, NULL))
+                    exit(2);
+            }
+        }
+        sprintf(path, "%s/time", store);
+        sprintf(attrs, "\"units\": \"days since %04d-01-01 00:00:00\",\n    \"calendar\": \"standard\"",
+                year+YEAR_START);
+        zarr_init_array(&time_arr, path, 1, &time_len, &time_len, arguments->deflate);
+        if (zarr_create_array(&time_arr, "<i4", "null", dim_names, attrs) ||
+                zarr_write_chunk(&time_arr, &time_chunk, days, sizeof(days)))
+            exit(2);
+    }
+    return;
+}
 
-    for (i = start_row; i <= stop_row; i++) {
-        for (j = 0; j < num_columns; j++) {
-            for (k = 0; k < NUM_YEARS; k++) {
-                for (m = 0; m < NUM_DAYS; m++) {
-                    tmp[k][m][i][j] = dry_ts[i][j][k][m];
-                }
+/* Writer process side for --zarr, writes this run's rows of the day */
+void write_zarr_slot(void *ctx, int year, int doy, const float *data) {
+    writer_ctx *w = (writer_ctx*)ctx;
+    size_t img_len = (size_t)w->num_rows*w->num_columns;
+    float *ov[NUM_OV_VARS][OVERVIEW_LEVELS];
+    float *ov_buf;
+    int k, v;
+
+    printf("    Day: %03d Year: %04d\n", doy, year);
+    for (k = 0; k < 3; k++) {
+        if (zarr_write_plane(&w->zarr[year-YEAR_START][k], (doy-1)/2, data + k*img_len,
+                w->row_offset, w->num_rows, NAN))
+            exit(2);
+    }
+    if (w->arguments->overviews) {
+        ov_buf = build_overviews(data, w->num_rows, w->num_columns, ov);
+        for (k = 0; k < OVERVIEW_LEVELS; k++) {
+            for (v = 0; v < NUM_OV_VARS; v++) {
+                if (zarr_write_plane(&w->zarr_ov[year-YEAR_START][v][k], (doy-1)/2, ov[v][k],
+                        0, OVERVIEW_LEN(w->num_rows, k), NAN))
+                    exit(2);
             }
         }
+        free(ov_buf);
     }
-    return NULL;
+    return;
 }
 
 int main (int argc, char **argv)
@@ -290,6 +936,16 @@ int main (int argc, char **argv)
     arguments.verbose = 0;
     arguments.region = NULL;
     arguments.grd = 0;
+    arguments.row_start = 0;
+    arguments.row_end = 0;
+    arguments.bench = 0;
+    arguments.memory = 0;
+    arguments.writers = DEFAULT_WRITERS;
+    arguments.cube = 0;
+    arguments.deflate = DEFAULT_DEFLATE;
+    arguments.zarr = 0;
+    arguments.overviews = 0;
+    arguments.readers = DEFAULT_READERS;
 
     /* Parse our arguments; every option seen by parse_opt will
      be reflected in arguments. */
@@ -300,14 +956,7 @@ int main (int argc, char **argv)
     int num_rows;
     int grd = arguments.grd;
     char* region = arguments.region;
-    char swi_fname[100];
-    int i,j,k;
-
-    // Initialize NETCDF Variables
-    int ncid, row_dimid, col_dimid;
-    int swi_varid, ms_varid, dry_varid;
-    int retval;
-    int dimids[NDIMS];
+    int i,j;
 
     // multithread args
     thread_args t_args[NUM_THREADS];
@@ -372,79 +1021,117 @@ int main (int argc, char **argv)
         }
     }
 
-    // Allocate memory for 4D image timeseries array
-    setvbuf (stdout, NULL, _IONBF, 0);
-    printf("Allocating Memory...");
-
-    float ****row_ptr = (float****)malloc(sizeof(float ***)*num_rows);
-    float ***column_ptr = (float***)malloc(sizeof(float **)*num_rows * num_columns);
-    float **year_ptr = (float**)malloc(sizeof(float *)*num_rows * num_columns*NUM_YEARS);
-    float *day_ptr = (float*)malloc(sizeof(float)*num_rows*num_columns*NUM_YEARS*NUM_DAYS);
-    float ****swi_ts = row_ptr;
-
-    for (i = 0; i < num_rows; i++, column_ptr += num_columns) {
-        swi_ts[i] = column_ptr;
-        for (j = 0; j < num_columns; j++, year_ptr += NUM_YEARS) {
-            swi_ts[i][j] = year_ptr;
-            for (k = 0; k < NUM_YEARS; k++, day_ptr += NUM_DAYS) {
-                swi_ts[i][j][k] = day_ptr;
-            }
-        }
+    if (arguments.bench) {
+        bench_scatter(num_columns);
+        exit(0);
     }
-    memset(swi_ts[0][0][0],0,num_rows*num_columns*NUM_YEARS*NUM_DAYS*sizeof(float));
 
-    row_ptr = (float****)malloc(sizeof(float ***)*num_rows);
-    column_ptr = (float***)malloc(sizeof(float **)*num_rows * num_columns);
-    year_ptr = (float**)malloc(sizeof(float *)*num_rows * num_columns*NUM_YEARS);
-    day_ptr = (float*)malloc(sizeof(float)*num_rows*num_columns*NUM_YEARS*NUM_DAYS);
-    float ****ms_ts = row_ptr;
-
-    for (i = 0; i < num_rows; i++, column_ptr += num_columns) {
-        ms_ts[i] = column_ptr;
-        for (j = 0; j < num_columns; j++, year_ptr += NUM_YEARS) {
-            ms_ts[i][j] = year_ptr;
-            for (k = 0; k < NUM_YEARS; k++, day_ptr += NUM_DAYS) {
-                ms_ts[i][j][k] = day_ptr;
-            }
+    // only compile a shard of the rows if asked
+    int total_rows = num_rows;
+    int row_offset = 0;
+    if (arguments.row_start) {
+        if (arguments.row_end > total_rows) {
+            printf("ERROR, row range %d:%d outside of image with %d rows!\n",
+                    arguments.row_start, arguments.row_end, total_rows);
+            exit(-1);
         }
-    }
-    memset(ms_ts[0][0][0],0,num_rows*num_columns*NUM_YEARS*NUM_DAYS*sizeof(float));
-
-    row_ptr = (float****)malloc(sizeof(float ***)*num_rows);
-    column_ptr = (float***)malloc(sizeof(float **)*num_rows * num_columns);
-    year_ptr = (float**)malloc(sizeof(float *)*num_rows * num_columns*NUM_YEARS);
-    day_ptr = (float*)malloc(sizeof(float)*num_rows*num_columns*NUM_YEARS*NUM_DAYS);
-    float ****dry_ts = row_ptr;
-
-    for (i = 0; i < num_rows; i++, column_ptr += num_columns) {
-        dry_ts[i] = column_ptr;
-        for (j = 0; j < num_columns; j++, year_ptr += NUM_YEARS) {
-            dry_ts[i][j] = year_ptr;
-            for (k = 0; k < NUM_YEARS; k++, day_ptr += NUM_DAYS) {
-                dry_ts[i][j][k] = day_ptr;
-            }
+        row_offset = arguments.row_start - 1;
+        num_rows = arguments.row_end - arguments.row_start + 1;
+        if (arguments.overviews) {
+            printf("ERROR, overviews can't be made of a shard, leave out --rows!\n");
+            exit(-1);
+        }
+        if (arguments.zarr && (row_offset % ZARR_CHUNK_ROWS ||
+                (arguments.row_end != total_rows && num_rows % ZARR_CHUNK_ROWS))) {
+            printf("ERROR, --zarr shards have to start and end on a multiple of %d rows!\n",
+                    ZARR_CHUNK_ROWS);
+            exit(-1);
         }
+        printf("Processing rows %04d-%04d\n", arguments.row_start, arguments.row_end);
     }
-    memset(dry_ts[0][0][0],0,num_rows*num_columns*NUM_YEARS*NUM_DAYS*sizeof(float));
 
-    float ****year_ptr_r = (float****)malloc(sizeof(float ***)*NUM_YEARS);
-    float ***day_ptr_r = (float***)malloc(sizeof(float **)*NUM_YEARS*NUM_DAYS);
-    float **row_ptr_r = (float**)malloc(sizeof(float *)*NUM_DAYS * NUM_YEARS*num_rows);
-    float *column_ptr_r = (float*)malloc(sizeof(float)*NUM_DAYS*NUM_YEARS*num_rows*num_columns);
-    float ****tmp = year_ptr_r;
-
-    for (i = 0; i < NUM_YEARS; i++, day_ptr_r += NUM_DAYS) {
-        tmp[i] = day_ptr_r;
-        for (j = 0; j < NUM_DAYS; j++, row_ptr_r += num_rows) {
-            tmp[i][j] = row_ptr_r;
-            for (k = 0; k < num_rows; k++, column_ptr_r += num_columns) {
-                tmp[i][j][k] = column_ptr_r;
-            }
+    // split the days into blocks that fit the memory budget, one block of
+    // every day without one. The images take 3 planes for every day written
+    // and the reader slots 3 columns x 2 days each.
+    int num_read_slots = NUM_THREADS;
+    if (arguments.readers && SLOTS_PER_READER*arguments.readers < NUM_THREADS)
+        num_read_slots = SLOTS_PER_READER*arguments.readers;
+    size_t plane_len = PLANE_LEN(num_rows, num_columns);
+    double day_bytes = 3.0*sizeof(float)*(plane_len + 2.0*num_read_slots*num_columns);
+    double slot_bytes = 3.0*sizeof(float)*num_rows*num_columns;
+    if (arguments.cube && arguments.zarr) {
+        printf("ERROR, choose either --cube or --zarr!\n");
+        exit(-1);
+    }
+    // a cube file can only be written by one process
+    if (arguments.cube && arguments.writers > 1)
+        arguments.writers = 1;
+    int num_slots = arguments.writers ? SLOTS_PER_WRITER*arguments.writers : 1;
+    if (arguments.cube && arguments.writers)
+        num_slots = SLOTS_PER_WRITER*DEFAULT_WRITERS;
+    int block_days = NUM_YEARS*NUM_OUT_DAYS;
+    if (arguments.memory > 0) {
+        block_days = (int)((arguments.memory*1e9 - num_slots*slot_bytes) / day_bytes);
+        if (block_days < 1) {
+            printf("ERROR, need at least %.2f GB for one day!\n", (day_bytes + num_slots*slot_bytes)/1e9);
+            exit(-1);
         }
     }
-    memset(tmp[0][0][0],0,num_rows*num_columns*NUM_YEARS*NUM_DAYS*sizeof(float));
-
+    day_block block;
+    int block_years, block_in_days;
+    if (block_days >= NUM_OUT_DAYS) {
+        block_years = block_days / NUM_OUT_DAYS < NUM_YEARS ? block_days / NUM_OUT_DAYS : NUM_YEARS;
+        block_in_days = NUM_DAYS;
+        block_days = NUM_OUT_DAYS;
+    } else {
+        block_years = 1;
+        block_in_days = 2*block_days;
+    }
+    printf("Blocks of %d year(s) x %d days, %.1f GB\n", block_years, block_days,
+            block_years*block_days*day_bytes/1e9);
+
+    // start the readers and writers before anything big is allocated,
+    // they are forked
+    size_t row_len = (size_t)num_columns*block_years*block_in_days;
+    reader_ctx r_ctx = {region, num_columns};
+    reader_pool *readers = reader_pool_start(arguments.readers, num_read_slots,
+            sizeof(float)*3*row_len, read_row_file, &r_ctx, NULL);
+
+    writer_ctx w_ctx;
+    memset(&w_ctx, 0, sizeof(w_ctx));
+    w_ctx.arguments = &arguments;
+    w_ctx.num_rows = num_rows;
+    w_ctx.num_columns = num_columns;
+    w_ctx.total_rows = total_rows;
+    w_ctx.cube_year = -1;
+    w_ctx.cube_ncid = -1;
+    w_ctx.row_offset = row_offset;
+    day_write_fn write_fn = write_day_slot;
+    if (arguments.cube)
+        write_fn = write_cube_slot;
+    if (arguments.zarr) {
+        create_zarr_stores(&w_ctx);
+        write_fn = write_zarr_slot;
+    }
+    day_writer *writer = day_writer_start(arguments.writers, num_slots,
+            3*(size_t)num_rows*num_columns, write_fn, &w_ctx);
+    size_t img_len = (size_t)num_rows*num_columns;
+    float *slot;
+
+    // days without any data aren't written, they are listed in the empty
+    // day index instead. Shards are always written so they can be merged.
+    char empty[NUM_YEARS][NUM_OUT_DAYS];
+    int num_empty = 0;
+    memset(empty, 0, sizeof(empty));
+
+    // Allocate memory for the day images, the row files are put straight
+    // into them so there is no time series copy to rearrange
+    setvbuf (stdout, NULL, _IONBF, 0);
+    printf("Allocating Memory...");
 
+    float ****swi_img = alloc_day_cube(block_years, block_days, num_rows, num_columns);
+    float ****ms_img = alloc_day_cube(block_years, block_days, num_rows, num_columns);
+    float ****dry_img = alloc_day_cube(block_years, block_days, num_rows, num_columns);
 
     printf("Done.\n");
 
@@ -459,217 +1146,89 @@ int main (int argc, char **argv)
         } else {
             stop_index = start_index + ind_per_thread;
         }
-        t_args[i].swi_ts = swi_ts;
-        t_args[i].ms_ts = ms_ts;
-        t_args[i].dry_ts = dry_ts;
-        t_args[i].tmp = tmp;
+        t_args[i].block = &block;
+        t_args[i].swi_img = swi_img;
+        t_args[i].ms_img = ms_img;
+        t_args[i].dry_img = dry_img;
+        t_args[i].readers = readers;
         t_args[i].start_i = start_index;
         t_args[i].stop_i = stop_index;
+        t_args[i].num_rows = num_rows;
         t_args[i].num_columns = num_columns;
+        t_args[i].row_offset = row_offset;
         t_args[i].region = region;
-        t_args[i].fopen_lock = &fopen_lock;
         t_args[i].fclose_lock = &fclose_lock;
         t_args[i].netcdfop_lock = &netcdfop_lock;
         start_index = stop_index + 1;
     }
 
-    // call multithreaded function
-    // submit threads
-    for (i = 0; i < NUM_THREADS; i++) {
-        pthread_create(&thread_id[i], NULL, mthreadGetImgData, &t_args[i]);
-    }
-
-    // join threads
-    for (i = 0; i < NUM_THREADS; i++) {
-        pthread_join(thread_id[i], NULL);
-    }
-
-
-    printf("Rearranging SWI...");
-    // call multithreaded function
-    // submit threads
-
-    // ***** REARRANGE SWI *****
-    for (i = 0; i < NUM_THREADS; i++) {
-        pthread_create(&thread_id[i], NULL, mthreadSwiRearrArray, &t_args[i]);
-    }
-
-    for (i = 0; i < NUM_THREADS; i++) {
-        pthread_join(thread_id[i], NULL);
-    }
-
-    // Free old array
-    free(swi_ts[0][0][0]);
-    free(swi_ts[0][0]);
-    free(swi_ts[0]);
-    free(swi_ts);
-
-    // Allocate new array
-    year_ptr_r = (float****)malloc(sizeof(float ***)*NUM_YEARS);
-    day_ptr_r = (float***)malloc(sizeof(float **)*NUM_YEARS*NUM_DAYS);
-    row_ptr_r = (float**)malloc(sizeof(float *)*NUM_DAYS * NUM_YEARS*num_rows);
-    column_ptr_r = (float*)malloc(sizeof(float)*NUM_DAYS*NUM_YEARS*num_rows*num_columns);
-    float ****swi_ts_rearr = year_ptr_r;
-
-    for (i = 0; i < NUM_YEARS; i++, day_ptr_r += NUM_DAYS) {
-        swi_ts_rearr[i] = day_ptr_r;
-        for (j = 0; j < NUM_DAYS; j++, row_ptr_r += num_rows) {
-            swi_ts_rearr[i][j] = row_ptr_r;
-            for (k = 0; k < num_rows; k++, column_ptr_r += num_columns) {
-                swi_ts_rearr[i][j][k] = column_ptr_r;
+    for (block.year0 = 0; block.year0 < NUM_YEARS; block.year0 += block_years) {
+        for (block.day0 = 0; block.day0 < NUM_DAYS; block.day0 += block_in_days) {
+            block.num_years = NUM_YEARS - block.year0 < block_years ? NUM_YEARS - block.year0 : block_years;
+            block.num_days = NUM_DAYS - block.day0 < block_in_days ? NUM_DAYS - block.day0 : block_in_days;
+            if (block_years < NUM_YEARS || block_in_days < NUM_DAYS)
+                printf("Block: Year %04d-%04d Day %03d-%03d\n", block.year0+YEAR_START,
+                        block.year0+block.num_years-1+YEAR_START, block.day0+1, block.day0+block.num_days);
+
+            // call multithreaded function
+            // submit threads
+            for (i = 0; i < NUM_THREADS; i++) {
+                pthread_create(&thread_id[i], NULL, mthreadGetImgData, &t_args[i]);
             }
-        }
-    }
-
-    memcpy((void *)&swi_ts_rearr[0][0][0][0], (void *)&tmp[0][0][0][0], sizeof(float)*NUM_DAYS*NUM_YEARS*num_rows*num_columns);
 
-    printf("Done.\n");
-
-    // ***** REARRANGE MS *****
-    printf("Rearranging ms...");
-    for (i = 0; i < NUM_THREADS; i++) {
-        pthread_create(&thread_id[i], NULL, mthreadMsRearrArray, &t_args[i]);
-    }
-
-    for (i = 0; i < NUM_THREADS; i++) {
-        pthread_join(thread_id[i], NULL);
-    }
-
-    // Free old array
-    free(ms_ts[0][0][0]);
-    free(ms_ts[0][0]);
-    free(ms_ts[0]);
-    free(ms_ts);
-
-    // Allocate new array
-    year_ptr_r = (float****)malloc(sizeof(float ***)*NUM_YEARS);
-    day_ptr_r = (float***)malloc(sizeof(float **)*NUM_YEARS*NUM_DAYS);
-    row_ptr_r = (float**)malloc(sizeof(float *)*NUM_DAYS * NUM_YEARS*num_rows);
-    column_ptr_r = (float*)malloc(sizeof(float)*NUM_DAYS*NUM_YEARS*num_rows*num_columns);
-    float ****ms_ts_rearr = year_ptr_r;
-
-    for (i = 0; i < NUM_YEARS; i++, day_ptr_r += NUM_DAYS) {
-       ms_ts_rearr[i] = day_ptr_r;
-       for (j = 0; j < NUM_DAYS; j++, row_ptr_r += num_rows) {
-           ms_ts_rearr[i][j] = row_ptr_r;
-           for (k = 0; k < num_rows; k++, column_ptr_r += num_columns) {
-               ms_ts_rearr[i][j][k] = column_ptr_r;
-           }
-       }
-    }
-
-    memcpy((void *)&ms_ts_rearr[0][0][0][0], (void *)&tmp[0][0][0][0], sizeof(float)*NUM_DAYS*NUM_YEARS*num_rows*num_columns);
-    printf("Done.\n");
-
-    // ***** REARRANGE DRY *****
-    printf("Rearranging sigma0-dry...");
-    for (i = 0; i < NUM_THREADS; i++) {
-        pthread_create(&thread_id[i], NULL, mthreadRearrDryArray, &t_args[i]);
-    }
+            // join threads
+            for (i = 0; i < NUM_THREADS; i++) {
+                pthread_join(thread_id[i], NULL);
+            }
 
-    for (i = 0; i < NUM_THREADS; i++) {
-        pthread_join(thread_id[i], NULL);
-    }
-
-    // Free old array
-    free(dry_ts[0][0][0]);
-    free(dry_ts[0][0]);
-    free(dry_ts[0]);
-    free(dry_ts);
-
-    // Allocate new array
-    year_ptr_r = (float****)malloc(sizeof(float ***)*NUM_YEARS);
-    day_ptr_r = (float***)malloc(sizeof(float **)*NUM_YEARS*NUM_DAYS);
-    row_ptr_r = (float**)malloc(sizeof(float *)*NUM_DAYS * NUM_YEARS*num_rows);
-    column_ptr_r = (float*)malloc(sizeof(float)*NUM_DAYS*NUM_YEARS*num_rows*num_columns);
-    float ****dry_ts_rearr = year_ptr_r;
-
-    for (i = 0; i < NUM_YEARS; i++, day_ptr_r += NUM_DAYS) {
-        dry_ts_rearr[i] = day_ptr_r;
-        for (j = 0; j < NUM_DAYS; j++, row_ptr_r += num_rows) {
-            dry_ts_rearr[i][j] = row_ptr_r;
-            for (k = 0; k < num_rows; k++, column_ptr_r += num_columns) {
-                dry_ts_rearr[i][j][k] = column_ptr_r;
+            // hand the days to the writers, the next block is read while
+            // they write this one
+            printf("Writing NetCDF Files!\n");
+            for (i = 0; i < block.num_years; i++) {
+                for (j = 0; j < block.num_days; j+=2) {
+                    if (!arguments.row_start &&
+                            empty_image(&swi_img[i][j/2][0][0], img_len) &&
+                            empty_image(&ms_img[i][j/2][0][0], img_len) &&
+                            empty_image(&dry_img[i][j/2][0][0], img_len)) {
+                        printf("    Day: %03d Year: %04d is empty, skipping\n",
+                                block.day0+j+1, block.year0+i+YEAR_START);
+                        empty[block.year0+i][(block.day0+j)/2] = 1;
+                        num_empty++;
+                        // a Zarr day may be rewritten, its old chunks are
+                        // removed. A cube is only closed by its last day, so
+                        // its empty days go in as NaN.
+                        if (!arguments.zarr && !arguments.cube)
+                            continue;
+                    }
+                    slot = day_writer_slot(writer);
+                    memcpy(slot, &swi_img[i][j/2][0][0], sizeof(float)*img_len);
+                    memcpy(slot + img_len, &ms_img[i][j/2][0][0], sizeof(float)*img_len);
+                    memcpy(slot + 2*img_len, &dry_img[i][j/2][0][0], sizeof(float)*img_len);
+                    day_writer_submit(writer, block.year0+i+YEAR_START, block.day0+j+1);
+                }
             }
         }
     }
 
-    memcpy((void *)&dry_ts_rearr[0][0][0][0], (void *)&tmp[0][0][0][0], sizeof(float)*NUM_DAYS*NUM_YEARS*num_rows*num_columns);
-
-    // Free temporary holding array
-    free(tmp[0][0][0]);
-    free(tmp[0][0]);
-    free(tmp[0]);
-    free(tmp);
-
-    printf("Done.\n");
-
-    // write netcdf files
-    printf("Writing NetCDF Files!\n");
-    for (i = 0; i < NUM_YEARS; i++) {
-        for (j = 0; j < NUM_DAYS; j+=2) {
-            printf("    Day: %03d Year: %04d\n",j+1,i+YEAR_START);
-            sprintf(swi_fname,"/auto/temp/lindell/soilmoisture/swi/combined/swi_%s_%04d_%03d.nc",region,i+YEAR_START,j+1);
-            if ((retval = nc_create(swi_fname, NC_NETCDF4, &ncid)))
-                ERR(retval);
-
-            /* Define the dimensions. */
-            if ((retval = nc_def_dim(ncid, "row", num_rows, &row_dimid)))
-                ERR(retval);
-            if ((retval = nc_def_dim(ncid, "column", num_columns, &col_dimid)))
-                ERR(retval);
-
-            /* Define the netCDF variables. The dimids array is used to pass
-                the dimids of the dimensions of the variables.*/
-            dimids[0] = row_dimid;
-            dimids[1] = col_dimid;
-
-            /* define the variable */
-            if ((retval = nc_def_var(ncid, "swi", NC_FLOAT, NDIMS, dimids, &swi_varid)))
-                ERR(retval);
-
-            if ((retval = nc_def_var(ncid, "ms", NC_FLOAT, NDIMS, dimids, &ms_varid)))
-                ERR(retval);
-
-            if ((retval = nc_def_var(ncid, "dry", NC_FLOAT, NDIMS, dimids, &dry_varid)))
-                ERR(retval);
-
-            /* End define mode. */
-            if ((retval = nc_enddef(ncid)))
-                ERR(retval);
-
-            /* Write the data. */
-            if ((retval = nc_put_var_float(ncid, swi_varid, &swi_ts_rearr[i][j][0][0])))
-                ERR(retval);
-
-            if ((retval = nc_put_var_float(ncid, ms_varid, &ms_ts_rearr[i][j][0][0])))
-                ERR(retval);
-
-            if ((retval = nc_put_var_float(ncid, dry_varid, &dry_ts_rearr[i][j][0][0])))
-                ERR(retval);
+    if (reader_pool_finish(readers)) {
+        printf("ERROR, a reader failed!\n");
+        exit(2);
+    }
 
-            /* Close the file. */
-            if ((retval = nc_close(ncid)))
-                ERR(retval);
-        }
+    printf("Waiting for the writers...\n");
+    if (day_writer_finish(writer)) {
+        printf("ERROR, not all of the daily files were written!\n");
+        exit(2);
     }
+    close_cube(&w_ctx);
+    if (!arguments.row_start)
+        write_empty_index(region, empty, num_empty);
 
     printf("Freeing memory.\n");
 
-    free(swi_ts_rearr[0][0][0]);
-    free(swi_ts_rearr[0][0]);
-    free(swi_ts_rearr[0]);
-    free(swi_ts_rearr);
-
-    free(ms_ts_rearr[0][0][0]);
-    free(ms_ts_rearr[0][0]);
-    free(ms_ts_rearr[0]);
-    free(ms_ts_rearr);
-
-    free(dry_ts_rearr[0][0][0]);
-    free(dry_ts_rearr[0][0]);
-    free(dry_ts_rearr[0]);
-    free(dry_ts_rearr);
+    free_day_cube(swi_img);
+    free_day_cube(ms_img);
+    free_day_cube(dry_img);
 
     printf("Finished.\n");
     exit (0);
@@ -0,0 +1,152 @@
+/*
+ * transpose.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Turns pixel time series ([pixel][day]) into day images ([day][pixel]).
+ *  The straightforward loop writes one float per image, a whole image
+ *  apart, so nearly every store misses the cache and the TLB. Here the
+ *  arrays are walked in TRANSPOSE_TILE x TRANSPOSE_TILE tiles: 16 pixel
+ *  series are loaded, transposed in registers 8x8 at a time, and each day
+ *  gets one full cache line of 16 pixels. The images are not read again
+ *  until they are written out, so the lines are stored non-temporally
+ *  (around the cache) when they are aligned. That only pays off when the
+ *  stores cover whole lines, so callers should pad the day images to a
+ *  multiple of TRANSPOSE_TILE floats. Edges and machines without AVX2 go
+ *  through the same tiles with plain loads and stores.
+ */
+
+#include <stdint.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "transpose.h"
+
+/* Plain tile, also handles the edges */
+static void transpose_tile(const float *src, size_t src_ld, int step,
+        float *dst, size_t dst_ld, int r0, int r1, int c0, int c1) {
+    int r, c;
+
+    for (c = c0; c < c1; c++) {
+        for (r = r0; r < r1; r++) {
+            dst[c*dst_ld + r] = src[r*src_ld + (size_t)c*step];
+        }
+    }
+    return;
+}
+
+#ifdef __AVX2__
+
+/* 8 consecutive output days of one pixel */
+static inline __m256 load_days(const float *p, int step) {
+    __m256 a, b;
+
+    if (step == 1)
+        return _mm256_loadu_ps(p);
+
+    /* every other day: pick the even floats of 16 and put them in order.
+     * The 16th float isn't used and may be past the end of the series. */
+    a = _mm256_loadu_ps(p);
+    b = _mm256_maskload_ps(p + 8, _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, -1, 0));
+    a = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+    return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(a), _MM_SHUFFLE(3,1,2,0)));
+}
+
+/* 8x8 transpose in registers */
+static inline void transpose8(__m256 *v) {
+    __m256 t0, t1, t2, t3, t4, t5, t6, t7;
+    __m256 s0, s1, s2, s3, s4, s5, s6, s7;
+
+    t0 = _mm256_unpacklo_ps(v[0], v[1]);
+    t1 = _mm256_unpackhi_ps(v[0], v[1]);
+    t2 = _mm256_unpacklo_ps(v[2], v[3]);
+    t3 = _mm256_unpackhi_ps(v[2], v[3]);
+    t4 = _mm256_unpacklo_ps(v[4], v[5]);
+    t5 = _mm256_unpackhi_ps(v[4], v[5]);
+    t6 = _mm256_unpacklo_ps(v[6], v[7]);
+    t7 = _mm256_unpackhi_ps(v[6], v[7]);
+
+    s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1,0,1,0));
+    s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3,2,3,2));
+    s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1,0,1,0));
+    s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3,2,3,2));
+    s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1,0,1,0));
+    s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3,2,3,2));
+    s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1,0,1,0));
+    s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3,2,3,2));
+
+    v[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    v[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    v[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    v[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    v[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    v[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    v[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    v[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+    return;
+}
+
+static inline void store_line(float *p, __m256 v) {
+    if (((uintptr_t)p & 31) == 0)
+        _mm256_stream_ps(p, v);
+    else
+        _mm256_storeu_ps(p, v);
+}
+
+/* Full 16x16 tile, every output day gets 16 pixels in a row */
+static void transpose_tile16(const float *src, size_t src_ld, int step,
+        float *dst, size_t dst_ld, int r0, int c0) {
+    __m256 lo[8], hi[8];
+    int half, k;
+
+    for (half = 0; half < TRANSPOSE_TILE; half += 8) {
+        for (k = 0; k < 8; k++) {
+            lo[k] = load_days(src + (r0+k)*src_ld + (size_t)(c0+half)*step, step);
+            hi[k] = load_days(src + (r0+8+k)*src_ld + (size_t)(c0+half)*step, step);
+        }
+        transpose8(lo);
+        transpose8(hi);
+        for (k = 0; k < 8; k++) {
+            store_line(dst + (c0+half+k)*dst_ld + r0, lo[k]);
+            store_line(dst + (c0+half+k)*dst_ld + r0 + 8, hi[k]);
+        }
+    }
+    return;
+}
+
+#endif
+
+void transpose_f32(const float *src, size_t src_ld, int step,
+        float *dst, size_t dst_ld, int rows, int cols) {
+    int r0, r1, c0, c1, head = 0;
+
+    /* when every day image lines up the same way, start the tiles on a
+     * cache line so the stores write whole lines */
+    if (dst_ld % TRANSPOSE_TILE == 0)
+        head = (TRANSPOSE_TILE - ((uintptr_t)dst / sizeof(float)) % TRANSPOSE_TILE) % TRANSPOSE_TILE;
+    if (head > rows)
+        head = rows;
+    transpose_tile(src, src_ld, step, dst, dst_ld, 0, head, 0, cols);
+
+    for (r0 = head; r0 < rows; r0 += TRANSPOSE_TILE) {
+        r1 = r0 + TRANSPOSE_TILE < rows ? r0 + TRANSPOSE_TILE : rows;
+        for (c0 = 0; c0 < cols; c0 += TRANSPOSE_TILE) {
+            c1 = c0 + TRANSPOSE_TILE < cols ? c0 + TRANSPOSE_TILE : cols;
+#ifdef __AVX2__
+            if (r1 - r0 == TRANSPOSE_TILE && c1 - c0 == TRANSPOSE_TILE && step <= 2) {
+                transpose_tile16(src, src_ld, step, dst, dst_ld, r0, c0);
+                continue;
+            }
+#endif
+            transpose_tile(src, src_ld, step, dst, dst_ld, r0, r1, c0, c1);
+        }
+    }
+#ifdef __AVX2__
+    /* streaming stores have to be visible before anyone reads the images */
+    _mm_sfence();
+#endif
+    return;
+}
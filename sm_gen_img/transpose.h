@@ -0,0 +1,21 @@
+/*
+ * transpose.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef TRANSPOSE_H_
+#define TRANSPOSE_H_
+
+#include <stddef.h>
+
+/* pixels x days moved at a time, one cache line of floats */
+#define TRANSPOSE_TILE 16
+
+/* dst[c*dst_ld + r] = src[r*src_ld + c*step] for r < rows, c < cols.
+ * step 2 takes every other day of a pixel's series, like the images. */
+void transpose_f32(const float *src, size_t src_ld, int step,
+        float *dst, size_t dst_ld, int rows, int cols);
+
+#endif /* TRANSPOSE_H_ */
@@ -0,0 +1,244 @@
+/*
+ * zarr_store.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Minimal writer for Zarr v2 directory stores. An array is a directory
+ *  with its metadata in .zarray/.zattrs (JSON) and one zlib compressed
+ *  file per chunk, named by the chunk indices ("0.3.1"). Every chunk is
+ *  its own file, so any number of processes can write different chunks of
+ *  the same array at once without NetCDF's global lock, and a region can
+ *  be rewritten later by writing its chunks again. Chunks that would only
+ *  hold the fill value aren't written, readers fill them in. The files
+ *  are written under a temporary name and renamed, so a reader never sees
+ *  half a chunk. The stores can be opened with zarr-python, xarray
+ *  (open_zarr) or any other Zarr v2 reader.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <zlib.h>
+
+#include "zarr_store.h"
+
+/* Write a whole file under a temporary name and move it into place */
+static int write_file(const char *fname, const void *data, size_t len) {
+    char tmp_fname[300];
+    FILE *fid;
+
+    snprintf(tmp_fname, sizeof(tmp_fname), "%s.tmp%d", fname, (int)getpid());
+    fid = fopen(tmp_fname, "wb");
+    if (fid == NULL) {
+        perror(tmp_fname);
+        return -1;
+    }
+    if (len > 0 && fwrite(data, 1, len, fid) != len) {
+        perror(tmp_fname);
+        fclose(fid);
+        unlink(tmp_fname);
+        return -1;
+    }
+    if (fclose(fid)) {
+        perror(tmp_fname);
+        unlink(tmp_fname);
+        return -1;
+    }
+    if (rename(tmp_fname, fname)) {
+        perror(fname);
+        unlink(tmp_fname);
+        return -1;
+    }
+    return 0;
+}
+
+static int make_dir(const char *path) {
+    if (mkdir(path, 0755) && errno != EEXIST) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+/* A group to keep the arrays of one store together */
+int zarr_create_group(const char *path) {
+    char fname[300];
+    const char *zgroup = "{\n    \"zarr_format\": 2\n}\n";
+
+    if (make_dir(path))
+        return -1;
+    snprintf(fname, sizeof(fname), "%s/.zgroup", path);
+    return write_file(fname, zgroup, strlen(zgroup));
+}
+
+void zarr_init_array(zarr_array *a, const char *path, int ndims, const size_t *shape,
+        const size_t *chunks, int level) {
+    int d;
+
+    snprintf(a->path, sizeof(a->path), "%s", path);
+    a->ndims = ndims;
+    for (d = 0; d < ndims; d++) {
+        a->shape[d] = shape[d];
+        a->chunks[d] = chunks[d];
+    }
+    a->level = level;
+    return;
+}
+
+/* Write the metadata of an array. dtype is the Zarr type ("<f4", "<i4"),
+ * fill the fill value as JSON ("\"NaN\"", "-1.0"), dim_names the xarray
+ * dimension names and attrs more JSON members for .zattrs (or NULL). */
+int zarr_create_array(const zarr_array *a, const char *dtype, const char *fill,
+        const char **dim_names, const char *attrs) {
+    char fname[300];
+    char meta[2048];
+    char compressor[64];
+    size_t len;
+    int d;
+
+    if (make_dir(a->path))
+        return -1;
+
+    if (a->level > 0)
+        snprintf(compressor, sizeof(compressor), "{\"id\": \"zlib\", \"level\": %d}", a->level);
+    else
+        snprintf(compressor, sizeof(compressor), "null");
+
+    len = snprintf(meta, sizeof(meta), "{\n    \"chunks\": [");
+    for (d = 0; d < a->ndims; d++)
+        len += snprintf(meta + len, sizeof(meta) - len, "%s%zu", d ? ", " : "", a->chunks[d]);
+    len += snprintf(meta + len, sizeof(meta) - len,
+            "],\n    \"compressor\": %s,\n"
+            "    \"dimension_separator\": \".\",\n"
+            "    \"dtype\": \"%s\",\n"
+            "    \"fill_value\": %s,\n"
+            "    \"filters\": null,\n"
+            "    \"order\": \"C\",\n"
+            "    \"shape\": [", compressor, dtype, fill);
+    for (d = 0; d < a->ndims; d++)
+        len += snprintf(meta + len, sizeof(meta) - len, "%s%zu", d ? ", " : "", a->shape[d]);
+    len += snprintf(meta + len, sizeof(meta) - len, "],\n    \"zarr_format\": 2\n}\n");
+    snprintf(fname, sizeof(fname), "%s/.zarray", a->path);
+    if (write_file(fname, meta, len))
+        return -1;
+
+    len = snprintf(meta, sizeof(meta), "{\n    \"_ARRAY_DIMENSIONS\": [");
+    for (d = 0; d < a->ndims; d++)
+        len += snprintf(meta + len, sizeof(meta) - len, "%s\"%s\"", d ? ", " : "", dim_names[d]);
+    len += snprintf(meta + len, sizeof(meta) - len, "]%s%s\n}\n",
+            attrs ? ",\n    " : "", attrs ? attrs : "");
+    snprintf(fname, sizeof(fname), "%s/.zattrs", a->path);
+    return write_file(fname, meta, len);
+}
+
+static void chunk_fname(const zarr_array *a, const size_t *chunk_i, char *fname, size_t fname_len) {
+    size_t len;
+    int d;
+
+    len = snprintf(fname, fname_len, "%s/", a->path);
+    for (d = 0; d < a->ndims; d++)
+        len += snprintf(fname + len, fname_len - len, "%s%zu", d ? "." : "", chunk_i[d]);
+    return;
+}
+
+/* Compress and write one chunk, len bytes of the whole chunk shape */
+int zarr_write_chunk(const zarr_array *a, const size_t *chunk_i, const void *data, size_t len) {
+    char fname[300];
+    uLongf comp_len;
+    Bytef *comp;
+    int retval;
+
+    chunk_fname(a, chunk_i, fname, sizeof(fname));
+    if (a->level <= 0)
+        return write_file(fname, data, len);
+
+    comp_len = compressBound(len);
+    comp = (Bytef*)malloc(comp_len);
+    if (!comp) {
+        fprintf(stderr, "Memory Error!\n");
+        return -1;
+    }
+    if (compress2(comp, &comp_len, (const Bytef*)data, len, a->level) != Z_OK) {
+        fprintf(stderr, "*** could not compress %s\n", fname);
+        free(comp);
+        return -1;
+    }
+    retval = write_file(fname, comp, comp_len);
+    free(comp);
+    return retval;
+}
+
+/* Write num_rows image rows into time step t of a (time, row, column)
+ * float array, starting at array row row0. The rows have to start on a
+ * chunk and end on one (or at the end of the array), otherwise chunks
+ * shared with another writer would be overwritten. Chunks that are all
+ * fill are removed instead of written. */
+int zarr_write_plane(const zarr_array *a, size_t t, const float *img, size_t row0,
+        size_t num_rows, float fill) {
+    size_t num_columns = a->shape[2];
+    size_t chunk_rows = a->chunks[1];
+    size_t chunk_cols = a->chunks[2];
+    size_t chunk_i[3];
+    size_t r0, c0, r, c, nr, nc;
+    char fname[300];
+    float *tile;
+    int empty, retval = 0;
+
+    if (a->ndims != 3 || a->chunks[0] != 1 || row0 % chunk_rows ||
+            (row0 + num_rows != a->shape[1] && num_rows % chunk_rows)) {
+        fprintf(stderr, "*** rows %zu-%zu are not on chunk boundaries of %s\n",
+                row0, row0 + num_rows - 1, a->path);
+        return -1;
+    }
+
+    tile = (float*)malloc(sizeof(float)*chunk_rows*chunk_cols);
+    if (!tile) {
+        fprintf(stderr, "Memory Error!\n");
+        return -1;
+    }
+
+    chunk_i[0] = t;
+    for (r0 = 0; r0 < num_rows && !retval; r0 += chunk_rows) {
+        nr = num_rows - r0 < chunk_rows ? num_rows - r0 : chunk_rows;
+        for (c0 = 0; c0 < num_columns && !retval; c0 += chunk_cols) {
+            nc = num_columns - c0 < chunk_cols ? num_columns - c0 : chunk_cols;
+
+            /* edge chunks are stored full size, padded with the fill */
+            empty = 1;
+            for (r = 0; r < chunk_rows; r++) {
+                for (c = 0; c < chunk_cols; c++) {
+                    if (r < nr && c < nc) {
+                        tile[r*chunk_cols + c] = img[(r0 + r)*num_columns + c0 + c];
+                        if (isnan(fill) ? !isnan(tile[r*chunk_cols + c]) : tile[r*chunk_cols + c] != fill)
+                            empty = 0;
+                    } else {
+                        tile[r*chunk_cols + c] = fill;
+                    }
+                }
+            }
+
+            chunk_i[1] = (row0 + r0) / chunk_rows;
+            chunk_i[2] = c0 / chunk_cols;
+            if (empty) {
+                /* may be rewriting a region that had data */
+                chunk_fname(a, chunk_i, fname, sizeof(fname));
+                if (unlink(fname) && errno != ENOENT) {
+                    perror(fname);
+                    retval = -1;
+                }
+                continue;
+            }
+            retval = zarr_write_chunk(a, chunk_i, tile, sizeof(float)*chunk_rows*chunk_cols);
+        }
+    }
+    free(tile);
+    return retval;
+}
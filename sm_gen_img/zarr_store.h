@@ -0,0 +1,33 @@
+/*
+ * zarr_store.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef ZARR_STORE_H_
+#define ZARR_STORE_H_
+
+#include <stddef.h>
+
+#define ZARR_MAX_DIMS 3
+
+/* An array in a Zarr v2 directory store */
+typedef struct {
+    char path[256];
+    int ndims;
+    size_t shape[ZARR_MAX_DIMS];
+    size_t chunks[ZARR_MAX_DIMS];
+    int level;                  /* zlib level, 0 to store the chunks raw */
+} zarr_array;
+
+int zarr_create_group(const char *path);
+void zarr_init_array(zarr_array *a, const char *path, int ndims, const size_t *shape,
+        const size_t *chunks, int level);
+int zarr_create_array(const zarr_array *a, const char *dtype, const char *fill,
+        const char **dim_names, const char *attrs);
+int zarr_write_chunk(const zarr_array *a, const size_t *chunk_i, const void *data, size_t len);
+int zarr_write_plane(const zarr_array *a, size_t t, const float *img, size_t row0,
+        size_t num_rows, float fill);
+
+#endif /* ZARR_STORE_H_ */
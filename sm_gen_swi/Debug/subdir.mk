@@ -0,0 +1,36 @@
+################################################################################
+# Automatically-generated file. Do not edit!
+################################################################################
+
+# Add inputs and outputs from these tool invocations to the build variables 
+C_SRCS += \
+../gen_swi.c \
+../swi_filter.c \
+../fourier_fit.c \
+../swi_state.c \
+../swi_pixel.c 
+
+OBJS += \
+./gen_swi.o \
+./swi_filter.o \
+./fourier_fit.o \
+./swi_state.o \
+./swi_pixel.o 
+
+C_DEPS += \
+./gen_swi.d \
+./swi_filter.d \
+./fourier_fit.d \
+./swi_state.d \
+./swi_pixel.d 
+
+
+# Each subdirectory must supply rules for building sources it contributes
+%.o: ../%.c
+	@echo 'Building file: $<'
+	@echo 'Invoking: GCC C Compiler'
+	gcc -I/home/lindell/local/include/sir -O3 -march=native -g3 -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$(@:%.o=%.d)" -o "$@" "$<"
+	@echo 'Finished building: $<'
+	@echo ' '
+
+
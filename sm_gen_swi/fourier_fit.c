@@ -0,0 +1,221 @@
+/*
+ * fourier_fit.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Batched least squares fit of a fourier series with a fixed period.
+ *  Replaces the per-pixel fit(..., 'fourier3') / fit(..., 'fourier2') calls
+ *  of sm_gen_swi.m. With the period fixed the fit is linear, and the normal
+ *  matrix of a pixel is the sum of precomputed per-day pieces over its valid
+ *  days. Pixels with no missing days share one precomputed factorization,
+ *  pixels with only a few missing days subtract those days from it.
+ *
+ *  Refitting the replicated fourier3 curve with fourier2 over whole periods
+ *  is the same as dropping the third harmonic, since the harmonics are
+ *  orthogonal over a full period, so the second fit is just a truncated
+ *  evaluation of the first.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fourier_fit.h"
+
+/* index of element (i,j), i >= j, of a packed lower triangle */
+#define PACKED(i,j) ((i)*((i)+1)/2 + (j))
+
+/* In place cholesky factorization of a packed symmetric matrix.
+ * Returns -1 if the matrix is not positive definite. */
+static int cholesky(double *a, int n) {
+    int i, j, k;
+    double sum;
+
+    for (j = 0; j < n; j++) {
+        sum = a[PACKED(j,j)];
+        for (k = 0; k < j; k++)
+            sum -= a[PACKED(j,k)] * a[PACKED(j,k)];
+        if (sum <= 1e-9)
+            return -1;
+        a[PACKED(j,j)] = sqrt(sum);
+        for (i = j + 1; i < n; i++) {
+            sum = a[PACKED(i,j)];
+            for (k = 0; k < j; k++)
+                sum -= a[PACKED(i,k)] * a[PACKED(j,k)];
+            a[PACKED(i,j)] = sum / a[PACKED(j,j)];
+        }
+    }
+    return 0;
+}
+
+/* Solve L*L'*x = b in place with a packed cholesky factor */
+static void cholesky_solve(const double *l, double *b, int n) {
+    int i, k;
+
+    for (i = 0; i < n; i++) {
+        for (k = 0; k < i; k++)
+            b[i] -= l[PACKED(i,k)] * b[k];
+        b[i] = b[i] / l[PACKED(i,i)];
+    }
+    for (i = n - 1; i >= 0; i--) {
+        for (k = i + 1; k < n; k++)
+            b[i] -= l[PACKED(k,i)] * b[k];
+        b[i] = b[i] / l[PACKED(i,i)];
+    }
+    return;
+}
+
+/* Set up the basis a0 + sum a_k cos(k w x) + b_k sin(k w x) with
+ * w = 2 pi / num_days and x = 1..num_days, as MATLAB evaluates it.
+ * Returns -1 if the sizes are not supported. */
+int fourier_fit_init(fourier_fit *fit, int num_days, int fit_harmonics,
+        int eval_harmonics, int min_days) {
+    double w = 2 * M_PI / num_days;
+    double *phi, *piece;
+    int d, i, j, k;
+
+    if (2*fit_harmonics + 1 > FOURIER_MAX_TERMS || eval_harmonics > fit_harmonics)
+        return -1;
+
+    fit->num_days = num_days;
+    fit->num_terms = 2*fit_harmonics + 1;
+    fit->eval_terms = 2*eval_harmonics + 1;
+    fit->num_pieces = fit->num_terms * (fit->num_terms + 1) / 2;
+    fit->min_days = min_days;
+    fit->basis = (double*)malloc(sizeof(double)*num_days*fit->num_terms);
+    fit->pieces = (double*)malloc(sizeof(double)*num_days*fit->num_pieces);
+    if (!fit->basis || !fit->pieces)
+        return -1;
+
+    memset(fit->full, 0, sizeof(fit->full));
+    for (d = 0; d < num_days; d++) {
+        phi = fit->basis + d*fit->num_terms;
+        piece = fit->pieces + d*fit->num_pieces;
+
+        phi[0] = 1;
+        for (k = 1; k <= fit_harmonics; k++) {
+            phi[2*k-1] = cos(k * w * (d + 1));
+            phi[2*k] = sin(k * w * (d + 1));
+        }
+        for (i = 0; i < fit->num_terms; i++) {
+            for (j = 0; j <= i; j++) {
+                piece[PACKED(i,j)] = phi[i] * phi[j];
+                fit->full[PACKED(i,j)] += phi[i] * phi[j];
+            }
+        }
+    }
+
+    memcpy(fit->full_chol, fit->full, sizeof(fit->full));
+    if (cholesky(fit->full_chol, fit->num_terms))
+        return -1;
+    return 0;
+}
+
+void fourier_fit_free(fourier_fit *fit) {
+    free(fit->basis);
+    free(fit->pieces);
+    fit->basis = NULL;
+    fit->pieces = NULL;
+    return;
+}
+
+/* Fit a batch of pixels. data is [num_px][num_days] with NaN on missing
+ * days, curve gets the fitted curve for each pixel with the same layout.
+ * If coef_out is not NULL it gets the eval_terms coefficients of each pixel.
+ * ok[px] is set to 1 for pixels that could be fit, the curve of the
+ * others is left untouched. Returns the number of pixels fit. */
+int fourier_fit_batch(const fourier_fit *fit, const float *data, int num_px,
+        float *curve, float *coef_out, unsigned char *ok) {
+    int num_days = fit->num_days;
+    int num_terms = fit->num_terms;
+    int num_pieces = fit->num_pieces;
+    double normal[FOURIER_MAX_PIECES];
+    double coef[FOURIER_MAX_TERMS];
+    const double *phi, *piece, *chol;
+    const float *y;
+    float *out;
+    int *missing = (int*)malloc(sizeof(int)*num_days);
+    int num_missing, num_valid, num_fit = 0;
+    int px, d, i, m;
+    double val;
+
+    for (px = 0; px < num_px; px++) {
+        y = data + (size_t)px * num_days;
+        ok[px] = 0;
+
+        /* right hand side and the missing days */
+        memset(coef, 0, sizeof(coef));
+        num_missing = 0;
+        for (d = 0; d < num_days; d++) {
+            if (isnan(y[d])) {
+                missing[num_missing++] = d;
+                continue;
+            }
+            phi = fit->basis + d*num_terms;
+            for (i = 0; i < num_terms; i++)
+                coef[i] += phi[i] * y[d];
+        }
+        num_valid = num_days - num_missing;
+        if (num_valid < fit->min_days)
+            continue;
+
+        /* normal matrix from whichever set of days is smaller */
+        if (num_missing == 0) {
+            chol = fit->full_chol;
+        } else {
+            if (num_missing < num_valid) {
+                memcpy(normal, fit->full, sizeof(double)*num_pieces);
+                for (m = 0; m < num_missing; m++) {
+                    piece = fit->pieces + missing[m]*num_pieces;
+                    for (i = 0; i < num_pieces; i++)
+                        normal[i] -= piece[i];
+                }
+            } else {
+                memset(normal, 0, sizeof(double)*num_pieces);
+                for (d = 0, m = 0; d < num_days; d++) {
+                    if (m < num_missing && missing[m] == d) {
+                        m++;
+                        continue;
+                    }
+                    piece = fit->pieces + d*num_pieces;
+                    for (i = 0; i < num_pieces; i++)
+                        normal[i] += piece[i];
+                }
+            }
+            if (cholesky(normal, num_terms))
+                continue;
+            chol = normal;
+        }
+        cholesky_solve(chol, coef, num_terms);
+
+        out = curve + (size_t)px * num_days;
+        for (d = 0; d < num_days; d++) {
+            phi = fit->basis + d*num_terms;
+            val = 0;
+            for (i = 0; i < fit->eval_terms; i++)
+                val += coef[i] * phi[i];
+            out[d] = val;
+        }
+        if (coef_out) {
+            for (i = 0; i < fit->eval_terms; i++)
+                coef_out[(size_t)px * fit->eval_terms + i] = coef[i];
+        }
+        ok[px] = 1;
+        num_fit++;
+    }
+
+    free(missing);
+    return num_fit;
+}
+
+/* Evaluate the curve given by eval_terms coefficients on day 0..num_days-1 */
+float fourier_fit_eval(const fourier_fit *fit, const float *coef, int day) {
+    const double *phi = fit->basis + (day % fit->num_days) * fit->num_terms;
+    double val = 0;
+    int i;
+
+    for (i = 0; i < fit->eval_terms; i++)
+        val += coef[i] * phi[i];
+    return val;
+}
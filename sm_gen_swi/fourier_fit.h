@@ -0,0 +1,37 @@
+/*
+ * fourier_fit.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef FOURIER_FIT_H_
+#define FOURIER_FIT_H_
+
+/* up to four harmonics plus the constant term */
+#define FOURIER_MAX_TERMS 9
+#define FOURIER_MAX_PIECES (FOURIER_MAX_TERMS*(FOURIER_MAX_TERMS+1)/2)
+
+/* Shared part of a fixed period least squares fourier series fit. The basis
+ * and the per-day pieces of the normal equations only depend on the period,
+ * so they are computed once and reused for every pixel. */
+typedef struct {
+    int num_days;
+    int num_terms;      /* 2*harmonics+1 terms in the fit */
+    int eval_terms;     /* terms kept when the curve is evaluated */
+    int num_pieces;     /* packed lower triangle of the normal matrix */
+    int min_days;       /* fewer valid days than this is not fit */
+    double *basis;      /* [num_days][num_terms] */
+    double *pieces;     /* [num_days][num_pieces], basis outer products */
+    double full[FOURIER_MAX_PIECES];        /* normal matrix, no missing days */
+    double full_chol[FOURIER_MAX_PIECES];   /* its cholesky factor */
+} fourier_fit;
+
+int fourier_fit_init(fourier_fit *fit, int num_days, int fit_harmonics,
+        int eval_harmonics, int min_days);
+void fourier_fit_free(fourier_fit *fit);
+int fourier_fit_batch(const fourier_fit *fit, const float *data, int num_px,
+        float *curve, float *coef, unsigned char *ok);
+float fourier_fit_eval(const fourier_fit *fit, const float *coef, int day);
+
+#endif /* FOURIER_FIT_H_ */
@@ -0,0 +1,846 @@
+/*
+ * gen_swi.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Native replacement for the sm_gen_swi.m / sm_swi_jobs.m row jobs.
+ *  Loads c0 and the arid mask once, streams row bands of the ts_a/ts_b
+ *  NetCDF files and computes sigma0_dry/sigma0_wet, ms and SWI for every
+ *  pixel on a pool of worker threads. The per-row swi files are written with
+ *  the same layout the MATLAB script produced so sm_gen_img can read them
+ *  unchanged.
+ */
+
+#include <stdlib.h>
+#include <argp.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include <netcdf.h>
+
+#include "swi_filter.h"
+#include "fourier_fit.h"
+#include "swi_state.h"
+#include "swi_pixel.h"
+
+#define NUM_THREADS 24
+#define YEAR_END 2014
+
+/* rows read from the ts files at a time, two bands are kept in memory */
+#define BAND_ROWS 48
+
+#define NDIMS 4
+
+/* characteristic times computed when none are given */
+#define DEFAULT_SWI_T_LIST "1,5,10,20,40,60"
+
+/* Handle errors by printing an error message and exiting with a
+ * non-zero status. */
+#define ERR(e) {printf("Error: %s\n", nc_strerror(e)); exit(2);}
+
+/* some global mutexes */
+pthread_mutex_t fopen_lock;
+pthread_mutex_t row_lock;
+
+/* Program documentation. */
+static char doc[] =
+  "sm_gen_swi.c-- Program to compute sigma0-dry, topsoil moisture and the\
+ soil water index from the time series and c0 NetCDF files.\n\
+ Region must be a defined type 'NAm','SAm', etc.";
+
+/* A description of the arguments we accept. */
+static char args_doc[] = "Region";
+
+/* The options we understand. */
+static struct argp_option options[] = {
+  {"verbose",  'v', 0,      0,  "Produce verbose output" },
+  {"grd",  'g', 0,      0,  "Process the grd time series" },
+  {"swi-t",  't', "T_LIST", 0,  "Comma separated SWI characteristic times in days, one of them 20 (default " DEFAULT_SWI_T_LIST ")" },
+  {"save-state",  's', 0,      0,  "Save the SWI filter state of every pixel for later updates" },
+  {"update",  'u', "YEAR:DOY", 0,  "Only add the A image of one day to the saved filter state" },
+  {"a-image",  'a', "FILE",   0,  "A image to use with --update (default is the msfa file in the temp dir)" },
+  {"rows",  'r', "START:END", 0,  "Only process rows START to END (1-based)" },
+  { 0 }
+};
+
+/* Used by main to communicate with parse_opt. */
+struct arguments
+{
+  char *region;                /* Region */
+  int grd;
+  int verbose;
+  float t_char[MAX_SWI_T];
+  int num_t;
+  int save_state;
+  int update_year;
+  int update_doy;
+  char *a_image;
+  int row_start;
+  int row_end;
+};
+
+/* Parse a comma separated list of characteristic times */
+int parse_t_list(char *arg, struct arguments *arguments) {
+    char *end;
+    arguments->num_t = 0;
+    while (*arg) {
+        if (arguments->num_t == MAX_SWI_T)
+            return -1;
+        arguments->t_char[arguments->num_t] = strtof(arg, &end);
+        if (end == arg || arguments->t_char[arguments->num_t] <= 0)
+            return -1;
+        arguments->num_t++;
+        arg = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0')
+            return -1;
+    }
+    return arguments->num_t > 0 ? 0 : -1;
+}
+
+/* The row files need the swi variable of SWI_T, and every characteristic
+ * time its own variable name */
+int check_t_list(struct arguments *arguments, char *bad, size_t bad_len) {
+    char name[NC_MAX_NAME], other[NC_MAX_NAME];
+    int k, j, has_swi = 0;
+
+    for (k = 0; k < arguments->num_t; k++) {
+        swi_var_name(name, arguments->t_char[k]);
+        if (strcmp(name, "swi") == 0)
+            has_swi = 1;
+        for (j = 0; j < k; j++) {
+            swi_var_name(other, arguments->t_char[j]);
+            if (strcmp(name, other) == 0) {
+                snprintf(bad, bad_len, "%g is given twice", arguments->t_char[k]);
+                return -1;
+            }
+        }
+    }
+    if (!has_swi) {
+        snprintf(bad, bad_len, "%d must be one of the times", SWI_T);
+        return -1;
+    }
+    return 0;
+}
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  /* Get the input argument from argp_parse, which we
+     know is a pointer to our arguments structure. */
+  struct arguments *arguments = state->input;
+
+  switch (key)
+    {
+    case 'v':
+      arguments->verbose = 1;
+      break;
+    case 'g':
+      arguments->grd = 1;
+      break;
+    case 's':
+      arguments->save_state = 1;
+      break;
+    case 'u':
+      if (sscanf(arg, "%d:%d", &arguments->update_year, &arguments->update_doy) != 2 ||
+              arguments->update_year < YEAR_START ||
+              arguments->update_doy < 1 || arguments->update_doy > NUM_DAYS)
+          argp_failure(state, 1, 0, "ERROR, could not parse update day %s!", arg);
+      break;
+    case 'a':
+      arguments->a_image = arg;
+      break;
+    case 'r':
+      if (sscanf(arg, "%d:%d", &arguments->row_start, &arguments->row_end) != 2 ||
+              arguments->row_start < 1 || arguments->row_end < arguments->row_start)
+          argp_failure(state, 1, 0, "ERROR, could not parse row range %s!", arg);
+      break;
+    case 't': {
+      char bad[100];
+      if (parse_t_list(arg, arguments))
+          argp_failure(state, 1, 0, "ERROR, could not parse SWI time list %s!", arg);
+      if (check_t_list(arguments, bad, sizeof(bad)))
+          argp_failure(state, 1, 0, "ERROR, SWI time list %s: %s!", arg, bad);
+      break;
+    }
+    case ARGP_KEY_ARG:
+      if (state->arg_num >= 1) {
+        /* Too many arguments. */
+        argp_usage (state);
+      }
+      else if (arguments->region == NULL) {
+          arguments->region = arg;
+      }
+      break;
+
+    case ARGP_KEY_END:
+      if (state->arg_num < 1) {
+        /* Not enough arguments. */
+        argp_usage (state);
+      }
+      else if (arguments->region == NULL) {
+          argp_failure(state, 1, 0, "ERROR, region not defined!");
+      }
+      else if (
+      strcmp(arguments->region,"Ama") != 0 &&
+      strcmp(arguments->region,"Aus") != 0 &&
+      strcmp(arguments->region,"Ber") != 0 &&
+      strcmp(arguments->region,"CAm") != 0 &&
+      strcmp(arguments->region,"ChJ") != 0 &&
+      strcmp(arguments->region,"Eur") != 0 &&
+      strcmp(arguments->region,"Ind") != 0 &&
+      strcmp(arguments->region,"NAf") != 0 &&
+      strcmp(arguments->region,"NAm") != 0 &&
+      strcmp(arguments->region,"SAf") != 0 &&
+      strcmp(arguments->region,"SAm") != 0 &&
+      strcmp(arguments->region,"SAs") != 0) {
+          argp_failure(state, 1, 0, "ERROR, inputted region not defined!");
+      }
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+/* Our argp parser. */
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+/* slope fit setup, shared by all threads */
+static fourier_fit slope_fit;
+
+/* Read rows [start_row, start_row+num_band_rows) of a ts file */
+void read_band(int ncid, int varid, int start_row, int num_band_rows, int num_columns, float *band) {
+    size_t start[NDIMS] = {start_row, 0, 0, 0};
+    size_t count[NDIMS] = {num_band_rows, num_columns, NUM_YEARS, NUM_DAYS};
+    int retval;
+
+    if ((retval = nc_get_vara_float(ncid, varid, start, count, band)))
+        ERR(retval);
+    return;
+}
+
+/* Read the c0 images, 0 is no data */
+void load_c0(char *region, float *c0_dry, float *c0_wet, size_t img_len) {
+    char fname[150];
+    int ncid, dry_varid, wet_varid;
+    int retval;
+    size_t i;
+
+    sprintf(fname,"/auto/temp/lindell/soilmoisture/c0/c0_%s.nc",region);
+    if ((retval = nc_open(fname, NC_NOWRITE, &ncid)))
+        ERR(retval);
+    if ((retval = nc_inq_varid(ncid, "dry", &dry_varid)))
+        ERR(retval);
+    if ((retval = nc_inq_varid(ncid, "wet", &wet_varid)))
+        ERR(retval);
+    if ((retval = nc_get_var_float(ncid, dry_varid, c0_dry)))
+        ERR(retval);
+    if ((retval = nc_get_var_float(ncid, wet_varid, c0_wet)))
+        ERR(retval);
+    if ((retval = nc_close(ncid)))
+        ERR(retval);
+
+    for (i = 0; i < img_len; i++) {
+        if (c0_dry[i] == 0)
+            c0_dry[i] = NAN;
+        if (c0_wet[i] == 0)
+            c0_wet[i] = NAN;
+    }
+    return;
+}
+
+typedef struct {
+    float *band_a;
+    float *band_b;
+    float *c0_dry;
+    float *c0_wet;
+    unsigned char *arid;
+    float *swi[MAX_SWI_T];
+    float *t_char;
+    int num_t;
+    float *ms;
+    float *dry;
+    float *scratch;
+    float *filter_scratch;
+    float *fit_data;
+    float *slope;
+    float *coef;
+    unsigned char *fit_ok;
+    float *last_gain;
+    float *last_swi;
+    swi_state *state;
+    int *next_row;
+    int band_start;
+    int band_stop;
+    int num_columns;
+    char *region;
+    pthread_mutex_t *fopen_lock;
+    pthread_mutex_t *row_lock;
+} thread_args;
+
+/* Keep the end of series filter state of a row so it can be updated later */
+void save_row_state(thread_args *t_args, int row, float *ms) {
+    int num_columns = t_args->num_columns;
+    int num_t = t_args->num_t;
+    swi_pixel_state *px;
+    int col, t, k;
+
+    for (col = 0; col < num_columns; col++) {
+        px = &t_args->state->pixels[(size_t)row*num_columns + col];
+        px->last_day = -1;
+        for (t = NUM_TS - 1; t >= 0; t--) {
+            if (!isnan(ms[(size_t)col*NUM_TS + t])) {
+                px->last_day = t;
+                break;
+            }
+        }
+        for (k = 0; k < SWI_STATE_TERMS; k++) {
+            px->coef[k] = t_args->fit_ok[col] ?
+                    t_args->coef[col*SWI_STATE_TERMS + k] : NAN;
+        }
+        for (k = 0; k < num_t; k++) {
+            px->gain[k] = t_args->last_gain[col*num_t + k];
+            px->swi[k] = t_args->last_swi[col*num_t + k];
+        }
+    }
+    return;
+}
+
+void *mthreadGenSwi(void *arg) {
+    thread_args *t_args = (thread_args*)arg;
+    int num_columns = t_args->num_columns;
+    float **swi = t_args->swi;
+    float *ms = t_args->ms;
+    float *dry = t_args->dry;
+    float *slope = t_args->slope;
+    size_t t, px, row_len = (size_t)num_columns * NUM_TS;
+    float *ts_a, *ts_b;
+    int row, col;
+
+    for (;;) {
+        /* grab the next row of the band */
+        pthread_mutex_lock(t_args->row_lock);
+        row = (*t_args->next_row)++;
+        pthread_mutex_unlock(t_args->row_lock);
+        if (row > t_args->band_stop)
+            break;
+
+        setvbuf (stdout, NULL, _IONBF, 0);
+        printf("Processing Row: %04d\n",row+1);
+
+        ts_a = t_args->band_a + (row - t_args->band_start) * row_len;
+        ts_b = t_args->band_b + (row - t_args->band_start) * row_len;
+        clean_row(ts_a, ts_b, t_args->scratch, num_columns);
+
+        /* seasonal slope curve of the whole row in one batch */
+        yearly_mean(ts_b, t_args->fit_data, num_columns);
+        fourier_fit_batch(&slope_fit, t_args->fit_data, num_columns, slope,
+                t_args->coef, t_args->fit_ok);
+
+        for (t = 0; t < row_len; t++) {
+            ms[t] = NAN;
+            dry[t] = NAN;
+        }
+
+        for (col = 0; col < num_columns; col++) {
+            px = (size_t)row * num_columns + col;
+            if (isnan(t_args->c0_dry[px]) || isnan(t_args->c0_wet[px]))
+                continue;
+            if (!t_args->fit_ok[col])
+                continue;
+
+            process_pixel(ts_a + col * NUM_TS, slope + col * NUM_DAYS, t_args->c0_dry[px],
+                    t_args->c0_wet[px], t_args->arid[px],
+                    ms + col * NUM_TS, dry + col * NUM_TS);
+        }
+
+        /* all characteristic times in one pass over the row */
+        swi_filter_pixels(ms, swi, num_columns, NUM_TS, t_args->t_char,
+                t_args->num_t, t_args->filter_scratch, t_args->last_gain,
+                t_args->last_swi);
+
+        if (t_args->state)
+            save_row_state(t_args, row, ms);
+
+        pthread_mutex_lock(t_args->fopen_lock);
+        write_row(t_args->region, row, num_columns, swi, t_args->t_char,
+                t_args->num_t, ms, dry);
+        pthread_mutex_unlock(t_args->fopen_lock);
+    }
+    return NULL;
+}
+
+/* Write one day of swi/ms/dry images, same layout as sm_gen_img */
+void write_day(char *region, int year, int doy, int num_rows, int num_columns,
+        float **swi, float *t_char, int num_t, float *ms, float *dry) {
+    char fname[150];
+    char var_name[NC_MAX_NAME];
+    int ncid, row_dimid, col_dimid;
+    int swi_varid[SWI_STATE_MAX_T], ms_varid, dry_varid;
+    int dimids[2];
+    int retval, k;
+
+    sprintf(fname,"/auto/temp/lindell/soilmoisture/swi/combined/swi_%s_%04d_%03d.nc",region,year,doy);
+    if ((retval = nc_create(fname, NC_NETCDF4|NC_CLOBBER, &ncid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(ncid, "row", num_rows, &row_dimid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(ncid, "column", num_columns, &col_dimid)))
+        ERR(retval);
+    dimids[0] = row_dimid;
+    dimids[1] = col_dimid;
+
+    for (k = 0; k < num_t; k++) {
+        swi_var_name(var_name, t_char[k]);
+        if ((retval = nc_def_var(ncid, var_name, NC_FLOAT, 2, dimids, &swi_varid[k])))
+            ERR(retval);
+    }
+    if ((retval = nc_def_var(ncid, "ms", NC_FLOAT, 2, dimids, &ms_varid)))
+        ERR(retval);
+    if ((retval = nc_def_var(ncid, "dry", NC_FLOAT, 2, dimids, &dry_varid)))
+        ERR(retval);
+    if ((retval = nc_enddef(ncid)))
+        ERR(retval);
+
+    for (k = 0; k < num_t; k++) {
+        if ((retval = nc_put_var_float(ncid, swi_varid[k], swi[k])))
+            ERR(retval);
+    }
+    if ((retval = nc_put_var_float(ncid, ms_varid, ms)))
+        ERR(retval);
+    if ((retval = nc_put_var_float(ncid, dry_varid, dry)))
+        ERR(retval);
+    if ((retval = nc_close(ncid)))
+        ERR(retval);
+    return;
+}
+
+/* Near real time mode: compute ms for one new A image, advance the saved
+ * filter state of every pixel and write that day's images */
+void run_update(struct arguments *arguments, int num_rows, int num_columns) {
+    char *region = arguments->region;
+    int year = arguments->update_year;
+    int doy = arguments->update_doy;
+    int day = (year - YEAR_START) * NUM_DAYS + doy - 1;
+    size_t i, img_len = (size_t)num_rows * num_columns;
+    char state_fname[150], a_fname[150];
+    float swi_px[SWI_STATE_MAX_T];
+    float *swi[SWI_STATE_MAX_T];
+    float sigma0_dry, sigma0_wet, a, slope;
+    swi_pixel_state *px;
+    swi_state state;
+    int num_t, k, num_obs = 0;
+
+    printf("Updating SWI state for day %03d of %04d\n", doy, year);
+
+    sprintf(state_fname,"/auto/temp/lindell/soilmoisture/swi/state_%s.bin",region);
+    if (swi_state_read(&state, state_fname)) {
+        fprintf(stderr,"*** could not read state file %s\n",state_fname);
+        exit(-1);
+    }
+    if (state.head.num_rows != num_rows || state.head.num_columns != num_columns) {
+        fprintf(stderr,"*** state file %s does not match the region size\n",state_fname);
+        exit(-1);
+    }
+    if (day <= state.head.last_update) {
+        fprintf(stderr,"*** state is already at day %d, can't add day %d\n",
+                state.head.last_update, day);
+        exit(-1);
+    }
+    num_t = state.head.num_t;
+
+    if (fourier_fit_init(&slope_fit, NUM_DAYS, FIT_HARMONICS, EVAL_HARMONICS, MIN_FIT_DAYS)) {
+        fprintf(stderr, "Error setting up the slope fit!\n");
+        exit(-1);
+    }
+
+    float *c0_dry = (float*)malloc(sizeof(float)*img_len);
+    float *c0_wet = (float*)malloc(sizeof(float)*img_len);
+    unsigned char *arid = (unsigned char*)malloc(img_len);
+    float *a_img = (float*)malloc(sizeof(float)*img_len);
+    float *ms = (float*)malloc(sizeof(float)*img_len);
+    float *dry = (float*)malloc(sizeof(float)*img_len);
+    for (k = 0; k < num_t; k++) {
+        swi[k] = (float*)malloc(sizeof(float)*img_len);
+        if (!swi[k]) {
+            fprintf(stderr, "Memory Error!\n");
+            exit(-1);
+        }
+    }
+    if (!c0_dry || !c0_wet || !arid || !a_img || !ms || !dry) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+
+    load_c0(region, c0_dry, c0_wet, img_len);
+    load_arid(region, arguments->grd, arid, num_rows, num_columns);
+
+    if (arguments->a_image)
+        strcpy(a_fname, arguments->a_image);
+    else
+        sprintf(a_fname,"/auto/temp/lindell/soilmoisture/msfa-a-%s%02d-%03d-%03d.sir",
+                region,year-2000,doy,doy+4);
+    if (read_sir_image(a_fname, a_img, num_rows, num_columns)) {
+        fprintf(stderr,"*** could not open A image %s\n",a_fname);
+        exit(-1);
+    }
+
+    for (i = 0; i < img_len; i++) {
+        px = &state.pixels[i];
+        a = a_img[i];
+        ms[i] = NAN;
+        dry[i] = NAN;
+        for (k = 0; k < num_t; k++)
+            swi[k][i] = NAN;
+
+        if (isnan(px->coef[0]) || isnan(c0_dry[i]) || isnan(c0_wet[i]))
+            continue;
+
+        slope = fourier_fit_eval(&slope_fit, px->coef, doy - 1);
+        sigma0_dry = c0_dry[i] - slope * (THETA_DRY - THETA_REF);
+        sigma0_wet = c0_wet[i] - slope * (THETA_WET - THETA_REF);
+        if (arid[i] && sigma0_wet - sigma0_dry < 5)
+            sigma0_wet = sigma0_dry + 5;
+        dry[i] = sigma0_dry;
+
+        if (a == 0 || fabsf(fabsf(a) - 33) < .01)
+            continue;
+
+        ms[i] = (a - sigma0_dry) / (sigma0_wet - sigma0_dry);
+        swi_state_advance(px, state.head.t_char, num_t, day, ms[i], swi_px);
+        for (k = 0; k < num_t; k++)
+            swi[k][i] = swi_px[k];
+        num_obs++;
+    }
+    printf("%d pixels observed\n", num_obs);
+
+    write_day(region, year, doy, num_rows, num_columns, swi, state.head.t_char,
+            num_t, ms, dry);
+
+    state.head.last_update = day;
+    if (swi_state_write(&state, state_fname)) {
+        fprintf(stderr,"*** could not write state file %s\n",state_fname);
+        exit(-1);
+    }
+
+    for (k = 0; k < num_t; k++)
+        free(swi[k]);
+    free(c0_dry);
+    free(c0_wet);
+    free(arid);
+    free(a_img);
+    free(ms);
+    free(dry);
+    swi_state_free(&state);
+    fourier_fit_free(&slope_fit);
+    return;
+}
+
+int main (int argc, char **argv)
+{
+    struct arguments arguments;
+
+    /* Default values. */
+    arguments.verbose = 0;
+    arguments.grd = 0;
+    arguments.region = NULL;
+    arguments.save_state = 0;
+    arguments.update_year = 0;
+    arguments.update_doy = 0;
+    arguments.a_image = NULL;
+    arguments.row_start = 0;
+    arguments.row_end = 0;
+    parse_t_list(DEFAULT_SWI_T_LIST, &arguments);
+
+    /* Parse our arguments; every option seen by parse_opt will
+     be reflected in arguments. */
+    argp_parse (&argp, argc, argv, 0, 0, &arguments);
+
+    /* Set up variables */
+    int num_columns;
+    int num_rows;
+    char* region = arguments.region;
+    int grd = arguments.grd;
+    int k;
+    size_t i;
+
+    /* Initialize NETCDF Variables */
+    int ts_a_ncid, ts_b_ncid;
+    int ts_a_varid, ts_b_varid;
+    int retval;
+    char FILE_NAME[150];
+
+    /* multithread args */
+    thread_args t_args[NUM_THREADS];
+    pthread_t thread_id[NUM_THREADS];
+    int next_row;
+
+    printf ("GEN_SWI\n---------------\nBeginning processing with options:\n");
+
+    printf ("Region = %s\nVERBOSE = %s\nGRD = %s\nSWI T =",
+      arguments.region,
+      arguments.verbose ? "yes" : "no",
+      arguments.grd ? "yes" : "no");
+    for (k = 0; k < arguments.num_t; k++)
+        printf(" %g", arguments.t_char[k]);
+    printf("\n---------------\n");
+
+    /* define image areas based on region */
+    if (!grd) {
+        if (strcmp(region,"Ama") == 0) {
+            num_columns = 1128;
+            num_rows = 744;
+        } else if (strcmp(region,"Ber") == 0) {
+            num_columns = 1350;
+            num_rows = 750;
+        } else if (strcmp(region,"CAm") == 0) {
+              num_columns = 1440;
+              num_rows = 700;
+        } else if (strcmp(region,"ChJ") == 0) {
+              num_columns = 1980;
+              num_rows = 950;
+        } else if (strcmp(region,"Eur") == 0) {
+              num_columns = 1530;
+              num_rows = 1040;
+        } else if (strcmp(region,"Ind") == 0) {
+              num_columns = 1800;
+              num_rows = 680;
+        } else if (strcmp(region,"NAf") == 0) {
+              num_columns = 2120;
+              num_rows = 1130;
+        } else if (strcmp(region,"NAm") == 0) {
+              num_columns = 1890;
+              num_rows = 1150;
+        } else if (strcmp(region,"SAf") == 0) {
+              num_columns = 1220;
+              num_rows = 1260;
+        } else if (strcmp(region,"SAm") == 0) {
+              num_columns = 1310;
+              num_rows = 1850;
+        }  else if (strcmp(region,"SAs") == 0) {
+              num_columns = 1760;
+              num_rows = 720;
+        } else {
+            printf("ERROR SETTING REGION SIZES!");
+            exit(-1);
+        }
+    } else {
+        if (strcmp(region,"NAm") == 0) {
+            num_columns = 672;
+            num_rows = 410;
+        } else {
+            printf("ERROR SETTING REGION SIZES!");
+            exit(-1);
+        }
+    }
+
+    if (arguments.update_year) {
+        run_update(&arguments, num_rows, num_columns);
+        exit (0);
+    }
+
+    /* the per-row output files need no merging, a row range just limits
+     * which of them this process writes */
+    int first_row = 0;
+    int end_row = num_rows;
+    if (arguments.row_start) {
+        if (arguments.row_end > num_rows) {
+            printf("ERROR, row range %d:%d outside of image with %d rows!\n",
+                    arguments.row_start, arguments.row_end, num_rows);
+            exit(-1);
+        }
+        if (arguments.save_state) {
+            fprintf(stderr, "Can't save the SWI state of only part of the rows!\n");
+            exit(-1);
+        }
+        first_row = arguments.row_start - 1;
+        end_row = arguments.row_end;
+        printf("Processing rows %04d-%04d\n", arguments.row_start, arguments.row_end);
+    }
+
+    if (arguments.save_state && arguments.num_t > SWI_STATE_MAX_T) {
+        fprintf(stderr, "Can't save the state of more than %d SWI times!\n", SWI_STATE_MAX_T);
+        exit(-1);
+    }
+
+    setvbuf (stdout, NULL, _IONBF, 0);
+    printf("Allocating Memory...");
+    size_t row_len = (size_t)num_columns * NUM_TS;
+    size_t img_len = (size_t)num_rows * num_columns;
+    float *c0_dry = (float*)malloc(sizeof(float)*img_len);
+    float *c0_wet = (float*)malloc(sizeof(float)*img_len);
+    unsigned char *arid = (unsigned char*)malloc(img_len);
+    float *band_a[2], *band_b[2];
+    for (i = 0; i < 2; i++) {
+        band_a[i] = (float*)malloc(sizeof(float)*BAND_ROWS*row_len);
+        band_b[i] = (float*)malloc(sizeof(float)*BAND_ROWS*row_len);
+        if (!band_a[i] || !band_b[i]) {
+            fprintf(stderr, "Memory Error!\n");
+            exit(-1);
+        }
+    }
+    for (i = 0; i < NUM_THREADS; i++) {
+        for (k = 0; k < arguments.num_t; k++) {
+            t_args[i].swi[k] = (float*)malloc(sizeof(float)*row_len);
+            if (!t_args[i].swi[k]) {
+                fprintf(stderr, "Memory Error!\n");
+                exit(-1);
+            }
+        }
+        t_args[i].ms = (float*)malloc(sizeof(float)*row_len);
+        t_args[i].dry = (float*)malloc(sizeof(float)*row_len);
+        t_args[i].scratch = (float*)malloc(sizeof(float)*row_len);
+        t_args[i].filter_scratch = (float*)malloc(sizeof(float)*SWI_SCRATCH_LEN(NUM_TS, arguments.num_t));
+        t_args[i].fit_data = (float*)malloc(sizeof(float)*num_columns*NUM_DAYS);
+        t_args[i].slope = (float*)malloc(sizeof(float)*num_columns*NUM_DAYS);
+        t_args[i].fit_ok = (unsigned char*)malloc(num_columns);
+        t_args[i].coef = (float*)malloc(sizeof(float)*num_columns*SWI_STATE_TERMS);
+        t_args[i].last_gain = (float*)malloc(sizeof(float)*num_columns*arguments.num_t);
+        t_args[i].last_swi = (float*)malloc(sizeof(float)*num_columns*arguments.num_t);
+        if (!t_args[i].ms || !t_args[i].dry || !t_args[i].scratch || !t_args[i].filter_scratch ||
+                !t_args[i].fit_data || !t_args[i].slope || !t_args[i].fit_ok ||
+                !t_args[i].coef || !t_args[i].last_gain || !t_args[i].last_swi) {
+            fprintf(stderr, "Memory Error!\n");
+            exit(-1);
+        }
+    }
+    if (!c0_dry || !c0_wet || !arid) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+    swi_state state;
+    if (arguments.save_state &&
+            swi_state_alloc(&state, num_rows, num_columns, arguments.t_char, arguments.num_t)) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+    printf("done\n");
+
+    printf("Reading c0 and climate mask...");
+    load_c0(region, c0_dry, c0_wet, img_len);
+    load_arid(region, grd, arid, num_rows, num_columns);
+    printf("done\n");
+
+    /* the time series files stay open while the bands are streamed */
+    sprintf(FILE_NAME,"/auto/temp/lindell/soilmoisture/ts/ts_%s_%s.nc",region,"a");
+    if ((retval = nc_open(FILE_NAME, NC_NOWRITE, &ts_a_ncid)))
+        ERR(retval);
+    if ((retval = nc_inq_varid(ts_a_ncid, "data", &ts_a_varid)))
+        ERR(retval);
+    sprintf(FILE_NAME,"/auto/temp/lindell/soilmoisture/ts/ts_%s_%s.nc",region,"b");
+    if ((retval = nc_open(FILE_NAME, NC_NOWRITE, &ts_b_ncid)))
+        ERR(retval);
+    if ((retval = nc_inq_varid(ts_b_ncid, "data", &ts_b_varid)))
+        ERR(retval);
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        t_args[i].c0_dry = c0_dry;
+        t_args[i].c0_wet = c0_wet;
+        t_args[i].arid = arid;
+        t_args[i].state = arguments.save_state ? &state : NULL;
+        t_args[i].t_char = arguments.t_char;
+        t_args[i].num_t = arguments.num_t;
+        t_args[i].next_row = &next_row;
+        t_args[i].num_columns = num_columns;
+        t_args[i].region = region;
+        t_args[i].fopen_lock = &fopen_lock;
+        t_args[i].row_lock = &row_lock;
+    }
+
+    if (fourier_fit_init(&slope_fit, NUM_DAYS, FIT_HARMONICS, EVAL_HARMONICS, MIN_FIT_DAYS)) {
+        fprintf(stderr, "Error setting up the slope fit!\n");
+        exit(-1);
+    }
+
+    printf("Starting Processing\n");
+    int cur = 0;
+    int band_start = first_row;
+    int band_rows = BAND_ROWS < end_row - first_row ? BAND_ROWS : end_row - first_row;
+    read_band(ts_a_ncid, ts_a_varid, band_start, band_rows, num_columns, band_a[cur]);
+    read_band(ts_b_ncid, ts_b_varid, band_start, band_rows, num_columns, band_b[cur]);
+
+    while (band_start < end_row) {
+        next_row = band_start;
+        for (i = 0; i < NUM_THREADS; i++) {
+            t_args[i].band_a = band_a[cur];
+            t_args[i].band_b = band_b[cur];
+            t_args[i].band_start = band_start;
+            t_args[i].band_stop = band_start + band_rows - 1;
+            pthread_create(&thread_id[i], NULL, mthreadGenSwi, &t_args[i]);
+        }
+
+        /* read the next band while this one is processed */
+        int next_start = band_start + band_rows;
+        int next_rows = end_row - next_start < BAND_ROWS ? end_row - next_start : BAND_ROWS;
+        if (next_rows > 0) {
+            pthread_mutex_lock(&fopen_lock);
+            read_band(ts_a_ncid, ts_a_varid, next_start, next_rows, num_columns, band_a[!cur]);
+            read_band(ts_b_ncid, ts_b_varid, next_start, next_rows, num_columns, band_b[!cur]);
+            pthread_mutex_unlock(&fopen_lock);
+        }
+
+        for (i = 0; i < NUM_THREADS; i++) {
+            pthread_join(thread_id[i], NULL);
+        }
+
+        band_start = next_start;
+        band_rows = next_rows;
+        cur = !cur;
+    }
+
+    if ((retval = nc_close(ts_a_ncid)))
+        ERR(retval);
+    if ((retval = nc_close(ts_b_ncid)))
+        ERR(retval);
+
+    if (arguments.save_state) {
+        printf("Saving SWI state...");
+        state.head.last_update = NUM_TS - 1;
+        sprintf(FILE_NAME,"/auto/temp/lindell/soilmoisture/swi/state_%s.bin",region);
+        if (swi_state_write(&state, FILE_NAME)) {
+            fprintf(stderr,"*** could not write state file %s\n",FILE_NAME);
+            exit(-1);
+        }
+        swi_state_free(&state);
+        printf("done\n");
+    }
+
+    printf("Finishing up...");
+    for (i = 0; i < 2; i++) {
+        free(band_a[i]);
+        free(band_b[i]);
+    }
+    for (i = 0; i < NUM_THREADS; i++) {
+        for (k = 0; k < arguments.num_t; k++)
+            free(t_args[i].swi[k]);
+        free(t_args[i].filter_scratch);
+        free(t_args[i].fit_data);
+        free(t_args[i].slope);
+        free(t_args[i].fit_ok);
+        free(t_args[i].coef);
+        free(t_args[i].last_gain);
+        free(t_args[i].last_swi);
+        free(t_args[i].ms);
+        free(t_args[i].dry);
+        free(t_args[i].scratch);
+    }
+    free(c0_dry);
+    free(c0_wet);
+    free(arid);
+    fourier_fit_free(&slope_fit);
+
+    printf("done\n");
+
+    exit (0);
+}
@@ -0,0 +1,126 @@
+/*
+ * swi_filter.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Recursive form of the SWI exponential filter (Albergel 2008):
+ *
+ *      K_n   = K_{n-1} / (K_{n-1} + exp(-(t_n - t_{n-1})/T))
+ *      SWI_n = SWI_{n-1} + K_n (ms_n - SWI_{n-1})
+ *
+ *  which gives the same values as the weighted sum over all previous
+ *  observations in sm_gen_swi.m, but in one pass. The time series is walked
+ *  one day at a time, so exp(-gap/T) is carried as a running product of the
+ *  daily decay and no exp is needed inside the loop. SWI_LANES pixels are
+ *  filtered together in vector registers.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "swi_filter.h"
+
+typedef float vfloat __attribute__ ((vector_size (SWI_LANES * sizeof(float))));
+typedef int vint __attribute__ ((vector_size (SWI_LANES * sizeof(int))));
+
+/* decays below this are flushed to zero to keep out of denormals */
+#define MIN_DECAY 1e-30f
+
+static inline vfloat vselect(vint mask, vfloat a, vfloat b) {
+    return (vfloat)(((vint)a & mask) | ((vint)b & ~mask));
+}
+
+/* Filter one group of lanes for all characteristic times in one pass.
+ * ms is [num_ts][SWI_LANES], NaN where there is no observation, swi is
+ * [num_t][num_ts][SWI_LANES] and is NaN on days without one. The gain and
+ * SWI after the last observation go to last_gain/last_swi, [num_t][SWI_LANES] */
+static void swi_filter_lanes(const float *ms, float *swi, int num_ts,
+        const float *t_char, int num_t, float *last_gain, float *last_swi) {
+    vfloat gain[MAX_SWI_T], val[MAX_SWI_T], decay[MAX_SWI_T], day_decay[MAX_SWI_T];
+    vfloat x, out, new_gain, new_val;
+    vfloat zero = {0};
+    vfloat tiny = zero + MIN_DECAY;
+    vfloat nan_v = zero + NAN;
+    vint valid;
+    int t, k;
+
+    for (k = 0; k < num_t; k++) {
+        gain[k] = zero + 1;
+        val[k] = zero;
+        decay[k] = zero;
+        day_decay[k] = zero + expf(-1 / t_char[k]);
+    }
+
+    for (t = 0; t < num_ts; t++) {
+        memcpy(&x, ms + (size_t)t * SWI_LANES, sizeof(x));
+        valid = x == x;
+
+        for (k = 0; k < num_t; k++) {
+            new_gain = gain[k] / (gain[k] + decay[k]);
+            new_val = val[k] + new_gain * (x - val[k]);
+
+            gain[k] = vselect(valid, new_gain, gain[k]);
+            val[k] = vselect(valid, new_val, val[k]);
+            decay[k] = vselect(valid, day_decay[k], decay[k] * day_decay[k]);
+            decay[k] = vselect(decay[k] < tiny, zero, decay[k]);
+
+            out = vselect(valid, new_val, nan_v);
+            memcpy(swi + ((size_t)k * num_ts + t) * SWI_LANES, &out, sizeof(out));
+        }
+    }
+
+    for (k = 0; k < num_t; k++) {
+        memcpy(last_gain + k*SWI_LANES, &gain[k], sizeof(gain[k]));
+        memcpy(last_swi + k*SWI_LANES, &val[k], sizeof(val[k]));
+    }
+    return;
+}
+
+/* Compute the SWI for num_t characteristic times. ms is [num_px][num_ts],
+ * swi[k] is [num_px][num_ts] for t_char[k]. scratch must hold
+ * SWI_SCRATCH_LEN(num_ts, num_t) floats. If last_gain and last_swi are not
+ * NULL they get the filter state at the end of the series, [num_px][num_t],
+ * so the series can be continued later. */
+void swi_filter_pixels(const float *ms, float **swi, int num_px, int num_ts,
+        const float *t_char, int num_t, float *scratch, float *last_gain,
+        float *last_swi) {
+    float *lanes_in = scratch;
+    float *lanes_out = scratch + (size_t)num_ts * SWI_LANES;
+    float lanes_gain[MAX_SWI_T*SWI_LANES], lanes_swi[MAX_SWI_T*SWI_LANES];
+    int px, lane, num_lanes, t, k;
+
+    for (px = 0; px < num_px; px += SWI_LANES) {
+        num_lanes = num_px - px < SWI_LANES ? num_px - px : SWI_LANES;
+
+        /* interleave the pixels so each day is one vector */
+        for (t = 0; t < num_ts; t++) {
+            for (lane = 0; lane < SWI_LANES; lane++) {
+                lanes_in[t*SWI_LANES + lane] = lane < num_lanes ?
+                        ms[(size_t)(px + lane) * num_ts + t] : NAN;
+            }
+        }
+
+        swi_filter_lanes(lanes_in, lanes_out, num_ts, t_char, num_t,
+                lanes_gain, lanes_swi);
+
+        for (k = 0; k < num_t; k++) {
+            float *out = lanes_out + (size_t)k * num_ts * SWI_LANES;
+            for (lane = 0; lane < num_lanes; lane++) {
+                for (t = 0; t < num_ts; t++)
+                    swi[k][(size_t)(px + lane) * num_ts + t] = out[t*SWI_LANES + lane];
+            }
+        }
+
+        if (last_gain && last_swi) {
+            for (lane = 0; lane < num_lanes; lane++) {
+                for (k = 0; k < num_t; k++) {
+                    last_gain[(px + lane)*num_t + k] = lanes_gain[k*SWI_LANES + lane];
+                    last_swi[(px + lane)*num_t + k] = lanes_swi[k*SWI_LANES + lane];
+                }
+            }
+        }
+    }
+    return;
+}
@@ -0,0 +1,32 @@
+/*
+ * swi_filter.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef SWI_FILTER_H_
+#define SWI_FILTER_H_
+
+#include <stddef.h>
+
+/* pixels filtered together, 16 when built for AVX-512, 8 for AVX */
+#ifndef SWI_LANES
+#ifdef __AVX512F__
+#define SWI_LANES 16
+#else
+#define SWI_LANES 8
+#endif
+#endif
+
+/* most characteristic times computed in one pass */
+#define MAX_SWI_T 16
+
+/* floats of scratch space needed by swi_filter_pixels */
+#define SWI_SCRATCH_LEN(num_ts, num_t) ((size_t)(num_ts) * SWI_LANES * ((num_t) + 1))
+
+void swi_filter_pixels(const float *ms, float **swi, int num_px, int num_ts,
+        const float *t_char, int num_t, float *scratch, float *last_gain,
+        float *last_swi);
+
+#endif /* SWI_FILTER_H_ */
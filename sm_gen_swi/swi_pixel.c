@@ -0,0 +1,231 @@
+/*
+ * swi_pixel.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Per-row and per-pixel steps of the SWI processing, shared by sm_gen_swi
+ *  and sm_pipeline: cleaning the time series, the sigma0-dry/ms model, the
+ *  per-row output files and the climate mask.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sir_ez.h>
+#include <sir3.h>
+
+#include <netcdf.h>
+
+#include "swi_filter.h"
+#include "swi_pixel.h"
+
+#define NDIMS 4
+
+/* Handle errors by printing an error message and exiting with a
+ * non-zero status. */
+#define ERR(e) {printf("Error: %s\n", nc_strerror(e)); exit(2);}
+
+int floatcmpfunc (const void * a, const void * b)
+{
+   float result = ( *(float*)a - *(float*)b );
+   if (result > 0)
+       return 1;
+   else if (result == 0)
+       return 0;
+   else
+       return -1;
+}
+
+/* percentile of sorted data, same interpolation as MATLAB's prctile */
+float prctile(float *sorted, int n, float p) {
+    float pos = n * p / 100 - 0.5;
+    int lo;
+
+    if (pos <= 0)
+        return sorted[0];
+    if (pos >= n - 1)
+        return sorted[n-1];
+    lo = (int)pos;
+    return sorted[lo] + (pos - lo) * (sorted[lo+1] - sorted[lo]);
+}
+
+/* Replace the no-data values in one row of the a/b time series with NaN
+ * and drop slope outliers more than 2 IQR away from the row mean */
+void clean_row(float *ts_a, float *ts_b, float *scratch, int num_columns) {
+    size_t i;
+    size_t n = (size_t)num_columns * NUM_TS;
+    int num_valid = 0;
+    double av = 0;
+    float iq, lo, hi;
+
+    for (i = 0; i < n; i++) {
+        if (ts_a[i] == 0 || fabsf(fabsf(ts_a[i]) - 33) < .01)
+            ts_a[i] = NAN;
+        if (ts_b[i] == 0 || fabsf(fabsf(ts_b[i]) - 3) < .01)
+            ts_b[i] = NAN;
+        if (!isnan(ts_b[i])) {
+            scratch[num_valid++] = ts_b[i];
+            av += ts_b[i];
+        }
+    }
+
+    if (num_valid == 0)
+        return;
+
+    qsort(scratch, num_valid, sizeof(float), floatcmpfunc);
+    iq = prctile(scratch, num_valid, 75) - prctile(scratch, num_valid, 25);
+    av = av / num_valid;
+    lo = av - 2 * iq;
+    hi = av + 2 * iq;
+
+    for (i = 0; i < n; i++) {
+        if (ts_b[i] > hi || ts_b[i] < lo)
+            ts_b[i] = NAN;
+    }
+    return;
+}
+
+/* Mean of each day over the years for every pixel of a row, any missing
+ * year leaves the day out of the slope fit */
+void yearly_mean(float *ts_b, float *fit_data, int num_columns) {
+    int col, year, day;
+    float val;
+
+    for (col = 0; col < num_columns; col++) {
+        for (day = 0; day < NUM_DAYS; day++) {
+            val = 0;
+            for (year = 0; year < NUM_YEARS; year++)
+                val += ts_b[(size_t)col*NUM_TS + year*NUM_DAYS + day];
+            fit_data[(size_t)col*NUM_DAYS + day] = val / NUM_YEARS;
+        }
+    }
+    return;
+}
+
+/* Compute sigma0-dry and ms for one pixel */
+void process_pixel(float *ts_a, float *slope, float c0_dry, float c0_wet,
+        int arid, float *ms, float *dry) {
+    int t;
+    float sigma0_dry, sigma0_wet;
+
+    for (t = 0; t < NUM_TS; t++) {
+        sigma0_dry = c0_dry - slope[t % NUM_DAYS] * (THETA_DRY - THETA_REF);
+        sigma0_wet = c0_wet - slope[t % NUM_DAYS] * (THETA_WET - THETA_REF);
+
+        if (arid && sigma0_wet - sigma0_dry < 5)
+            sigma0_wet = sigma0_dry + 5;
+
+        dry[t] = sigma0_dry;
+        ms[t] = (ts_a[t] - sigma0_dry) / (sigma0_wet - sigma0_dry);
+    }
+    return;
+}
+
+/* Name of the SWI variable for characteristic time t_char */
+void swi_var_name(char *name, float t_char) {
+    if (t_char == SWI_T)
+        strcpy(name, "swi");
+    else
+        sprintf(name, "swi_t%02g", t_char);
+    return;
+}
+
+/* Write the results for one row, same layout as sm_gen_swi.m with one
+ * extra SWI variable for every other characteristic time */
+void write_row(char *region, int row, int num_columns, float **swi, float *t_char,
+        int num_t, float *ms, float *dry) {
+    char fname[100];
+    char var_name[NC_MAX_NAME];
+    int ncid, row_dimid, col_dimid, year_dimid, day_dimid;
+    int swi_varid[MAX_SWI_T], ms_varid, dry_varid;
+    int dimids[NDIMS];
+    int retval, k;
+
+    sprintf(fname,"/auto/temp/lindell/soilmoisture/swi/swi_%s_%04d.nc",region,row+1);
+    if ((retval = nc_create(fname, NC_NETCDF4|NC_CLOBBER, &ncid)))
+        ERR(retval);
+
+    /* Define the dimensions. */
+    if ((retval = nc_def_dim(ncid, "row", 1, &row_dimid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(ncid, "column", num_columns, &col_dimid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(ncid, "year", NUM_YEARS, &year_dimid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(ncid, "day", NUM_DAYS, &day_dimid)))
+        ERR(retval);
+
+    dimids[0] = row_dimid;
+    dimids[1] = col_dimid;
+    dimids[2] = year_dimid;
+    dimids[3] = day_dimid;
+
+    /* define the variables */
+    for (k = 0; k < num_t; k++) {
+        swi_var_name(var_name, t_char[k]);
+        if ((retval = nc_def_var(ncid, var_name, NC_FLOAT, NDIMS, dimids, &swi_varid[k])))
+            ERR(retval);
+    }
+    if ((retval = nc_def_var(ncid, "ms", NC_FLOAT, NDIMS, dimids, &ms_varid)))
+        ERR(retval);
+    if ((retval = nc_def_var(ncid, "dry", NC_FLOAT, NDIMS, dimids, &dry_varid)))
+        ERR(retval);
+
+    /* End define mode. */
+    if ((retval = nc_enddef(ncid)))
+        ERR(retval);
+
+    /* Write the data. */
+    for (k = 0; k < num_t; k++) {
+        if ((retval = nc_put_var_float(ncid, swi_varid[k], swi[k])))
+            ERR(retval);
+    }
+    if ((retval = nc_put_var_float(ncid, ms_varid, ms)))
+        ERR(retval);
+    if ((retval = nc_put_var_float(ncid, dry_varid, dry)))
+        ERR(retval);
+
+    /* Close the file. */
+    if ((retval = nc_close(ncid)))
+        ERR(retval);
+    return;
+}
+
+/* Read a whole sir image a row at a time, same row order as the ts files.
+ * Returns -1 if the file can't be opened. */
+int read_sir_image(char *fname, float *img, int num_rows, int num_columns) {
+    sir_head head;
+    int row;
+    FILE *sir = fopen(fname,"r");
+
+    if (!sir)
+        return -1;
+    sir_init_head(&head);
+    get_sir_head_file(sir, &head);
+    for (row = 1; row <= num_rows; row++) {
+        if (get_sir_data_block(sir, img + (size_t)(row-1)*num_columns, &head,
+                1, row, num_columns, row) < 0)
+            printf("ERROR READING SIR DATA BLOCK!\n");
+    }
+    fclose(sir);
+    return 0;
+}
+
+/* arid climate classes 4-7 get a minimum wet/dry separation */
+void load_arid(char *region, int grd, unsigned char *arid, int num_rows, int num_columns) {
+    char fname[150];
+    size_t i, img_len = (size_t)num_rows * num_columns;
+    float *climate = (float*)malloc(sizeof(float)*img_len);
+
+    sprintf(fname,"/home/lindell/research/soil_moisture/climate/%s.%s",region,grd ? "grd" : "sir");
+    if (!climate || read_sir_image(fname, climate, num_rows, num_columns)) {
+        fprintf(stderr,"*** could not read climate file %s\n",fname);
+        exit(-1);
+    }
+    for (i = 0; i < img_len; i++)
+        arid[i] = climate[i] >= 4 && climate[i] <= 7;
+    free(climate);
+    return;
+}
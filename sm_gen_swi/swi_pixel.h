@@ -0,0 +1,42 @@
+/*
+ * swi_pixel.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef SWI_PIXEL_H_
+#define SWI_PIXEL_H_
+
+#define NUM_YEARS 6
+#define NUM_DAYS 365
+#define NUM_TS (NUM_YEARS*NUM_DAYS)
+#define YEAR_START 2009
+
+/* Scipal Dissertation p. 49 */
+#define THETA_WET 40
+#define THETA_DRY 25
+#define THETA_REF 40
+
+/* scipal p. 75, this one is written to the "swi" variable */
+#define SWI_T 20
+
+/* minimum number of days with slope data needed for the seasonal fit */
+#define MIN_FIT_DAYS 15
+
+/* harmonics of the slope fit (fourier3) and of the smoothed curve (fourier2) */
+#define FIT_HARMONICS 3
+#define EVAL_HARMONICS 2
+
+float prctile(float *sorted, int n, float p);
+void clean_row(float *ts_a, float *ts_b, float *scratch, int num_columns);
+void yearly_mean(float *ts_b, float *fit_data, int num_columns);
+void process_pixel(float *ts_a, float *slope, float c0_dry, float c0_wet,
+        int arid, float *ms, float *dry);
+void swi_var_name(char *name, float t_char);
+void write_row(char *region, int row, int num_columns, float **swi, float *t_char,
+        int num_t, float *ms, float *dry);
+int read_sir_image(char *fname, float *img, int num_rows, int num_columns);
+void load_arid(char *region, int grd, unsigned char *arid, int num_rows, int num_columns);
+
+#endif /* SWI_PIXEL_H_ */
@@ -0,0 +1,118 @@
+/*
+ * swi_state.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Per-pixel state of the recursive SWI filter, saved at the end of a full
+ *  run so that new days can be added without reprocessing the whole series.
+ *  The file is the header followed by one swi_pixel_state record per pixel.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "swi_state.h"
+
+int swi_state_alloc(swi_state *state, int num_rows, int num_columns,
+        const float *t_char, int num_t) {
+    size_t i, num_px = (size_t)num_rows * num_columns;
+    int k;
+
+    if (num_t > SWI_STATE_MAX_T)
+        return -1;
+
+    memset(&state->head, 0, sizeof(state->head));
+    memcpy(state->head.magic, SWI_STATE_MAGIC, sizeof(state->head.magic));
+    state->head.num_rows = num_rows;
+    state->head.num_columns = num_columns;
+    state->head.num_t = num_t;
+    state->head.last_update = -1;
+    for (k = 0; k < num_t; k++)
+        state->head.t_char[k] = t_char[k];
+
+    state->pixels = (swi_pixel_state*)malloc(sizeof(swi_pixel_state)*num_px);
+    if (!state->pixels)
+        return -1;
+    for (i = 0; i < num_px; i++) {
+        memset(&state->pixels[i], 0, sizeof(swi_pixel_state));
+        state->pixels[i].last_day = -1;
+        for (k = 0; k < SWI_STATE_TERMS; k++)
+            state->pixels[i].coef[k] = NAN;
+    }
+    return 0;
+}
+
+void swi_state_free(swi_state *state) {
+    free(state->pixels);
+    state->pixels = NULL;
+    return;
+}
+
+int swi_state_read(swi_state *state, const char *fname) {
+    size_t num_px;
+    FILE *fid = fopen(fname, "rb");
+
+    if (!fid)
+        return -1;
+    if (fread(&state->head, sizeof(state->head), 1, fid) != 1 ||
+            memcmp(state->head.magic, SWI_STATE_MAGIC, sizeof(state->head.magic)) != 0 ||
+            state->head.num_t > SWI_STATE_MAX_T) {
+        fclose(fid);
+        return -1;
+    }
+
+    num_px = (size_t)state->head.num_rows * state->head.num_columns;
+    state->pixels = (swi_pixel_state*)malloc(sizeof(swi_pixel_state)*num_px);
+    if (!state->pixels || fread(state->pixels, sizeof(swi_pixel_state), num_px, fid) != num_px) {
+        free(state->pixels);
+        state->pixels = NULL;
+        fclose(fid);
+        return -1;
+    }
+    fclose(fid);
+    return 0;
+}
+
+/* Written to a temporary file first so an interrupted update never leaves
+ * a half written state behind */
+int swi_state_write(const swi_state *state, const char *fname) {
+    char tmp_fname[300];
+    size_t num_px = (size_t)state->head.num_rows * state->head.num_columns;
+    FILE *fid;
+
+    snprintf(tmp_fname, sizeof(tmp_fname), "%s.tmp", fname);
+    fid = fopen(tmp_fname, "wb");
+    if (!fid)
+        return -1;
+    if (fwrite(&state->head, sizeof(state->head), 1, fid) != 1 ||
+            fwrite(state->pixels, sizeof(swi_pixel_state), num_px, fid) != num_px) {
+        fclose(fid);
+        return -1;
+    }
+    if (fclose(fid))
+        return -1;
+    return rename(tmp_fname, fname);
+}
+
+/* Add an observation of ms on the given day to the filter of one pixel and
+ * store the new SWI for every characteristic time in swi */
+void swi_state_advance(swi_pixel_state *px, const float *t_char, int num_t,
+        int day, float ms, float *swi) {
+    double decay;
+    int k;
+
+    for (k = 0; k < num_t; k++) {
+        decay = px->last_day < 0 ? 0 : exp(-(day - px->last_day) / t_char[k]);
+        if (px->last_day < 0)
+            px->gain[k] = 1;
+        else
+            px->gain[k] = px->gain[k] / (px->gain[k] + decay);
+        px->swi[k] += px->gain[k] * (ms - px->swi[k]);
+        swi[k] = px->swi[k];
+    }
+    px->last_day = day;
+    return;
+}
@@ -0,0 +1,49 @@
+/*
+ * swi_state.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef SWI_STATE_H_
+#define SWI_STATE_H_
+
+#include <stdint.h>
+
+#define SWI_STATE_MAGIC "SWISTAT1"
+
+/* characteristic times and slope curve terms kept per pixel */
+#define SWI_STATE_MAX_T 8
+#define SWI_STATE_TERMS 5
+
+/* Everything needed to continue the SWI of one pixel */
+typedef struct {
+    int32_t last_day;               /* day of the last observation, -1 if none */
+    float coef[SWI_STATE_TERMS];    /* slope curve coefficients, NaN if not fit */
+    float gain[SWI_STATE_MAX_T];
+    float swi[SWI_STATE_MAX_T];
+} swi_pixel_state;
+
+typedef struct {
+    char magic[8];
+    int32_t num_rows;
+    int32_t num_columns;
+    int32_t num_t;
+    int32_t last_update;            /* last day the state was advanced to */
+    float t_char[SWI_STATE_MAX_T];
+} swi_state_header;
+
+typedef struct {
+    swi_state_header head;
+    swi_pixel_state *pixels;        /* [num_rows][num_columns] */
+} swi_state;
+
+int swi_state_alloc(swi_state *state, int num_rows, int num_columns,
+        const float *t_char, int num_t);
+void swi_state_free(swi_state *state);
+int swi_state_read(swi_state *state, const char *fname);
+int swi_state_write(const swi_state *state, const char *fname);
+void swi_state_advance(swi_pixel_state *px, const float *t_char, int num_t,
+        int day, float ms, float *swi);
+
+#endif /* SWI_STATE_H_ */
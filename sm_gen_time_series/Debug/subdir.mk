@@ -4,13 +4,16 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
-../gen_time_series.c 
+../gen_time_series.c \
+../ts_ingest.c 
 
 OBJS += \
-./gen_time_series.o 
+./gen_time_series.o \
+./ts_ingest.o 
 
 C_DEPS += \
-./gen_time_series.d 
+./gen_time_series.d \
+./ts_ingest.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -9,8 +9,6 @@
 #include <stdio.h>
 #include <argp.h>
 #include <string.h>
-#include <sir_ez.h>
-#include <sir3.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -19,12 +17,11 @@
 #include <fcntl.h>
 #include <errno.h>
 
-#include <pthread.h>
-
 #include <netcdf.h>
 
+#include "ts_ingest.h"
+
 /* This is the name of the data file we will read. */
-#define NUM_THREADS 24
 #define NDIMS 4
 #define YEAR_START 2009
 #define YEAR_END 2014
@@ -35,8 +32,6 @@
 #define ERR(e) {printf("Error: %s\n", nc_strerror(e)); return 2;}
 
 
-pthread_mutex_t fopen_lock;
-
 /* Program documentation. */
 static char doc[] =
   "gen_time_series.c-- Program to parse sir file pixels into time\
@@ -51,6 +46,7 @@ static char args_doc[] = "Region Image_Type";
 static struct argp_option options[] = {
   {"verbose",  'v', 0,      0,  "Produce verbose output" },
   {"grd",  'g', 0,      0,  "Parse grd files" },
+  {"rows",  'r', "START:END", 0,  "Only parse rows START to END (1-based) into a shard file" },
   { 0 }
 };
 
@@ -61,6 +57,8 @@ struct arguments
   char *type;
   int grd;
   int verbose;
+  int row_start;
+  int row_end;
 };
 
 /* Parse a single option. */
@@ -79,6 +77,11 @@ parse_opt (int key, char *arg, struct argp_state *state)
     case 'g':
       arguments->grd = 1;
       break;
+    case 'r':
+      if (sscanf(arg, "%d:%d", &arguments->row_start, &arguments->row_end) != 2 ||
+              arguments->row_start < 1 || arguments->row_end < arguments->row_start)
+          argp_failure(state, 1, 0, "ERROR, could not parse row range %s!", arg);
+      break;
     case ARGP_KEY_ARG:
       if (state->arg_num >= 2) {
         /* Too many arguments. */
@@ -129,22 +132,6 @@ parse_opt (int key, char *arg, struct argp_state *state)
 /* Our argp parser. */
 static struct argp argp = { options, parse_opt, args_doc, doc };
 
-/* Thread arg struct */
-typedef struct {
-    float ****tseries;
-	int start_i;
-	int stop_i;
-	int num_rows;
-	int num_columns;
-	char *region;
-	int grd;
-	char *type;
-	int NUM_DAYS;
-	pthread_mutex_t *fopen_lock;
-	pthread_mutex_t *store_lock;
-	float ****thread_buffer;
-} thread_args;
-
 /* Check to see if a directory exists */
 void checkdir(char* dirname) {
 // http://stackoverflow.com/questions/9314586/c-faster-way-to-check-if-a-directory-exists
@@ -169,184 +156,6 @@ void checkdir(char* dirname) {
 	return;
 }
 
-// Copy file utility
-// http://stackoverflow.com/questions/2180079/how-can-i-copy-a-file-on-unix-using-c
-int cp(const char *to, const char *from)
-{
-    int fd_to, fd_from;
-    char buf[4096];
-    ssize_t nread;
-    int saved_errno;
-
-    fd_from = open(from, O_RDONLY);
-    if (fd_from < 0)
-        return -1;
-
-    fd_to = open(to, O_WRONLY | O_CREAT | O_EXCL, 0666);
-    if (fd_to < 0)
-        goto out_error;
-
-    while (nread = read(fd_from, buf, sizeof buf), nread > 0)
-    {
-        char *out_ptr = buf;
-        ssize_t nwritten;
-
-        do {
-            nwritten = write(fd_to, out_ptr, nread);
-
-            if (nwritten >= 0)
-            {
-                nread -= nwritten;
-                out_ptr += nwritten;
-            }
-            else if (errno != EINTR)
-            {
-                goto out_error;
-            }
-        } while (nread > 0);
-    }
-
-    if (nread == 0)
-    {
-        if (close(fd_to) < 0)
-        {
-            fd_to = -1;
-            goto out_error;
-        }
-        close(fd_from);
-
-        /* Success! */
-        return 0;
-    }
-
-  out_error:
-    saved_errno = errno;
-
-    close(fd_from);
-    if (fd_to >= 0)
-        close(fd_to);
-
-    errno = saved_errno;
-    return -1;
-}
-
-void *mthreadParseImg(void *arg) {
-	thread_args *t_args = (thread_args*)arg;
-	float ****tseries = t_args->tseries;
-	int start_day = t_args->start_i;
-	int stop_day = t_args->stop_i;
-	int num_rows = t_args->num_rows;
-	int num_columns = t_args->num_columns;
-	int grd = t_args->grd;
-	char *region = t_args->region;
-	char *type = t_args->type;
-	pthread_mutex_t *fopen_lock = t_args->fopen_lock;
-	int row, column;
-	int year;
-	int day;
-	char ascat_path[100];
-	char ascat_internet_path[100];
-	char tmpdir[100];
-	char cmd[100];
-	float pix_val;
-	sir_head head;
-
-      for (year = YEAR_START; year <= YEAR_END; ++year) {
-          for (day = start_day; day <= stop_day; day+=2) {
-              setvbuf (stdout, NULL, _IONBF, 0);
-              printf("    Day: %03d of %04d\n", day, year);
-
-              if (strcmp("a",type) == 0) {
-                  if (!grd) { // here we do sir files
-                      sprintf(ascat_path,
-                      "/auto/temp/lindell/soilmoisture/msfa-%s-%s%02d-%03d-%03d.sir",
-                      type,region,year-2000,day,day+4);
-
-                      // check if sir file exists in temp dir
-                      if( access( ascat_path, F_OK ) == -1 ) {
-                          // not unzipped in temp dir, copy over unzipped version and use that
-                          // check if exists on internet
-                          sprintf(ascat_internet_path,
-                          "/auto/internet/ftp/data/ascat/%d/sir/msfa/%s/%03d/%s/msfa-%s-%s%02d-%03d-%03d.sir.gz",
-                          year,region,day,type,type,region,year-2000,day,day+4);
-                          if( access( ascat_internet_path, F_OK ) != -1 ) {
-                              sprintf(tmpdir,"%s.gz",ascat_path);
-                              cp(tmpdir,ascat_internet_path);
-                              sprintf(cmd, "gunzip %s.gz",ascat_path);
-                              system(cmd);
-                          } else { //then we don't have the file
-                              printf("Error reading file for day %03d, year %d\n",day,year);
-                              continue;
-                          }
-                      }
-                  }
-                  else { // grab the grd files
-                    sprintf(ascat_path,
-                        "/auto/temp/lindell/soilmoisture/grd/%04d/%03d-%03d-%04d/msfa-%s-%s%02d-%03d-%03d.grd",
-                        year,day,day+4,year,type,region,year-2000,day,day+4);
-                    if( access( ascat_path, F_OK ) == -1 ) { // we don't have custom grd files anywhere else
-                        printf("Error reading file for day %03d, year %d:\n%s",day,year,ascat_path);
-                        continue;
-                    }
-                  }
-              } else { // type is 'b'
-                  int day1 = day-14;
-                  int day2 = day+15;
-                  int year_tmp = year;
-                  if (day2 > 365) {
-                      day2 = (day2%366)+1;
-                  }
-                  // year boundary corrections
-                  if (day1 < 1) {
-                      day1 = day1+366;
-                      day2 = day+16;
-                      year_tmp = year-1;
-                  }
-                  if (!grd) {
-                      sprintf(ascat_path,
-                         "/auto/temp/lindell/soilmoisture/ave/%04d/%03d-%03d-%04d/msfa-%s-%s%02d-%03d-%03d.ave",
-                         year_tmp,day1,day2,year_tmp,type,region,year_tmp-2000,day1,day2);
-                  }
-                  else { // grab grd files
-                      sprintf(ascat_path,
-                           "/auto/temp/lindell/soilmoisture/grd/%04d/%03d-%03d-%04d/msfa-%s-%s%02d-%03d-%03d.grd",
-                            year_tmp,day1,day2,year_tmp,type,region,year_tmp-2000,day1,day2);
-                  }
-                  if( access( ascat_path, F_OK ) == -1 ) {
-                      printf("Error reading file %s for day %03d, year %d\n",ascat_path,day,year);
-                      continue;
-                  }
-              }
-              pthread_mutex_lock(fopen_lock);
-              FILE *sir = fopen(ascat_path,"r");
-              pthread_mutex_unlock(fopen_lock);
-
-              if (!sir) {
-                  printf("SIR FILE ERROR day %03d, year %d\n",day,year);
-                  continue;
-              }
-
-              sir_init_head(&head);
-              get_sir_head_file(sir, &head);
-
-              for (row = 1; row <= num_rows; row++) {
-                    for (column = 1; column <= num_columns; column++) {
-                      // retrieve pixel
-                      if (get_sir_data_block(sir, &pix_val, &head, column, row, column, row) < 0)
-                          printf("ERROR READING SIR DATA BLOCK!\n");
-
-                      // store pixel in buffer
-                      tseries[row-1][column-1][year-YEAR_START][day-1] = pix_val;
-                  }
-              }
-
-              // close file
-              fclose(sir);
-          }
-	}
-	return NULL;
-}
-
 int main (int argc, char **argv)
 {
     struct arguments arguments;
@@ -356,12 +165,6 @@ int main (int argc, char **argv)
     int num_columns;
     int num_rows;
 
-    // multithreading params
-    thread_args t_args[NUM_THREADS];
-    pthread_t thread_id[NUM_THREADS];
-    int ind_per_thread;
-    int start_index;
-    int stop_index;
     int i,j,k;
 
     // Initialize NETCDF Variables
@@ -376,6 +179,8 @@ int main (int argc, char **argv)
     arguments.grd = 0;
     arguments.region = NULL;
     arguments.type = NULL;
+    arguments.row_start = 0;
+    arguments.row_end = 0;
 
     /* Parse our arguments; every option seen by parse_opt will
      be reflected in arguments. */
@@ -440,6 +245,21 @@ int main (int argc, char **argv)
               exit(-1);
         }
     }
+
+    // only parse a shard of the rows if asked
+    int total_rows = num_rows;
+    int row_start = 1;
+    if (arguments.row_start) {
+        if (arguments.row_end > total_rows) {
+            printf("ERROR, row range %d:%d outside of image with %d rows!\n",
+                    arguments.row_start, arguments.row_end, total_rows);
+            exit(-1);
+        }
+        row_start = arguments.row_start;
+        num_rows = arguments.row_end - arguments.row_start + 1;
+        printf("Parsing rows %04d-%04d\n", arguments.row_start, arguments.row_end);
+    }
+
     // Allocate memory for 4D image timeseries array
     setvbuf (stdout, NULL, _IONBF, 0);
     printf("Allocating Memory...");
@@ -463,50 +283,28 @@ int main (int argc, char **argv)
     printf("Done\n");
 
     // sort through pixels/images
-    // split up row processing based on number of threads/rows
-    ind_per_thread = 364 / NUM_THREADS;
-
-    if ((ind_per_thread % 2) == 0) {
-        ind_per_thread--;
-    }
-
-    start_index = 1;
-    stop_index = 0;
-    for (i = 0; i < NUM_THREADS; i++) {
-        if (i == NUM_THREADS - 1) {
-            stop_index = 364;
-        } else {
-            stop_index = start_index + ind_per_thread;
-        }
-        t_args[i].tseries = tseries;
-        t_args[i].start_i = start_index;
-        t_args[i].stop_i = stop_index;
-        t_args[i].num_rows = num_rows;
-        t_args[i].num_columns = num_columns;
-        t_args[i].region = region;
-        t_args[i].grd = grd;
-        t_args[i].type = type;
-        t_args[i].NUM_DAYS = NUM_DAYS;
-        t_args[i].fopen_lock = &fopen_lock;
-        start_index = stop_index + 1;
-    }
-
-    // submit threads
-    for (i = 0; i < NUM_THREADS; i++) {
-        pthread_create(&thread_id[i], NULL, mthreadParseImg, &t_args[i]);
-    }
-
-    // join threads
-    for (i = 0; i < NUM_THREADS; i++) {
-        pthread_join(thread_id[i], NULL);
-    }
+    ingest_time_series(&tseries[0][0][0][0], region, type, grd, row_start, num_rows, num_columns);
 
     printf("Saving NetCDF File...");
     /* Create the file. */
-    sprintf(FILE_NAME,"/auto/temp/lindell/soilmoisture/ts/ts_%s_%s.nc",region,type);
+    if (arguments.row_start)
+        sprintf(FILE_NAME,"/auto/temp/lindell/soilmoisture/ts/ts_%s_%s.r%04d-%04d.nc",
+                region,type,arguments.row_start,arguments.row_end);
+    else
+        sprintf(FILE_NAME,"/auto/temp/lindell/soilmoisture/ts/ts_%s_%s.nc",region,type);
     if ((retval = nc_create(FILE_NAME, NC_NETCDF4, &ncid)))
         ERR(retval);
 
+    /* shard files record where they go, for sm_merge_shards */
+    if (arguments.row_start) {
+        if ((retval = nc_put_att_int(ncid, NC_GLOBAL, "shard_row_start", NC_INT, 1, &arguments.row_start)))
+            ERR(retval);
+        if ((retval = nc_put_att_int(ncid, NC_GLOBAL, "shard_row_end", NC_INT, 1, &arguments.row_end)))
+            ERR(retval);
+        if ((retval = nc_put_att_int(ncid, NC_GLOBAL, "shard_total_rows", NC_INT, 1, &total_rows)))
+            ERR(retval);
+    }
+
     /* Define the dimensions. */
     if ((retval = nc_def_dim(ncid, "row", num_rows, &row_dimid)))
         ERR(retval);
@@ -0,0 +1,279 @@
+/*
+ * ts_ingest.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Parsing of the sir images into a time series cube, split out of
+ *  gen_time_series.c so that sm_pipeline can fill its cube in memory.
+ *  The cube is [row][column][year][day] like the ts files.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sir_ez.h>
+#include <sir3.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <errno.h>
+
+#include <pthread.h>
+
+#include "ts_ingest.h"
+
+#define NUM_THREADS 24
+#define YEAR_START 2009
+#define YEAR_END 2014
+#define NUM_YEARS 6
+
+static pthread_mutex_t fopen_lock;
+
+/* Thread arg struct */
+typedef struct {
+	float *tseries;
+	int start_i;
+	int stop_i;
+	int num_rows;
+	int row_start;
+	int num_columns;
+	char *region;
+	int grd;
+	char *type;
+	pthread_mutex_t *fopen_lock;
+} thread_args;
+
+// Copy file utility
+// http://stackoverflow.com/questions/2180079/how-can-i-copy-a-file-on-unix-using-c
+int cp(const char *to, const char *from)
+{
+    int fd_to, fd_from;
+    char buf[4096];
+    ssize_t nread;
+    int saved_errno;
+
+    fd_from = open(from, O_RDONLY);
+    if (fd_from < 0)
+        return -1;
+
+    fd_to = open(to, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd_to < 0)
+        goto out_error;
+
+    while (nread = read(fd_from, buf, sizeof buf), nread > 0)
+    {
+        char *out_ptr = buf;
+        ssize_t nwritten;
+
+        do {
+            nwritten = write(fd_to, out_ptr, nread);
+
+            if (nwritten >= 0)
+            {
+                nread -= nwritten;
+                out_ptr += nwritten;
+            }
+            else if (errno != EINTR)
+            {
+                goto out_error;
+            }
+        } while (nread > 0);
+    }
+
+    if (nread == 0)
+    {
+        if (close(fd_to) < 0)
+        {
+            fd_to = -1;
+            goto out_error;
+        }
+        close(fd_from);
+
+        /* Success! */
+        return 0;
+    }
+
+  out_error:
+    saved_errno = errno;
+
+    close(fd_from);
+    if (fd_to >= 0)
+        close(fd_to);
+
+    errno = saved_errno;
+    return -1;
+}
+
+void *mthreadParseImg(void *arg) {
+	thread_args *t_args = (thread_args*)arg;
+	float *tseries = t_args->tseries;
+	int start_day = t_args->start_i;
+	int stop_day = t_args->stop_i;
+	int num_rows = t_args->num_rows;
+	int row_start = t_args->row_start;
+	int num_columns = t_args->num_columns;
+	int grd = t_args->grd;
+	char *region = t_args->region;
+	char *type = t_args->type;
+	pthread_mutex_t *fopen_lock = t_args->fopen_lock;
+	int row, column;
+	int year;
+	int day;
+	char ascat_path[100];
+	char ascat_internet_path[100];
+	char tmpdir[100];
+	char cmd[100];
+	float pix_val;
+	sir_head head;
+
+      for (year = YEAR_START; year <= YEAR_END; ++year) {
+          for (day = start_day; day <= stop_day; day+=2) {
+              setvbuf (stdout, NULL, _IONBF, 0);
+              printf("    Day: %03d of %04d\n", day, year);
+
+              if (strcmp("a",type) == 0) {
+                  if (!grd) { // here we do sir files
+                      sprintf(ascat_path,
+                      "/auto/temp/lindell/soilmoisture/msfa-%s-%s%02d-%03d-%03d.sir",
+                      type,region,year-2000,day,day+4);
+
+                      // check if sir file exists in temp dir
+                      if( access( ascat_path, F_OK ) == -1 ) {
+                          // not unzipped in temp dir, copy over unzipped version and use that
+                          // check if exists on internet
+                          sprintf(ascat_internet_path,
+                          "/auto/internet/ftp/data/ascat/%d/sir/msfa/%s/%03d/%s/msfa-%s-%s%02d-%03d-%03d.sir.gz",
+                          year,region,day,type,type,region,year-2000,day,day+4);
+                          if( access( ascat_internet_path, F_OK ) != -1 ) {
+                              sprintf(tmpdir,"%s.gz",ascat_path);
+                              cp(tmpdir,ascat_internet_path);
+                              sprintf(cmd, "gunzip %s.gz",ascat_path);
+                              system(cmd);
+                          } else { //then we don't have the file
+                              printf("Error reading file for day %03d, year %d\n",day,year);
+                              continue;
+                          }
+                      }
+                  }
+                  else { // grab the grd files
+                    sprintf(ascat_path,
+                        "/auto/temp/lindell/soilmoisture/grd/%04d/%03d-%03d-%04d/msfa-%s-%s%02d-%03d-%03d.grd",
+                        year,day,day+4,year,type,region,year-2000,day,day+4);
+                    if( access( ascat_path, F_OK ) == -1 ) { // we don't have custom grd files anywhere else
+                        printf("Error reading file for day %03d, year %d:\n%s",day,year,ascat_path);
+                        continue;
+                    }
+                  }
+              } else { // type is 'b'
+                  int day1 = day-14;
+                  int day2 = day+15;
+                  int year_tmp = year;
+                  if (day2 > 365) {
+                      day2 = (day2%366)+1;
+                  }
+                  // year boundary corrections
+                  if (day1 < 1) {
+                      day1 = day1+366;
+                      day2 = day+16;
+                      year_tmp = year-1;
+                  }
+                  if (!grd) {
+                      sprintf(ascat_path,
+                         "/auto/temp/lindell/soilmoisture/ave/%04d/%03d-%03d-%04d/msfa-%s-%s%02d-%03d-%03d.ave",
+                         year_tmp,day1,day2,year_tmp,type,region,year_tmp-2000,day1,day2);
+                  }
+                  else { // grab grd files
+                      sprintf(ascat_path,
+                           "/auto/temp/lindell/soilmoisture/grd/%04d/%03d-%03d-%04d/msfa-%s-%s%02d-%03d-%03d.grd",
+                            year_tmp,day1,day2,year_tmp,type,region,year_tmp-2000,day1,day2);
+                  }
+                  if( access( ascat_path, F_OK ) == -1 ) {
+                      printf("Error reading file %s for day %03d, year %d\n",ascat_path,day,year);
+                      continue;
+                  }
+              }
+              pthread_mutex_lock(fopen_lock);
+              FILE *sir = fopen(ascat_path,"r");
+              pthread_mutex_unlock(fopen_lock);
+
+              if (!sir) {
+                  printf("SIR FILE ERROR day %03d, year %d\n",day,year);
+                  continue;
+              }
+
+              sir_init_head(&head);
+              get_sir_head_file(sir, &head);
+
+              for (row = row_start; row < row_start + num_rows; row++) {
+                    for (column = 1; column <= num_columns; column++) {
+                      // retrieve pixel
+                      if (get_sir_data_block(sir, &pix_val, &head, column, row, column, row) < 0)
+                          printf("ERROR READING SIR DATA BLOCK!\n");
+
+                      // store pixel in buffer
+                      tseries[((size_t)(row-row_start)*num_columns + column-1)*NUM_YEARS*365 +
+                              (year-YEAR_START)*365 + day-1] = pix_val;
+                  }
+              }
+
+              // close file
+              fclose(sir);
+          }
+	}
+	return NULL;
+}
+
+/* Fill rows row_start..row_start+num_rows-1 (1-based) of the time series
+ * cube for image type a or b, the days are split between the threads */
+void ingest_time_series(float *tseries, char *region, char *type, int grd,
+        int row_start, int num_rows, int num_columns) {
+    thread_args t_args[NUM_THREADS];
+    pthread_t thread_id[NUM_THREADS];
+    int ind_per_thread;
+    int start_index;
+    int stop_index;
+    int i;
+
+    // split up row processing based on number of threads/rows
+    ind_per_thread = 364 / NUM_THREADS;
+
+    if ((ind_per_thread % 2) == 0) {
+        ind_per_thread--;
+    }
+
+    start_index = 1;
+    stop_index = 0;
+    for (i = 0; i < NUM_THREADS; i++) {
+        if (i == NUM_THREADS - 1) {
+            stop_index = 364;
+        } else {
+            stop_index = start_index + ind_per_thread;
+        }
+        t_args[i].tseries = tseries;
+        t_args[i].start_i = start_index;
+        t_args[i].stop_i = stop_index;
+        t_args[i].num_rows = num_rows;
+        t_args[i].row_start = row_start;
+        t_args[i].num_columns = num_columns;
+        t_args[i].region = region;
+        t_args[i].grd = grd;
+        t_args[i].type = type;
+        t_args[i].fopen_lock = &fopen_lock;
+        start_index = stop_index + 1;
+    }
+
+    // submit threads
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&thread_id[i], NULL, mthreadParseImg, &t_args[i]);
+    }
+
+    // join threads
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_join(thread_id[i], NULL);
+    }
+    return;
+}
@@ -0,0 +1,14 @@
+/*
+ * ts_ingest.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef TS_INGEST_H_
+#define TS_INGEST_H_
+
+void ingest_time_series(float *tseries, char *region, char *type, int grd,
+        int row_start, int num_rows, int num_columns);
+
+#endif /* TS_INGEST_H_ */
@@ -4,5 +4,5 @@
 
 USER_OBJS :=
 
-LIBS := -lm -lsir -lnetcdf
+LIBS := -lm -lsir -lnetcdf -lz
 
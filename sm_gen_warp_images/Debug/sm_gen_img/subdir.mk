@@ -0,0 +1,30 @@
+################################################################################
+# Automatically-generated file. Do not edit!
+################################################################################
+
+# Add inputs and outputs from these tool invocations to the build variables 
+C_SRCS += \
+../../sm_gen_img/day_writer.c \
+../../sm_gen_img/reader_pool.c \
+../../sm_gen_img/zarr_store.c 
+
+OBJS += \
+./sm_gen_img/day_writer.o \
+./sm_gen_img/reader_pool.o \
+./sm_gen_img/zarr_store.o 
+
+C_DEPS += \
+./sm_gen_img/day_writer.d \
+./sm_gen_img/reader_pool.d \
+./sm_gen_img/zarr_store.d 
+
+
+# Each subdirectory must supply rules for building sources it contributes
+sm_gen_img/%.o: ../../sm_gen_img/%.c
+	@echo 'Building file: $<'
+	@echo 'Invoking: GCC C Compiler'
+	gcc -I/home/lindell/local/include/sir -O1 -g3 -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$(@:%.o=%.d)" -o "$@" "$<"
+	@echo 'Finished building: $<'
+	@echo ' '
+
+
@@ -13,5 +13,6 @@ EXECUTABLES :=
 
 # Every subdirectory with source files must be described here
 SUBDIRS := \
+sm_gen_img \
 . \
 
@@ -4,13 +4,22 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
-../gen_warp_images.c 
+../gen_warp_images.c \
+../warp_pix.c \
+../warp_index.c \
+../warp_fp.c 
 
 OBJS += \
-./gen_warp_images.o 
+./gen_warp_images.o \
+./warp_pix.o \
+./warp_index.o \
+./warp_fp.o 
 
 C_DEPS += \
-./gen_warp_images.d 
+./gen_warp_images.d \
+./warp_pix.d \
+./warp_index.d \
+./warp_fp.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -0,0 +1,74 @@
+/*
+ * check_warp_time.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Checks warp_time_to_day against the gmtime_r conversion it replaced:
+ *  every second of 2007-2030 as a WARP time (days since 1900-01-01 as a
+ *  double), and times a few nanodays either side of every midnight, go
+ *  through both and must give the same year and day of year. Build and run
+ *  it with "make check_warp_time" in Debug. Exits 1 if any time differs.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "warp_time.h"
+
+/* 2007-01-01 and 2031-01-01 in seconds since 1970 */
+#define CHECK_START 1167609600LL
+#define CHECK_STOP 1924992000LL
+
+/* WARP time of 1970-01-01 */
+#define EPOCH_DAYS 25567
+
+/* The year and day the old code got, through gmtime_r */
+static void gmtime_day(double time, int *year, int *yday) {
+    double cur_time = time * 86400 - 2208988800;
+    time_t cur_time_conv = (time_t)cur_time;
+    struct tm tm;
+
+    gmtime_r(&cur_time_conv, &tm);
+    *year = tm.tm_year + 1900;
+    *yday = tm.tm_yday;
+    return;
+}
+
+static long long num_bad = 0;
+
+static void check(double time) {
+    int year, yday, gm_year, gm_yday;
+
+    warp_time_to_day(time, &year, &yday);
+    gmtime_day(time, &gm_year, &gm_yday);
+    if (year != gm_year || yday != gm_yday) {
+        if (num_bad < 10)
+            printf("time %.9f: %04d %03d, gmtime_r %04d %03d\n", time, year, yday,
+                    gm_year, gm_yday);
+        num_bad++;
+    }
+    return;
+}
+
+int main(void) {
+    long long secs, day, num_checked = 0;
+    int k;
+
+    printf("Checking every second of 2007-2030...\n");
+    for (secs = CHECK_START; secs < CHECK_STOP; secs++) {
+        check((secs + 2208988800.0) / 86400.0);
+        num_checked++;
+    }
+
+    printf("Checking the times around midnight...\n");
+    for (day = CHECK_START/86400 + EPOCH_DAYS; day < CHECK_STOP/86400 + EPOCH_DAYS; day++) {
+        for (k = -50; k <= 50; k++) {
+            check(day + k * 1e-9);
+            num_checked++;
+        }
+    }
+
+    printf("%lld times checked, %lld differ\n", num_checked, num_bad);
+    return num_bad != 0;
+}
@@ -23,16 +23,63 @@
 #include <errno.h>
 
 #include <pthread.h>
+#include <sys/mman.h>
 
 #include <netcdf.h>
 
+#include "../sm_gen_img/day_writer.h"
+#include "../sm_gen_img/reader_pool.h"
+#include "../sm_gen_img/zarr_store.h"
+#include "warp_pix.h"
+#include "warp_index.h"
+#include "warp_fp.h"
+#include "warp_time.h"
+
 /* This is the name of the data file we will read. */
 #define NUM_THREADS 24
 #define NDIMS 2
 #define YEAR_START 2007
 #define YEAR_END 2014
 #define NUM_YEARS 8
-#define NUM_DAYS 183
+
+/* the observations are added up in a bin per day of the year (0 based),
+ * which become prefix sums of the year with the empty sum before Jan 1
+ * first */
+#define NUM_BINS 366
+#define YEAR_SUMS (NUM_BINS+1)
+
+/* the composite image of a day D is the mean of the LEN days from D on,
+ * for every STEP days of the year from Jan 1. The standard images are 5
+ * days every other day, and keep the days after D as they always had. */
+#define DEFAULT_WINDOW_LEN 5
+#define DEFAULT_WINDOW_STEP 2
+#define MAX_WINDOWS 4
+
+/* regions made in one pass over the WARP files */
+#define MAX_REGIONS 12
+
+/* writer processes, and days waiting for them per writer */
+#define DEFAULT_WRITERS 8
+#define SLOTS_PER_WRITER 2
+
+/* reader processes, and files read or being put into the images per reader */
+#define DEFAULT_READERS 8
+#define SLOTS_PER_READER 2
+
+/* room for one WARP cell file in a reader slot, the odd bigger file is
+ * read by its thread instead */
+#define READ_SLOT_LEN (128*1024*1024)
+
+/* pixels without measurements, saved as the _FillValue of sm */
+#define NODATA -1
+
+/* most of an image has no measurements, so a fast deflate level with the
+ * byte shuffle shrinks the files a lot without slowing the writes */
+#define DEFAULT_DEFLATE 1
+
+/* Chunks of the Zarr stores, one day x 128 rows x 512 columns */
+#define ZARR_CHUNK_ROWS 128
+#define ZARR_CHUNK_COLS 512
 
 /* Handle errors by printing an error message and exiting with a
  * non-zero status. */
@@ -43,22 +90,72 @@ pthread_mutex_t fopen_lock;
 
 /* Program documentation. */
 static char doc[] =
-  "gen_warp_images.c-- Program to generate images from the warp files.";
+  "gen_warp_images.c-- Program to generate images from the warp files."
+  " The images of several regions (or all) are made in one pass over the files.";
 
 /* A description of the arguments we accept. */
-static char args_doc[] = "Region";
+static char args_doc[] = "Region [Region...] | all";
+
+/* The regions and the size of their images */
+typedef struct {
+    const char *name;
+    int num_columns;
+    int num_rows;
+} region_size;
+
+static const region_size region_sizes[] = {
+    {"Ama", 1128, 744},
+    {"Ber", 1350, 750},
+    {"CAm", 1440, 700},
+    {"ChJ", 1980, 950},
+    {"Eur", 1530, 1040},
+    {"Ind", 1800, 680},
+    {"NAf", 2120, 1130},
+    {"NAm", 1890, 1150},
+    {"SAf", 1220, 1260},
+    {"SAm", 1310, 1850},
+    {"SAs", 1760, 720},
+};
+#define NUM_REGION_SIZES (int)(sizeof(region_sizes)/sizeof(region_sizes[0]))
+
+static const region_size *find_region(const char *name) {
+    int i;
+
+    for (i = 0; i < NUM_REGION_SIZES; i++) {
+        if (strcmp(region_sizes[i].name, name) == 0)
+            return &region_sizes[i];
+    }
+    return NULL;
+}
 
 /* The options we understand. */
 static struct argp_option options[] = {
   {"verbose",  'v', 0,      0,  "Produce verbose output" },
+  {"writers",  'w', "N",    0,  "Processes writing the daily files (default 8, 0 to write them in this one)" },
+  {"deflate",  'z', "LEVEL", 0,  "Deflate level of the images, 0 to 9 (default 1, 0 for no compression)" },
+  {"zarr",  'Z', 0,      0,  "Write one Zarr store per year (<region>_<year>.zarr) instead of NetCDF files" },
+  {"readers",  'R', "N",    0,  "Processes reading the WARP files (default 8, 0 to read them in the threads one at a time)" },
+  {"memory",  'm', "GB",   0,  "Make the images a block of years at a time to stay under GB of memory" },
+  {"window",  'W', "LEN[:STEP]", 0,  "Composite LEN days after every STEP'th day (default 5:2, STEP 2 if left out), up to 4 windows" },
+  {"footprint",  'F', "SIGMA", 0,  "Spread each grid point over the pixels around it with Gaussian weights, SIGMA in pixels (default 0, each point only in its own pixel)" },
   { 0 }
 };
 
 /* Used by main to communicate with parse_opt. */
 struct arguments
 {
-  char *region;                /* Region */
+  char *regions[MAX_REGIONS];  /* Regions */
+  int num_regions;
   int verbose;
+  int writers;
+  int deflate;
+  int zarr;
+  int readers;
+  double memory;               /* GB, 0 for all years at once */
+  float footprint;             /* sigma in pixels, 0 for one pixel per point */
+  int window_len[MAX_WINDOWS]; /* composite windows */
+  int window_step[MAX_WINDOWS];
+  int num_windows;
 };
 
 /* Parse a single option. */
@@ -74,39 +171,79 @@ parse_opt (int key, char *arg, struct argp_state *state)
     case 'v':
       arguments->verbose = 1;
       break;
+    case 'w':
+      arguments->writers = atoi(arg);
+      if (arguments->writers < 0 || arguments->writers > MAX_WRITERS)
+          argp_failure(state, 1, 0, "ERROR, number of writers must be 0 to %d!", MAX_WRITERS);
+      break;
+    case 'Z':
+      arguments->zarr = 1;
+      break;
+    case 'R':
+      arguments->readers = atoi(arg);
+      if (arguments->readers < 0 || arguments->readers > MAX_READERS)
+          argp_failure(state, 1, 0, "ERROR, number of readers must be 0 to %d!", MAX_READERS);
+      break;
+    case 'm':
+      arguments->memory = atof(arg);
+      if (arguments->memory <= 0)
+          argp_failure(state, 1, 0, "ERROR, memory budget must be positive!");
+      break;
+    case 'W': {
+      int len, step = DEFAULT_WINDOW_STEP, k;
+      if (sscanf(arg, "%d:%d", &len, &step) < 1 || len < 1 || len > NUM_BINS ||
+          step < 1 || step > NUM_BINS)
+          argp_failure(state, 1, 0, "ERROR, window must be LEN[:STEP] with 1 to %d days!", NUM_BINS);
+      if (arguments->num_windows >= MAX_WINDOWS)
+          argp_failure(state, 1, 0, "ERROR, at most %d windows!", MAX_WINDOWS);
+      for (k = 0; k < arguments->num_windows; k++) {
+        if (arguments->window_len[k] == len && arguments->window_step[k] == step)
+          argp_failure(state, 1, 0, "ERROR, window %d:%d given twice!", len, step);
+      }
+      arguments->window_len[arguments->num_windows] = len;
+      arguments->window_step[arguments->num_windows++] = step;
+      break;
+    }
+    case 'F':
+      arguments->footprint = atof(arg);
+      if (arguments->footprint < 0)
+          argp_failure(state, 1, 0, "ERROR, footprint must be positive!");
+      break;
+    case 'z':
+      arguments->deflate = atoi(arg);
+      if (arguments->deflate < 0 || arguments->deflate > 9)
+          argp_failure(state, 1, 0, "ERROR, deflate level must be 0 to 9!");
+      break;
     case ARGP_KEY_ARG:
-      if (state->arg_num >= 1) {
+      if (strcmp(arg, "all") == 0) {
+        int k;
+        if (arguments->num_regions > 0)
+          argp_failure(state, 1, 0, "ERROR, all can't be given with other regions!");
+        for (k = 0; k < NUM_REGION_SIZES; k++)
+          arguments->regions[arguments->num_regions++] = (char*)region_sizes[k].name;
+      }
+      else if (find_region(arg) == NULL) {
+    	  argp_failure(state, 1, 0, "ERROR, inputted region %s not defined!", arg);
+      }
+      else if (arguments->num_regions >= MAX_REGIONS) {
         /* Too many arguments. */
         argp_usage (state);
       }
-      else if (arguments->region == NULL) {
-    	  arguments->region = arg;
+      else {
+        int k;
+        for (k = 0; k < arguments->num_regions; k++) {
+          if (strcmp(arguments->regions[k], arg) == 0)
+            argp_failure(state, 1, 0, "ERROR, region %s given twice!", arg);
+        }
+    	  arguments->regions[arguments->num_regions++] = arg;
       }
       break;
 
     case ARGP_KEY_END:
-      if (state->arg_num < 1) {
+      if (arguments->num_regions < 1) {
         /* Not enough arguments. */
         argp_usage (state);
       }
-      else if (arguments->region == NULL) {
-    	  argp_failure(state, 1, 0, "ERROR, region not defined!");
-      }
-      else if (
-	  strcmp(arguments->region,"Ama") != 0 &&
-	  strcmp(arguments->region,"Aus") != 0 &&
-	  strcmp(arguments->region,"Ber") != 0 &&
-	  strcmp(arguments->region,"CAm") != 0 &&
-	  strcmp(arguments->region,"ChJ") != 0 &&
-	  strcmp(arguments->region,"Eur") != 0 &&
-	  strcmp(arguments->region,"Ind") != 0 &&
-	  strcmp(arguments->region,"NAf") != 0 &&
-	  strcmp(arguments->region,"NAm") != 0 &&
-	  strcmp(arguments->region,"SAf") != 0 &&
-	  strcmp(arguments->region,"SAm") != 0 &&
-	  strcmp(arguments->region,"SAs") != 0) {
-    	  argp_failure(state, 1, 0, "ERROR, inputted region not defined!");
-      }
       break;
 
     default:
@@ -118,20 +255,298 @@ parse_opt (int key, char *arg, struct argp_state *state)
 /* Our argp parser. */
 static struct argp argp = { options, parse_opt, args_doc, doc };
 
+/* time index of a daily bin in the sums, [year][bin + 1] */
+#define NUM_TIMES (NUM_YEARS*YEAR_SUMS)
+
+/* A composite window and the images it makes in a year */
+typedef struct {
+    int len;
+    int step;
+    int offset;         /* days from the day of an image to its window, 1 for the standard one */
+    int num_days;       /* most images in a year, days 1, 1+step, ... */
+} warp_window;
+
+/* Images of a window in a year, one for every STEP days of the year. The
+ * standard window always had 183, the last one with only Dec 31 of a leap
+ * year. */
+static int window_days(const warp_window *window, int year) {
+    int year_len = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0) ? 366 : 365;
+
+    if (window->offset)
+        return window->num_days;
+    return (year_len + window->step - 1) / window->step;
+}
+
+/* One region the images are made for */
+typedef struct {
+    char *name;
+    int num_rows;
+    int num_columns;
+    sir_head head;
+    warp_pix_table pix_table;
+    char pix_fname[100];
+    // footprint weights, for -F
+    int footprint;
+    warp_fp_matrix fp;
+    char fp_fname[100];
+    int fp_ready;               /* fp is made, read or built after the first pass */
+    uint8_t *fp_near;           /* [WARP_MAX_GPI], grid points with a weight, in shared memory */
+    warp_fp_point *fp_points;   /* the grid points near the image found by the threads */
+    size_t num_fp_points;
+    size_t max_fp_points;
+    pthread_mutex_t fp_lock;
+} warp_region;
+
+/* Sum and count of the observations of one WARP location in the regions,
+ * for every day of the years being made. Every location is in a single
+ * file, so only the thread that read the file touches it, and a location
+ * in several regions is only added up once. sm is int8, so the sums are
+ * kept as integers and the mean is only taken in the merge; a location
+ * has at most a few observations on a day. After the pass the daily bins
+ * of each year are turned into prefix sums, so the sum over any window is
+ * the difference of two of them; a year of observations still fits the
+ * counts. */
+typedef struct {
+    int gpi;
+    int file_i;
+    int loc_i;
+    int pix[MAX_REGIONS];   /* image pixel in each region, -1 outside it */
+    int32_t sum[];          /* [num_times], followed by uint16_t count[num_times] */
+} loc_acc;
+
+static inline uint16_t *loc_count(loc_acc *acc, int num_times) {
+    return (uint16_t*)(acc->sum + num_times);
+}
+
 /* Thread arg struct */
 typedef struct {
-    float ****storage;
-    float ****count;
-	int start_i;
-	int stop_i;
-	int num_rows;
-	int num_columns;
-	char *region;
+	loc_acc **locs;         /* the locations this thread read */
+	size_t num_locs;
+	size_t max_locs;
+	int *queue;             /* the files to read, list indices */
+	int queue_len;
+	int *next_i;            /* next file of the queue to take */
+	pthread_mutex_t *queue_lock;
+	warp_bbox *boxes;
+	int *index_dirty;
+	int year0;              /* the block of years added up in this pass */
+	int num_years;
 	char **warp_list;
-	sir_head *head;
+	warp_region *regions;
+	int num_regions;
+	int fp_build;           /* some footprint weights are built after this pass */
+	reader_pool *readers;
 	pthread_mutex_t *fopen_lock;
 } thread_args;
 
+/* What the readers need to read a WARP file */
+typedef struct {
+    char **warp_list;
+    warp_region *regions;
+    int num_regions;
+} reader_ctx;
+
+/* The read a thread asks for */
+typedef struct {
+    int file_i;
+    int need_latlon;    /* the file isn't in the index yet, or fp_build */
+    int fp_build;       /* find the grid points near the images for the footprint weights */
+} warp_request;
+
+/* A WARP cell file read into a reader slot. The header is followed by
+ * lon, lat, row_size, location_id and whether it is in any of the images
+ * for every location, its image pixel in each region, and then time and
+ * sm of the observations of the locations in the images, one location
+ * after the other. */
+typedef struct {
+    int num_regions;
+    size_t loc_len;
+    size_t obs_len;     /* observations read */
+    size_t obs_room;    /* room for time and sm, a little more while reading */
+    size_t needed;      /* bytes needed for the file */
+    int has_latlon;     /* lon and lat were read, for points not in the table or the index */
+} warp_data;
+
+/* read_warp_file status when the file doesn't fit in the buffer */
+#define WARP_TOO_BIG 1
+
+/* observations of locations outside the image that are read anyway to
+ * join the ranges on either side into one read */
+#define WARP_OBS_GAP 4096
+
+/* bytes of the per location arrays */
+static size_t warp_loc_len(size_t loc_len, int num_regions) {
+    return (2*sizeof(double) + sizeof(long long) + (2 + num_regions)*sizeof(int))*loc_len;
+}
+
+static size_t warp_data_len(size_t loc_len, int num_regions, size_t obs_room) {
+    return sizeof(warp_data) + warp_loc_len(loc_len, num_regions) +
+            (sizeof(double) + sizeof(int8_t))*obs_room;
+}
+
+/* pix[r*loc_len + i] is the pixel of location i in region r, keep[i] is
+ * -1 for locations outside all of the images */
+static void warp_arrays(warp_data *d, double **lon, double **lat, long long **rsize,
+        int **gpi, int **keep, int **pix, double **time, int8_t **sm) {
+    *lon = (double*)(d + 1);
+    *lat = *lon + d->loc_len;
+    *rsize = (long long*)(*lat + d->loc_len);
+    *gpi = (int*)(*rsize + d->loc_len);
+    *keep = *gpi + d->loc_len;
+    *pix = *keep + d->loc_len;
+    /* doubles have to start on 8 bytes */
+    *time = (double*)((char*)d + (sizeof(warp_data) +
+            warp_loc_len(d->loc_len, d->num_regions) + 7) / 8 * 8);
+    *sm = (int8_t*)(*time + d->obs_room);
+    return;
+}
+
+/* A new location for the thread's sums, with its pixel in every region */
+loc_acc *new_loc_acc(thread_args *t_args, const int *pix, size_t loc_len, int gpi,
+        int file_i, int loc_i) {
+    int num_times = t_args->num_years*YEAR_SUMS;
+    loc_acc *acc = (loc_acc*)calloc(1, sizeof(loc_acc) +
+            (sizeof(int32_t) + sizeof(uint16_t))*num_times);
+    int r;
+
+    if (t_args->num_locs == t_args->max_locs) {
+        t_args->max_locs = t_args->max_locs ? 2*t_args->max_locs : 1024;
+        t_args->locs = (loc_acc**)realloc(t_args->locs, sizeof(loc_acc*)*t_args->max_locs);
+    }
+    if (!acc || !t_args->locs) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+    for (r = 0; r < t_args->num_regions; r++)
+        acc->pix[r] = pix[r*loc_len + loc_i];
+    acc->gpi = gpi;
+    acc->file_i = file_i;
+    acc->loc_i = loc_i;
+    t_args->locs[t_args->num_locs++] = acc;
+    return acc;
+}
+
+/* A location of one region in the merge */
+typedef struct {
+    int pix;
+    loc_acc *acc;
+} region_loc;
+
+/* Order of the locations in the merge: by pixel, and within a pixel by
+ * grid point, so the sums don't depend on which thread read what */
+int cmp_region_loc(const void *a, const void *b) {
+    const region_loc *x = (const region_loc*)a;
+    const region_loc *y = (const region_loc*)b;
+
+    if (x->pix != y->pix)
+        return x->pix < y->pix ? -1 : 1;
+    if (x->acc->gpi != y->acc->gpi)
+        return x->acc->gpi < y->acc->gpi ? -1 : 1;
+    if (x->acc->file_i != y->acc->file_i)
+        return x->acc->file_i < y->acc->file_i ? -1 : 1;
+    return x->acc->loc_i < y->acc->loc_i ? -1 : (x->acc->loc_i > y->acc->loc_i);
+}
+
+/* The days [start, end) of image k of a window, its sum in the prefix
+ * sums of a year is sum[end] - sum[start]. The window is cut off at the
+ * end of the year. */
+static inline void window_bins(const warp_window *window, int k, int *start, int *end) {
+    *start = window->step*k + window->offset;
+    *end = *start + window->len;
+    if (*end > NUM_BINS)
+        *end = NUM_BINS;
+    return;
+}
+
+/* Prefix thread arg struct */
+typedef struct {
+    loc_acc **locs;
+    int num_years;
+    size_t start_i;
+    size_t stop_i;
+} prefix_args;
+
+/* Turn the daily bins of each location into prefix sums over each year */
+void *mthreadPrefix(void *arg) {
+    prefix_args *p_args = (prefix_args*)arg;
+    int num_times = p_args->num_years*YEAR_SUMS;
+    uint16_t *acc_count;
+    loc_acc *acc;
+    size_t l;
+    int y, b, t;
+
+    for (l = p_args->start_i; l < p_args->stop_i; l++) {
+        acc = p_args->locs[l];
+        acc_count = loc_count(acc, num_times);
+        for (y = 0; y < p_args->num_years; y++) {
+            for (b = 1; b < YEAR_SUMS; b++) {
+                t = y*YEAR_SUMS + b;
+                acc->sum[t] += acc->sum[t-1];
+                acc_count[t] += acc_count[t-1];
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Merge thread arg struct */
+typedef struct {
+    region_loc *locs;   /* sorted by cmp_region_loc */
+    size_t *run_start;  /* first location of each pixel with data, and the end */
+    const warp_window *windows;
+    int num_windows;
+    float **mean;       /* [window][pixel with data][year][day], NaN without observations */
+    int year0;
+    int num_years;
+    size_t start_i;
+    size_t stop_i;
+} merge_args;
+
+/* Add up the prefix sums and counts of the locations of each pixel in
+ * order and take the mean over the days of each window. The loops over
+ * the bins are plain array loops the compiler turns into SIMD. */
+void *mthreadMerge(void *arg) {
+    merge_args *m_args = (merge_args*)arg;
+    int num_times = m_args->num_years*YEAR_SUMS;
+    int32_t sum[NUM_TIMES], count[NUM_TIMES];
+    const warp_window *window;
+    const uint16_t *acc_count;
+    float *mean;
+    loc_acc *acc;
+    size_t p, l;
+    int t, w, y, k, start, end, num_days;
+    int32_t s, n;
+
+    for (p = m_args->start_i; p < m_args->stop_i; p++) {
+        for (t = 0; t < num_times; t++) {
+            sum[t] = 0;
+            count[t] = 0;
+        }
+        for (l = m_args->run_start[p]; l < m_args->run_start[p+1]; l++) {
+            acc = m_args->locs[l].acc;
+            acc_count = loc_count(acc, num_times);
+            for (t = 0; t < num_times; t++) {
+                sum[t] += acc->sum[t];
+                count[t] += acc_count[t];
+            }
+        }
+        for (w = 0; w < m_args->num_windows; w++) {
+            window = &m_args->windows[w];
+            for (y = 0; y < m_args->num_years; y++) {
+                mean = m_args->mean[w] + (p*m_args->num_years + y)*window->num_days;
+                num_days = window_days(window, m_args->year0 + y + YEAR_START);
+                for (k = 0; k < num_days; k++) {
+                    window_bins(window, k, &start, &end);
+                    s = sum[y*YEAR_SUMS + end] - sum[y*YEAR_SUMS + start];
+                    n = count[y*YEAR_SUMS + end] - count[y*YEAR_SUMS + start];
+                    mean[k] = n > 0 ? (float)s / n : NAN;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
 void remove_newline(char *text) {
     int last_char = strlen(text) - 1;
     if (text[last_char] == '\n')
@@ -163,368 +578,921 @@ void checkdir(char* dirname) {
 	return;
 }
 
-void *mthreadLoadImg(void *arg) {
-    thread_args *t_args = (thread_args*)arg;
-    float ****storage = t_args->storage;
-    float ****count = t_args->count;
-    int start_i = t_args->start_i;
-    int stop_i = t_args->stop_i;
-    int num_rows = t_args->num_rows;
-    int num_columns = t_args->num_columns;
-    pthread_mutex_t *fopen_lock = t_args->fopen_lock;
-    char **warp_list = t_args->warp_list;
+/* Read the observations of the locations in the images. The row_size
+ * prefix sums give the range of each location, neighbouring ranges are
+ * joined into one hyperslab when the gap between them is small, and the
+ * gap is squeezed out again after the read. */
+static int read_obs(int ncid, int varid, size_t elem, const warp_data *d,
+        const long long *rsize, const int *keep, void *out) {
+    char *o = (char*)out;
+    size_t pos = 0;         /* observations kept so far */
+    size_t first, next;     /* obs index of location i and of the one after it */
+    size_t start[1], count[1], keep_end, seg, gap;
+    size_t i = 0, k;
+    int retval;
+
+    first = 0;
+    while (i < d->loc_len) {
+        if (keep[i] < 0 || rsize[i] == 0) {
+            first += rsize[i++];
+            continue;
+        }
+        /* a span from location i over the next in-image locations */
+        start[0] = first;
+        keep_end = first + rsize[i];
+        next = keep_end;
+        for (k = i + 1; k < d->loc_len; k++) {
+            if (keep[k] >= 0 && rsize[k] > 0) {
+                if (next - keep_end > WARP_OBS_GAP)
+                    break;
+                keep_end = next + rsize[k];
+            }
+            next += rsize[k];
+        }
+        count[0] = keep_end - first;
+        if ((retval = nc_get_vara(ncid, varid, start, count, o + pos*elem)))
+            return retval;
+
+        /* squeeze out the locations outside the images */
+        seg = pos;
+        gap = 0;
+        next = first;
+        for (; i < k; i++) {
+            if (keep[i] >= 0) {
+                if (gap)
+                    memmove(o + seg*elem, o + (seg + gap)*elem, rsize[i]*elem);
+                seg += rsize[i];
+            } else {
+                gap += rsize[i];
+            }
+            next += rsize[i];
+        }
+        pos = seg;
+        first = next;
+    }
+    return 0;
+}
+
+/* Reader process side, reads the WARP file of a warp_request into buf as
+ * a warp_data. Only the observations of locations in one of the images
+ * are read. The pixels come from the tables of the regions, lon and lat
+ * are only read for points that aren't in one of them yet or if the file
+ * isn't in the index. Returns a NetCDF error, or WARP_TOO_BIG with the
+ * bytes it needs in needed. */
+int read_warp_file(void *ctx, const void *req, void *buf, size_t buf_len) {
+    reader_ctx *r = (reader_ctx*)ctx;
+    const warp_request *rq = (const warp_request*)req;
+    int file_i = rq->file_i;
+    int num_regions = r->num_regions;
+    warp_pix_table *pix_table;
+    warp_data *d = (warp_data*)buf;
     int retval;
     int ncid;
-    size_t i,j;
-    int file_i;
-    sir_head *head = t_args->head;
     // netcdf vars
-    int lon_varid, lat_varid, time_varid, sm_varid, rsize_varid;
+    int lon_varid, lat_varid, time_varid, sm_varid, rsize_varid, gpi_varid;
     int loc_dimid, obs_dimid;
-    size_t loc_len,obs_len;
+    size_t file_obs_len;
     // netcdf storage
     double *lon, *lat, *time;
     long long *rsize;
+    int *gpi, *keep, *pix;
     int8_t *sm;
-    // time storage
-    struct tm *tm;
-
-
-
-    for (file_i = start_i; file_i <= stop_i; file_i++) {
-        printf("Processing file %d of %d\n",file_i,935);
-        pthread_mutex_lock(fopen_lock);
-
-        if ((retval = nc_open(warp_list[file_i], NC_NOWRITE, &ncid))) {
-            ERR(retval);
-            continue;
+    size_t i, k, first, next, keep_end, obs_room;
+    int reg;
+
+    if ((retval = nc_open(r->warp_list[file_i], NC_NOWRITE, &ncid)))
+        return retval;
+
+    // get the dimids and the lengths of the dimensions
+    if ((retval = nc_inq_dimid (ncid, "locations", &loc_dimid)) ||
+            (retval = nc_inq_dimid (ncid, "obs", &obs_dimid)) ||
+            (retval = nc_inq_dimlen (ncid, loc_dimid, &d->loc_len)) ||
+            (retval = nc_inq_dimlen (ncid, obs_dimid, &file_obs_len))) {
+        nc_close(ncid);
+        return retval;
+    }
+    d->num_regions = num_regions;
+    d->obs_len = 0;
+    d->obs_room = 0;
+    d->needed = warp_data_len(d->loc_len, num_regions, 0) + 8;
+    if (d->needed > buf_len) {
+        nc_close(ncid);
+        return WARP_TOO_BIG;
+    }
+    warp_arrays(d, &lon, &lat, &rsize, &gpi, &keep, &pix, &time, &sm);
+
+    /* the grid points first, to see if their pixels are all known */
+    if ((retval = nc_inq_varid(ncid, "location_id", &gpi_varid)) ||
+            (retval = nc_inq_varid(ncid, "row_size", &rsize_varid)) ||
+            (retval = nc_get_var_int(ncid, gpi_varid, gpi)) ||
+            (retval = nc_get_var_longlong(ncid, rsize_varid, rsize))) {
+        nc_close(ncid);
+        return retval;
+    }
+    d->has_latlon = rq->need_latlon;
+    for (reg = 0; reg < num_regions && !d->has_latlon; reg++) {
+        pix_table = &r->regions[reg].pix_table;
+        for (i = 0; i < d->loc_len && !d->has_latlon; i++) {
+            if (gpi[i] < 0 || gpi[i] >= pix_table->head.num_gpi ||
+                    pix_table->pix[gpi[i]] == WARP_PIX_UNKNOWN)
+                d->has_latlon = 1;
         }
-        // get the dimids and the lengths of the dimensions
-        if ((retval = nc_inq_dimid (ncid, "locations", &loc_dimid))){
-            ERR(retval);
-            continue;
+    }
+    if (d->has_latlon) {
+        if ((retval = nc_inq_varid(ncid, "lon", &lon_varid)) ||
+                (retval = nc_inq_varid(ncid, "lat", &lat_varid)) ||
+                (retval = nc_get_var_double(ncid, lon_varid, lon)) ||
+                (retval = nc_get_var_double(ncid, lat_varid, lat))) {
+            nc_close(ncid);
+            return retval;
         }
-        if ((retval = nc_inq_dimid (ncid, "obs", &obs_dimid))){
-            ERR(retval);
-            continue;
+    }
+
+    // the pixel of each location in each region, and the room the
+    // observations of the ones in an image take with the gaps that are
+    // read along
+    for (i = 0; i < d->loc_len; i++)
+        keep[i] = -1;
+    for (reg = 0; reg < num_regions; reg++) {
+        warp_region *region = &r->regions[reg];
+        int *reg_pix = pix + reg*d->loc_len;
+        pix_table = &region->pix_table;
+        for (i = 0; i < d->loc_len; i++) {
+            if (gpi[i] >= 0 && gpi[i] < pix_table->head.num_gpi &&
+                    pix_table->pix[gpi[i]] != WARP_PIX_UNKNOWN)
+                reg_pix[i] = pix_table->pix[gpi[i]];
+            else
+                reg_pix[i] = warp_pix_project(lon[i], lat[i], region->num_rows,
+                        region->num_columns, &region->head);
+            if (reg_pix[i] >= 0)
+                keep[i] = 0;
         }
-        if ((retval = nc_inq_dimlen (ncid, loc_dimid, &loc_len))){
-            ERR(retval);
+        // with footprint weights the points around the image are needed
+        // too, the ones with a weight or, before there are weights, the
+        // ones close enough to get one
+        if (!region->footprint)
             continue;
+        for (i = 0; i < d->loc_len; i++) {
+            if (rq->fp_build && !region->fp_ready) {
+                float x, y;
+                sir_latlon2pix(lon[i], lat[i], &x, &y, &region->head);
+                if (warp_fp_near(&region->fp, x, y))
+                    keep[i] = 0;
+            } else if (gpi[i] >= 0 && gpi[i] < WARP_MAX_GPI && region->fp_near[gpi[i]]) {
+                keep[i] = 0;
+            }
         }
-        if ((retval = nc_inq_dimlen (ncid, obs_dimid, &obs_len))){
-            ERR(retval);
+    }
+    for (i = 0; i < d->loc_len; i++) {
+        if (keep[i] >= 0)
+            d->obs_len += rsize[i];
+    }
+    obs_room = 0;
+    first = 0;
+    for (i = 0; i < d->loc_len; i = k) {
+        k = i + 1;
+        if (keep[i] < 0 || rsize[i] == 0) {
+            first += rsize[i];
             continue;
         }
-        // allocate space for all of the variables based on dim length
-        lon = malloc(sizeof(double)*loc_len);
-        lat = malloc(sizeof(double)*loc_len);
-        time = malloc(sizeof(double)*obs_len);
-        rsize = malloc(sizeof(int64_t)*loc_len);
-        sm = malloc(sizeof(int8_t)*obs_len);
-
-        // where to store the time conversions
-        tm = malloc(sizeof(struct tm)*obs_len);
-
-        memset(lon,0,sizeof(double)*loc_len);
-        memset(lat,0,sizeof(double)*loc_len);
-        memset(time,0,sizeof(double)*obs_len);
-        memset(rsize,0,sizeof(int64_t)*loc_len);
-        memset(sm,0,sizeof(int8_t)*obs_len);
-        memset(tm,0,sizeof(struct tm)*obs_len);
-
-        /* Get the varid of the data variable, based on its name. */
-        if ((retval = nc_inq_varid(ncid, "lon", &lon_varid))){
-            ERR(retval);
-            continue;
+        keep_end = first + rsize[i];
+        next = keep_end;
+        for (; k < d->loc_len; k++) {
+            if (keep[k] >= 0 && rsize[k] > 0) {
+                if (next - keep_end > WARP_OBS_GAP)
+                    break;
+                keep_end = next + rsize[k];
+            }
+            next += rsize[k];
         }
-        if ((retval = nc_inq_varid(ncid, "lat", &lat_varid))){
-            ERR(retval);
-            continue;
+        /* this span is read behind the observations kept before it */
+        if (obs_room < keep_end - first)
+            obs_room = keep_end - first;
+        first = next;
+    }
+    d->obs_room = d->obs_len + obs_room;
+    d->needed = warp_data_len(d->loc_len, num_regions, d->obs_room) + 8;
+    if (d->needed > buf_len) {
+        nc_close(ncid);
+        return WARP_TOO_BIG;
+    }
+    warp_arrays(d, &lon, &lat, &rsize, &gpi, &keep, &pix, &time, &sm);
+    if (d->obs_len == 0)
+        return nc_close(ncid);
+
+    /* Get the varids and read values from the netCDF variables */
+    if ((retval = nc_inq_varid(ncid, "time", &time_varid)) ||
+            (retval = nc_inq_varid(ncid, "sm", &sm_varid)) ||
+            (retval = read_obs(ncid, time_varid, sizeof(double), d, rsize, keep, time)) ||
+            (retval = read_obs(ncid, sm_varid, sizeof(int8_t), d, rsize, keep, sm))) {
+        nc_close(ncid);
+        return retval;
+    }
+    return nc_close(ncid);
+}
+
+void *mthreadLoadImg(void *arg) {
+    thread_args *t_args = (thread_args*)arg;
+    warp_bbox *boxes = t_args->boxes;
+    pthread_mutex_t *fopen_lock = t_args->fopen_lock;
+    warp_pix_table *pix_table;
+    reader_ctx r_ctx = {t_args->warp_list, t_args->regions, t_args->num_regions};
+    int num_times = t_args->num_years*YEAR_SUMS;
+    int retval;
+    size_t i,j;
+    int file_i, q, reg;
+    warp_request req;
+    size_t loc_len,obs_len,own_len;
+    // file data, in a reader slot or in own memory if it was too big
+    warp_data *data, *own;
+    double *lon, *lat, *time;
+    long long *rsize;
+    int *gpi, *keep, *pix;
+    int8_t *sm;
+
+    // the files take very different times, so each thread takes the next
+    // one off the queue when it's done with the last
+    for (;;) {
+        pthread_mutex_lock(t_args->queue_lock);
+        q = (*t_args->next_i)++;
+        pthread_mutex_unlock(t_args->queue_lock);
+        if (q >= t_args->queue_len)
+            break;
+        file_i = t_args->queue[q];
+        printf("Processing file %d of %d\n",q,t_args->queue_len);
+
+        own = NULL;
+        req.file_i = file_i;
+        req.fp_build = t_args->fp_build;
+        req.need_latlon = !boxes[file_i].known || req.fp_build;
+        data = (warp_data*)reader_pool_read(t_args->readers, &req, sizeof(req), &retval);
+        // a file too big for a slot is read here instead. The locations are
+        // sized first and then their observations, so the buffer is grown
+        // until both fit.
+        own_len = 0;
+        while (retval == WARP_TOO_BIG && data->needed > own_len) {
+            own_len = data->needed;
+            warp_data *grown = (warp_data*)realloc(own, own_len);
+            if (!grown) {
+                fprintf(stderr, "Memory Error!\n");
+                exit(-1);
+            }
+            if (!own)
+                reader_pool_release(t_args->readers, data);
+            own = data = grown;
+            pthread_mutex_lock(fopen_lock);
+            retval = read_warp_file(&r_ctx, &req, own, own_len);
+            pthread_mutex_unlock(fopen_lock);
         }
-        if ((retval = nc_inq_varid(ncid, "time", &time_varid))){
-            ERR(retval);
+        if (retval) {
+            if (retval == WARP_TOO_BIG)
+                printf("ERROR, %s is too big to read (%zu bytes)!\n",
+                        t_args->warp_list[file_i], data->needed);
+            else
+                ERR(retval);
+            if (own)
+                free(own);
+            else
+                reader_pool_release(t_args->readers, data);
             continue;
         }
-        if ((retval = nc_inq_varid(ncid, "row_size", &rsize_varid))){
-            ERR(retval);
-            continue;
+        loc_len = data->loc_len;
+        obs_len = data->obs_len;
+        warp_arrays(data, &lon, &lat, &rsize, &gpi, &keep, &pix, &time, &sm);
+
+        // add a new file to the index
+        if (!boxes[file_i].known) {
+            warp_bbox_of(lon, lat, loc_len, &boxes[file_i]);
+            *t_args->index_dirty = 1;
         }
-        if ((retval = nc_inq_varid(ncid, "sm", &sm_varid))){
-            ERR(retval);
-            continue;
+
+        // the reader projected the points that aren't in the tables yet,
+        // add them to them
+        for (reg = 0; reg < t_args->num_regions; reg++) {
+            pix_table = &t_args->regions[reg].pix_table;
+            for (i = 0; i < loc_len; i++) {
+                if (gpi[i] >= 0 && gpi[i] < pix_table->head.num_gpi &&
+                        pix_table->pix[gpi[i]] == WARP_PIX_UNKNOWN) {
+                    pix_table->pix[gpi[i]] = pix[reg*loc_len + i];
+                    pix_table->dirty = 1;
+                }
+            }
         }
-        /* read values from netCDF variable */
-        if ((retval = nc_get_var_double(ncid, lon_varid, lon))){
-            ERR(retval);
-            continue;
+
+        // the grid points near the images that have no footprint weights
+        // yet, for building them after the pass
+        for (reg = 0; req.fp_build && reg < t_args->num_regions; reg++) {
+            warp_region *region = &t_args->regions[reg];
+            float x, y;
+            if (!region->footprint || region->fp_ready)
+                continue;
+            pthread_mutex_lock(&region->fp_lock);
+            for (i = 0; i < loc_len; i++) {
+                if (keep[i] < 0 || gpi[i] < 0 || gpi[i] >= WARP_MAX_GPI)
+                    continue;
+                sir_latlon2pix(lon[i], lat[i], &x, &y, &region->head);
+                if (!warp_fp_near(&region->fp, x, y))
+                    continue;
+                if (region->num_fp_points == region->max_fp_points) {
+                    region->max_fp_points = region->max_fp_points ? 2*region->max_fp_points : 4096;
+                    region->fp_points = (warp_fp_point*)realloc(region->fp_points,
+                            sizeof(warp_fp_point)*region->max_fp_points);
+                    if (!region->fp_points) {
+                        fprintf(stderr, "Memory Error!\n");
+                        exit(-1);
+                    }
+                }
+                region->fp_points[region->num_fp_points].gpi = gpi[i];
+                region->fp_points[region->num_fp_points].x = x;
+                region->fp_points[region->num_fp_points++].y = y;
+            }
+            pthread_mutex_unlock(&region->fp_lock);
         }
-        /* read values from netCDF variable */
-        if ((retval = nc_get_var_double(ncid, lat_varid, lat))){
-            ERR(retval);
+
+        // only the observations of locations in the images were read
+        if (obs_len == 0) {
+            // free data
+            if (own)
+                free(own);
+            else
+                reader_pool_release(t_args->readers, data);
             continue;
         }
-        /* read values from netCDF variable */
-        if ((retval = nc_get_var_double(ncid, time_varid, time))){
-            ERR(retval);
-            continue;
+
+        // if I'm here, then there are measurements that need to be stored
+        size_t ind = 0;
+        int t, year, yday;
+        loc_acc *acc;
+        uint16_t *acc_count = NULL;
+        for (i = 0; i < loc_len; i++){
+            // if lat/lon are in one of the images
+            if (keep[i] >= 0) {
+                // made for the first observation in the block of years
+                acc = NULL;
+                for (j = 0; j < rsize[i]; j++){
+                    // time is stored as a double -- number of days since 1900-1-1 00:00:00
+                    warp_time_to_day(time[ind], &year, &yday);
+                    assert(year-(YEAR_START)>=0);
+                    if (year-YEAR_START < t_args->year0 ||
+                            year-YEAR_START >= t_args->year0 + t_args->num_years) {
+                        ind++;
+                        continue;
+                    }
+                    if (acc == NULL) {
+                        acc = new_loc_acc(t_args, pix, loc_len, gpi[i], file_i, i);
+                        acc_count = loc_count(acc, num_times);
+                    }
+
+                    // one bin per day, after the empty sum that starts
+                    // the year. The windows are added up from the bins
+                    // when the locations are merged
+                    t = (year-YEAR_START-t_args->year0)*YEAR_SUMS + yday + 1;
+                    acc->sum[t] += sm[ind];
+                    acc_count[t]++;
+                    ind++;
+                }
+            }
         }
-        /* read values from netCDF variable */
-        if ((retval = nc_get_var_longlong(ncid, rsize_varid, rsize))){
+        // free data
+        if (own)
+            free(own);
+        else
+            reader_pool_release(t_args->readers, data);
+    }
+    return NULL;
+}
+
+/* What the writer processes need to write a day */
+typedef struct {
+    char name[40];          /* region, and the window if not the standard one */
+    int num_rows;
+    int num_columns;
+    int step;               /* days between the images */
+    int num_days[NUM_YEARS];    /* images in each year */
+    int deflate;
+    zarr_array zarr[NUM_YEARS];     /* sm of every year for --zarr */
+} writer_ctx;
+
+/* Writer process side, writes the sm image of one day */
+void write_day_slot(void *ctx, int year, int doy, const float *data) {
+    writer_ctx *w = (writer_ctx*)ctx;
+    int ncid, row_dimid, col_dimid;
+    int varid;
+    int retval;
+    char FILE_NAME[100];
+    int dimids[NDIMS];
+    float fill = NODATA;
+
+    printf("Saving data for %03d %d...\n",doy,year);
+    sprintf(FILE_NAME,"/auto/temp/lindell/soilmoisture/warp/%s_%04d_%03d.nc",w->name,year,doy);
+
+    if ((retval = nc_create(FILE_NAME, NC_NETCDF4, &ncid))){
+        ERR(retval);
+        return;
+    }
+    /* Define the dimensions. */
+    if ((retval = nc_def_dim(ncid, "row", w->num_rows, &row_dimid))) {
+        ERR(retval);
+        return;
+    }
+    if ((retval = nc_def_dim(ncid, "column", w->num_columns, &col_dimid))){
+        ERR(retval);
+        return;
+    }
+
+    /* Define the netCDF variables. The dimids array is used to pass
+       the dimids of the dimensions of the variables.*/
+    dimids[0] = row_dimid;
+    dimids[1] = col_dimid;
+
+    /* define the variable */
+    if ((retval = nc_def_var(ncid, "sm", NC_FLOAT, NDIMS, dimids, &varid)))
+        ERR(retval);
+    if ((retval = nc_def_var_fill(ncid, varid, 0, &fill)))
+        ERR(retval);
+    if (w->deflate > 0) {
+        if ((retval = nc_def_var_deflate(ncid, varid, 1, 1, w->deflate)))
             ERR(retval);
-            continue;
+    }
+
+    /* End define mode. */
+    if ((retval = nc_enddef(ncid)))
+        ERR(retval);
+
+    /* Write the data. */
+    if ((retval = nc_put_var_float(ncid, varid, data)))
+        ERR(retval);
+
+    /* Close the file. */
+    if ((retval = nc_close(ncid)))
+        ERR(retval);
+    return;
+}
+
+/* Create the Zarr store of every year before the writers start: a group
+ * with sm over (time, row, column) and the time coordinate */
+void create_zarr_stores(writer_ctx *w) {
+    const char *dim_names[3] = {"time", "row", "column"};
+    char store[200], path[250], attrs[150];
+    size_t shape[3] = {0, w->num_rows, w->num_columns};
+    size_t chunks[3] = {1, ZARR_CHUNK_ROWS, ZARR_CHUNK_COLS};
+    size_t time_len;
+    int days[NUM_BINS];
+    zarr_array time_arr;
+    size_t time_chunk = 0;
+    int year, k;
+
+    for (k = 0; k < NUM_BINS; k++)
+        days[k] = w->step*k;
+
+    for (year = 0; year < NUM_YEARS; year++) {
+        shape[0] = time_len = w->num_days[year];
+        sprintf(store,"/auto/temp/lindell/soilmoisture/warp/%s_%04d.zarr",w->name,year+YEAR_START);
+        if (zarr_create_group(store))
+            exit(2);
+        sprintf(path, "%s/sm", store);
+        zarr_init_array(&w->zarr[year], path, 3, shape, chunks, w->deflate);
+        if (zarr_create_array(&w->zarr[year], "<f4", "-1.0", dim_names, NULL))
+            exit(2);
+        sprintf(path, "%s/time", store);
+        sprintf(attrs, "\"units\": \"days since %04d-01-01 00:00:00\",\n    \"calendar\": \"standard\"",
+                year+YEAR_START);
+        zarr_init_array(&time_arr, path, 1, &time_len, &time_len, w->deflate);
+        if (zarr_create_array(&time_arr, "<i4", "null", dim_names, attrs) ||
+                zarr_write_chunk(&time_arr, &time_chunk, days, sizeof(int)*time_len))
+            exit(2);
+    }
+    return;
+}
+
+/* Writer process side for --zarr */
+void write_zarr_slot(void *ctx, int year, int doy, const float *data) {
+    writer_ctx *w = (writer_ctx*)ctx;
+
+    printf("Saving data for %03d %d...\n",doy,year);
+    if (zarr_write_plane(&w->zarr[year-YEAR_START], (doy-1)/w->step, data, 0, w->num_rows, NODATA))
+        exit(2);
+    return;
+}
+
+/* Years one pass over the files can add up in mem_bytes, from the grid
+ * points in one of the images, or with a footprint weight in one. Until
+ * the tables of the regions have the points of every file they aren't
+ * known, so that pass does a single year and fills them in for the next
+ * ones. */
+int fit_years(warp_region *regions, int num_regions, const warp_window *windows,
+        int num_windows, int complete, double mem_bytes) {
+    size_t num_points = 0;
+    double loc_bytes, year_bytes;
+    int gpi, reg, years, w, num_days = 0;
+
+    if (!complete)
+        return 1;
+    for (gpi = 0; gpi < WARP_MAX_GPI; gpi++) {
+        for (reg = 0; reg < num_regions; reg++) {
+            if (regions[reg].pix_table.pix[gpi] >= 0 ||
+                    (regions[reg].footprint && regions[reg].fp_near[gpi])) {
+                num_points++;
+                break;
+            }
         }
-        /* read values from netCDF variable */
-        if ((retval = nc_get_var(ncid, sm_varid, sm))){
-            ERR(retval);
-            continue;
+    }
+    // the daily sums and counts, and the merged means of a region
+    for (w = 0; w < num_windows; w++)
+        num_days += windows[w].num_days;
+    year_bytes = (double)num_points*(YEAR_SUMS*(sizeof(int32_t) + sizeof(uint16_t)) +
+            num_days*sizeof(float));
+    loc_bytes = (double)num_points*(sizeof(loc_acc) + sizeof(loc_acc*) + sizeof(region_loc) + 16);
+    years = year_bytes > 0 ? (int)((mem_bytes - loc_bytes) / year_bytes) : NUM_YEARS;
+    if (years < 1) {
+        printf("ERROR, the sums of one year of %zu grid points don't fit in the memory budget!\n",
+                num_points);
+        exit(-1);
+    }
+    printf("%zu grid points in the regions\n", num_points);
+    return years < NUM_YEARS ? years : NUM_YEARS;
+}
+
+/* Hand a gathered day of a region to its writers, or list it in the empty
+ * days if there wasn't a single measurement */
+static void hand_day(day_writer *writer, float **slot, int observed, FILE *empty_fid,
+        int zarr, int year_i, int doy) {
+    if (!observed) {
+        printf("No data for %03d %d, skipping\n",doy,year_i+YEAR_START);
+        fprintf(empty_fid, "%04d %03d\n", year_i+YEAR_START, doy);
+        // a Zarr day may be rewritten, its old chunks are removed
+        if (!zarr)
+            return;
+    }
+    // an empty day keeps its slot for the next one
+    day_writer_submit(writer, year_i+YEAR_START, doy);
+    *slot = NULL;
+    return;
+}
+
+/* SpMV thread arg struct */
+typedef struct {
+    const warp_fp_matrix *fp;
+    const float *x_sum;     /* [column], the sums of the grid points on the day */
+    const float *x_count;
+    float *slot;
+    size_t start_i;         /* pixels */
+    size_t stop_i;
+    int observed;
+} spmv_args;
+
+/* One day of the footprint weighted images: the weighted sum of the
+ * observations around each pixel over the weighted number of them */
+void *mthreadSpmv(void *arg) {
+    spmv_args *s_args = (spmv_args*)arg;
+    const warp_fp_matrix *fp = s_args->fp;
+    float sum, count;
+    size_t p;
+    int64_t e;
+
+    s_args->observed = 0;
+    for (p = s_args->start_i; p < s_args->stop_i; p++) {
+        sum = 0;
+        count = 0;
+        for (e = fp->row_start[p]; e < fp->row_start[p+1]; e++) {
+            sum += fp->weight[e] * s_args->x_sum[fp->col[e]];
+            count += fp->weight[e] * s_args->x_count[fp->col[e]];
         }
-        if ((retval = nc_close(ncid))){
-            ERR(retval);
-            continue;
+        if (count > 0) {
+            s_args->slot[p] = sum / count;
+            s_args->observed = 1;
+        } else {
+            s_args->slot[p] = NODATA;
         }
+    }
+    return NULL;
+}
 
-        pthread_mutex_unlock(fopen_lock);
+/* The days of a region with footprint weights. The window sums of each
+ * grid point with a weight are put in a vector for the day and the matrix
+ * is applied to it, the threads taking the pixels in runs of about the
+ * same number of weights. Each window has its own writers. */
+void write_region_fp(warp_region *region, loc_acc **all_locs, size_t num_all_locs,
+        int year0, int num_years, const warp_window *windows, int num_windows,
+        day_writer **writer, float **slot, FILE **empty_fid, int zarr) {
+    const warp_fp_matrix *fp = &region->fp;
+    size_t num_pix = (size_t)region->num_rows*region->num_columns;
+    int num_times = num_years*YEAR_SUMS;
+    pthread_t thread_id[NUM_THREADS];
+    spmv_args s_args[NUM_THREADS];
+    size_t i, c, lo, hi, num_data = 0;
+    int year_i, day_i, w, start, end, observed;
+    const uint16_t *acc_count;
+
+    printf("Applying the footprint weights of %s...\n", region->name);
+    loc_acc **by_gpi = (loc_acc**)calloc(WARP_MAX_GPI, sizeof(loc_acc*));
+    loc_acc **col_acc = (loc_acc**)malloc(sizeof(loc_acc*)*(fp->head.num_cols+1));
+    float *x_sum = (float*)malloc(sizeof(float)*(fp->head.num_cols+1));
+    float *x_count = (float*)malloc(sizeof(float)*(fp->head.num_cols+1));
+    if (!by_gpi || !col_acc || !x_sum || !x_count) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+    for (i = 0; i < num_all_locs; i++) {
+        if (all_locs[i]->gpi >= 0 && all_locs[i]->gpi < WARP_MAX_GPI &&
+                by_gpi[all_locs[i]->gpi] == NULL)
+            by_gpi[all_locs[i]->gpi] = all_locs[i];
+    }
+    for (c = 0; c < (size_t)fp->head.num_cols; c++) {
+        col_acc[c] = by_gpi[fp->col_gpi[c]];
+        if (col_acc[c])
+            num_data++;
+    }
+    free(by_gpi);
+    printf("%zu of %d grid points with weights have data\n", num_data, fp->head.num_cols);
 
-        // now load the image into the storage array if necessary
-        int use_file = 0;
-        float x,y;
-        int x_int, y_int;
-        for (i = 0; i < loc_len; i++) {
-            sir_latlon2pix(lon[i],lat[i],&x,&y,head);
-            x_int = (int)x;
-            y_int = (int)y;
-            if ( x_int < num_columns && x_int >= 0 && y_int < num_rows && y_int >= 0) {
-                use_file = 1;
-                break;
+    // split the pixels where the weights before them pass each share
+    for (i = 0; i < NUM_THREADS; i++) {
+        int64_t share = fp->head.num_weights * (int64_t)i / NUM_THREADS;
+        lo = 0;
+        hi = num_pix;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (fp->row_start[mid] < share)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        s_args[i].start_i = lo;
+        if (i > 0)
+            s_args[i-1].stop_i = lo;
+        s_args[i].fp = fp;
+        s_args[i].x_sum = x_sum;
+        s_args[i].x_count = x_count;
+    }
+    s_args[NUM_THREADS-1].stop_i = num_pix;
+
+    for (w = 0; w < num_windows; w++) {
+        for (year_i = year0; year_i < year0 + num_years; year_i++) {
+            int num_days = window_days(&windows[w], year_i+YEAR_START);
+            for (day_i = 0; day_i < num_days; day_i++){
+                if (slot[w] == NULL)
+                    slot[w] = day_writer_slot(writer[w]);
+
+                window_bins(&windows[w], day_i, &start, &end);
+                start += (year_i-year0)*YEAR_SUMS;
+                end += (year_i-year0)*YEAR_SUMS;
+                for (c = 0; c < (size_t)fp->head.num_cols; c++) {
+                    if (col_acc[c]) {
+                        acc_count = loc_count(col_acc[c], num_times);
+                        x_sum[c] = col_acc[c]->sum[end] - col_acc[c]->sum[start];
+                        x_count[c] = acc_count[end] - acc_count[start];
+                    } else {
+                        x_sum[c] = 0;
+                        x_count[c] = 0;
+                    }
+                }
+                for (i = 0; i < NUM_THREADS; i++) {
+                    s_args[i].slot = slot[w];
+                    pthread_create(&thread_id[i], NULL, mthreadSpmv, &s_args[i]);
+                }
+                observed = 0;
+                for (i = 0; i < NUM_THREADS; i++) {
+                    pthread_join(thread_id[i], NULL);
+                    observed |= s_args[i].observed;
+                }
+                hand_day(writer[w], &slot[w], observed, empty_fid[w], zarr, year_i,
+                        windows[w].step*day_i+1);
             }
         }
+    }
+    free(col_acc);
+    free(x_sum);
+    free(x_count);
+    return;
+}
 
-        if (!use_file) {
-            // free data
-            free(lon);
-            free(lat);
-            free(time);
-            free(rsize);
-            free(sm);
-            free(tm);
-            continue;
+/* Merge the sums of the threads into the window means of each pixel of
+ * the region with data, and hand its days in the block to the writers of
+ * each window. The locations of a pixel are added in grid point order so
+ * the result is the same however the files were split between the
+ * threads. */
+void write_region(warp_region *region, int reg, loc_acc **all_locs, size_t num_all_locs,
+        int year0, int num_years, const warp_window *windows, int num_windows,
+        day_writer **writer, float **slot, FILE **empty_fid, int zarr) {
+    pthread_t thread_id[NUM_THREADS];
+    merge_args m_args[NUM_THREADS];
+    float *mean[MAX_WINDOWS];
+    size_t i, num_locs = 0;
+    int w;
+
+    printf("Merging the sums of %s...\n", region->name);
+    region_loc *locs = malloc(sizeof(region_loc)*(num_all_locs+1));
+    size_t *run_start = malloc(sizeof(size_t)*(num_all_locs+1));
+    int *data_pix = malloc(sizeof(int)*(num_all_locs+1));
+    if (!locs || !run_start || !data_pix) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+    for (i = 0; i < num_all_locs; i++) {
+        if (all_locs[i]->pix[reg] >= 0) {
+            locs[num_locs].pix = all_locs[i]->pix[reg];
+            locs[num_locs++].acc = all_locs[i];
         }
+    }
+    qsort(locs, num_locs, sizeof(region_loc), cmp_region_loc);
 
-        // if I'm here, then there are measurements that need to be stored
-        // first convert the time to doy and year
-        // time is stored as a double -- number of days since 1900-1-1 00:00:00
-        double cur_time;
-        for (i = 0; i < obs_len; i++){
-            cur_time = time[i];
-            // first convert to seconds
-            // (1 day * 24 hours/day * 60 min/hr * 60 sec/min) = 84600
-            cur_time = cur_time * 86400;
-            // convert from seconds since 1900 to unix time
-            // note that accd to time protocol in RFC 868, this is 2208988800
-            cur_time = cur_time - 2208988800;
-
-            // here, cast from double to time_t and use gmtime_r to convert to year/doy
-            time_t cur_time_conv = (time_t) cur_time;
-            gmtime_r(&cur_time_conv, &tm[i]);
-            // note that tm_year is years since 1900, so adjust to true year
-            tm[i].tm_year = tm[i].tm_year + 1900;
-            assert(tm[i].tm_year-(YEAR_START)>=0);
-        }
-        // now all the times should be correct in the tm struct
-        // parse through the measurements
+    size_t num_data_pix = 0;
+    for (i = 0; i < num_locs; i++) {
+        if (i == 0 || locs[i].pix != locs[i-1].pix) {
+            run_start[num_data_pix] = i;
+            data_pix[num_data_pix++] = locs[i].pix;
+        }
+    }
+    run_start[num_data_pix] = num_locs;
+    for (w = 0; w < num_windows; w++) {
+        mean[w] = malloc(sizeof(float)*num_years*windows[w].num_days*(num_data_pix+1));
+        if (!mean[w]) {
+            fprintf(stderr, "Memory Error!\n");
+            exit(-1);
+        }
+    }
+    printf("%zu locations in %zu pixels\n", num_locs, num_data_pix);
 
-        size_t ind = 0;
-        int affected_days[3] = {-1,-1,-1};
-        int k;
-        for (i = 0; i < loc_len; i++){
-            sir_latlon2pix(lon[i],lat[i],&x,&y,head);
-            x_int = (int)x;
-            y_int = (int)y;
-            // if lat/lon are in im bounds
-            if ( x_int < num_columns && x_int >= 0 && y_int < num_rows && y_int >= 0) {
-                for (j = 0; j < rsize[i]; j++){
+    for (i = 0; i < NUM_THREADS; i++) {
+        m_args[i].locs = locs;
+        m_args[i].run_start = run_start;
+        m_args[i].windows = windows;
+        m_args[i].num_windows = num_windows;
+        m_args[i].mean = mean;
+        m_args[i].year0 = year0;
+        m_args[i].num_years = num_years;
+        m_args[i].start_i = num_data_pix * i / NUM_THREADS;
+        m_args[i].stop_i = num_data_pix * (i+1) / NUM_THREADS;
+        pthread_create(&thread_id[i], NULL, mthreadMerge, &m_args[i]);
+    }
+    for (i = 0; i < NUM_THREADS; i++)
+        pthread_join(thread_id[i], NULL);
+    free(locs);
+    free(run_start);
 
-                    if (tm[ind].tm_yday%2 == 0){
-                        affected_days[0] = tm[ind].tm_yday-3;
-                        affected_days[1] = tm[ind].tm_yday-1;
-                        affected_days[2] = -1;
-                    }
-                    else {
-                        affected_days[0] = tm[ind].tm_yday-4;
-                        affected_days[1] = tm[ind].tm_yday-2;
-                        affected_days[2] = tm[ind].tm_yday;
-                    }
-                    // convert affected days to a 1:2:365 index
-
-                    for (k = 0; k < 3; k++) {
-                        if (affected_days[k] < 0)
-                            continue;
-                        affected_days[k] = affected_days[k]/2;
-                        // shorthand
-                        float *st = &storage[y_int][x_int][affected_days[k]][tm[ind].tm_year-YEAR_START];
-                        float *ct = &count[y_int][x_int][affected_days[k]][tm[ind].tm_year-YEAR_START];
-                        // do running average
-                        *st = *st + (((float)sm[ind]) - *st) / *ct;
-                        (*ct)++;
+    // gather each day into a writer slot, the writers save the files
+    // while the next days are gathered
+    // days without a single measurement aren't written, they are listed
+    // in warp/<name>_empty.txt instead
+    int year_i;
+    int day_i;
+    int observed;
+    for (w = 0; w < num_windows; w++) {
+        int num_times = num_years*windows[w].num_days;
+        for (year_i = year0; year_i < year0 + num_years; year_i++) {
+            int num_days = window_days(&windows[w], year_i+YEAR_START);
+            for (day_i = 0; day_i < num_days; day_i++){
+                if (slot[w] == NULL)
+                    slot[w] = day_writer_slot(writer[w]);
+
+                // copy the pixels with data into the slot
+                observed = 0;
+                for (i = 0; i < (size_t)region->num_rows*region->num_columns; i++)
+                    slot[w][i] = NODATA; // set nodata flag
+                for (i = 0; i < num_data_pix; i++) {
+                    float value = mean[w][i*num_times + (year_i-year0)*windows[w].num_days + day_i];
+                    if (!isnan(value)) {
+                        slot[w][data_pix[i]] = value;
+                        observed = 1;
                     }
-                    ind++;
                 }
-            }
-            else {
-                ind += rsize[i];
+                hand_day(writer[w], &slot[w], observed, empty_fid[w], zarr, year_i,
+                        windows[w].step*day_i+1);
             }
         }
-        // free data
-        free(lon);
-        free(lat);
-        free(time);
-        free(rsize);
-        free(sm);
-        free(tm);
+        free(mean[w]);
     }
-    return NULL;
+    free(data_pix);
+    return;
 }
 
 int main (int argc, char **argv)
 {
     struct arguments arguments;
 
-    // Set up variables
-    int num_columns;
-    int num_rows;
-
     // multithreading params
     thread_args t_args[NUM_THREADS];
     pthread_t thread_id[NUM_THREADS];
-    int ind_per_thread;
-    int start_index;
-    int stop_index;
-    size_t i,j,k,m;
-
-    // Initialize NETCDF Variables
-    int ncid, row_dimid, col_dimid;
-    int varid;
-    int retval;
-    char FILE_NAME[100];
-    int dimids[NDIMS];
+    size_t i,j;
+    int reg;
 
     /* Default values. */
     arguments.verbose = 0;
-    arguments.region = NULL;
+    arguments.writers = DEFAULT_WRITERS;
+    arguments.deflate = DEFAULT_DEFLATE;
+    arguments.zarr = 0;
+    arguments.readers = DEFAULT_READERS;
+    arguments.memory = 0;
+    arguments.footprint = 0;
+    arguments.num_windows = 0;
+    arguments.num_regions = 0;
 
     /* Parse our arguments; every option seen by parse_opt will
      be reflected in arguments. */
     argp_parse (&argp, argc, argv, 0, 0, &arguments);
 
-    char* region = arguments.region;
+    int num_regions = arguments.num_regions;
+
+    // the composite windows, the standard one if none were given
+    warp_window windows[MAX_WINDOWS];
+    int num_windows = arguments.num_windows;
+    if (num_windows == 0) {
+        arguments.window_len[0] = DEFAULT_WINDOW_LEN;
+        arguments.window_step[0] = DEFAULT_WINDOW_STEP;
+        num_windows = 1;
+    }
+    for (i = 0; i < (size_t)num_windows; i++) {
+        windows[i].len = arguments.window_len[i];
+        windows[i].step = arguments.window_step[i];
+        windows[i].offset = windows[i].len == DEFAULT_WINDOW_LEN &&
+                windows[i].step == DEFAULT_WINDOW_STEP;
+        windows[i].num_days = ((windows[i].offset ? 365 : NUM_BINS) + windows[i].step - 1) /
+                windows[i].step;
+    }
 
     printf ("GEN_WARP_IMAGES\n---------------\nBeginning processing with options:\n");
 
-    printf ("Region = %s\nVERBOSE = %s\n---------------\n",
-          arguments.region,
-          arguments.verbose ? "yes" : "no");
-
-    // define image areas based on region
-    if (strcmp(region,"Ama") == 0) {
-      num_columns = 1128;
-      num_rows = 744;
-    } else if (strcmp(region,"Ber") == 0) {
-          num_columns = 1350;
-          num_rows = 750;
-    } else if (strcmp(region,"CAm") == 0) {
-          num_columns = 1440;
-          num_rows = 700;
-    } else if (strcmp(region,"ChJ") == 0) {
-          num_columns = 1980;
-          num_rows = 950;
-    } else if (strcmp(region,"Eur") == 0) {
-          num_columns = 1530;
-          num_rows = 1040;
-    } else if (strcmp(region,"Ind") == 0) {
-          num_columns = 1800;
-          num_rows = 680;
-    } else if (strcmp(region,"NAf") == 0) {
-          num_columns = 2120;
-          num_rows = 1130;
-    } else if (strcmp(region,"NAm") == 0) {
-          num_columns = 1890;
-          num_rows = 1150;
-    } else if (strcmp(region,"SAf") == 0) {
-          num_columns = 1220;
-          num_rows = 1260;
-    } else if (strcmp(region,"SAm") == 0) {
-          num_columns = 1310;
-          num_rows = 1850;
-    }  else if (strcmp(region,"SAs") == 0) {
-          num_columns = 1760;
-          num_rows = 720;
-    } else {
-          printf("ERROR SETTING REGION SIZES!");
-          exit(-1);
-    }
-
-    // open example sir file
-    sir_head head;
-    char sir_fname[150];
-    sprintf(sir_fname,"/home/lindell/workspace/soil_moisture/sm_gen_warp_images/sir/%s.sir",region);
-    FILE *sir_fid = fopen(sir_fname,"r");
-    if (sir_fid == NULL) {
-        fprintf(stderr,"*** could not open list file %s\n",sir_fname);
+    printf ("Regions =");
+    for (reg = 0; reg < num_regions; reg++)
+        printf (" %s", arguments.regions[reg]);
+    printf ("\nWindows =");
+    for (i = 0; i < (size_t)num_windows; i++)
+        printf (" %d:%d", windows[i].len, windows[i].step);
+    printf ("\nVERBOSE = %s\nWRITERS = %d\nREADERS = %d\nFOOTPRINT = %g\n---------------\n",
+          arguments.verbose ? "yes" : "no",
+          arguments.writers,
+          arguments.readers,
+          arguments.footprint);
+
+    // image size, projection and grid point pixels of each region
+    warp_region *regions = calloc(num_regions, sizeof(warp_region));
+    int tables_read = 1;
+    if (!regions) {
+        fprintf(stderr, "Memory Error!\n");
         exit(-1);
     }
-    get_sir_head_file(sir_fid,&head);
-    head.ascale = head.ascale/2.809;
-    head.bscale = head.bscale/2.809;
-
-//    printf("NUM_ROWS: %d\nNUM_COL: %d\nNUM_DAYS: %d\nNUM_YEARS: %d\nREG:%s\n",num_rows,num_columns,NUM_DAYS,NUM_YEARS,region);
-//    exit(-1);
-    // Allocate memory for 4D image timeseries array
-    setvbuf (stdout, NULL, _IONBF, 0);
-    printf("Allocating Memory...");
-    float ****row_ptr = (float****)malloc(sizeof(float ***)*num_rows);
-    float ***column_ptr = (float***)malloc(sizeof(float **)*num_rows * num_columns);
-    float **day_ptr = (float**)malloc(sizeof(float *)*num_rows * num_columns*NUM_DAYS);
-    float *year_ptr = (float*)malloc(sizeof(float)*num_rows*num_columns*NUM_YEARS*NUM_DAYS);
-    float ****storage = row_ptr;
-
-    for (i = 0; i < num_rows; i++, column_ptr += num_columns) {
-        storage[i] = column_ptr;
-        for (j = 0; j < num_columns; j++, day_ptr += NUM_DAYS) {
-            storage[i][j] = day_ptr;
-            for (k = 0; k < NUM_DAYS; k++, year_ptr += NUM_YEARS) {
-                storage[i][j][k] = year_ptr;
-            }
+    for (reg = 0; reg < num_regions; reg++) {
+        warp_region *region = &regions[reg];
+        const region_size *size = find_region(arguments.regions[reg]);
+        region->name = arguments.regions[reg];
+        region->num_columns = size->num_columns;
+        region->num_rows = size->num_rows;
+
+        // open example sir file
+        char sir_fname[150];
+        sprintf(sir_fname,"/home/lindell/workspace/soil_moisture/sm_gen_warp_images/sir/%s.sir",region->name);
+        FILE *sir_fid = fopen(sir_fname,"r");
+        if (sir_fid == NULL) {
+            fprintf(stderr,"*** could not open list file %s\n",sir_fname);
+            exit(-1);
+        }
+        get_sir_head_file(sir_fid,&region->head);
+        fclose(sir_fid);
+        region->head.ascale = region->head.ascale/2.809;
+        region->head.bscale = region->head.bscale/2.809;
+
+        // pixel of every WARP grid point, saved by an earlier run or made by
+        // this one as the files are read
+        sprintf(region->pix_fname,"/auto/temp/lindell/soilmoisture/warp/%s_pix.bin",region->name);
+        if (warp_pix_init(&region->pix_table, region->num_rows, region->num_columns, &region->head)) {
+            fprintf(stderr, "Memory Error!\n");
+            exit(-1);
+        }
+        if (warp_pix_read(&region->pix_table, region->pix_fname) == 0) {
+            printf("Using the grid point pixels in %s\n", region->pix_fname);
+        } else {
+            printf("No grid point pixels for %s yet, they are made as the files are read\n",
+                    region->name);
+            tables_read = 0;
         }
-    }
-    memset(storage[0][0][0],0,num_rows*num_columns*NUM_YEARS*NUM_DAYS*sizeof(float));
 
-    row_ptr = (float****)malloc(sizeof(float ***)*num_rows);
-    column_ptr = (float***)malloc(sizeof(float **)*num_rows * num_columns);
-    day_ptr = (float**)malloc(sizeof(float *)*num_rows * num_columns*NUM_DAYS);
-    year_ptr = (float*)malloc(sizeof(float)*num_rows*num_columns*NUM_YEARS*NUM_DAYS);
-    float ****count = row_ptr;
-    for (i = 0; i < num_rows; i++, column_ptr += num_columns) {
-        count[i] = column_ptr;
-        for (j = 0; j < num_columns; j++, day_ptr += NUM_DAYS) {
-            count[i][j] = day_ptr;
-            for (k = 0; k < NUM_DAYS; k++, year_ptr += NUM_YEARS) {
-                count[i][j][k] = year_ptr;
+        // footprint weights, saved by an earlier run or built after the
+        // first pass
+        if (arguments.footprint > 0) {
+            region->footprint = 1;
+            warp_fp_init(&region->fp, region->num_rows, region->num_columns,
+                    arguments.footprint, &region->head);
+            sprintf(region->fp_fname,"/auto/temp/lindell/soilmoisture/warp/%s_fp.bin",region->name);
+            region->fp_near = (uint8_t*)mmap(NULL, WARP_MAX_GPI, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (region->fp_near == MAP_FAILED) {
+                fprintf(stderr, "Memory Error!\n");
+                exit(-1);
             }
-        }
-    }
-//    memset(count[0][0][0],0,num_rows*num_columns*NUM_YEARS*NUM_DAYS*sizeof(float));
-    for (i = 0; i < num_rows; i++){
-        for (j = 0; j < num_columns; j++) {
-            for (k = 0; k < NUM_DAYS; k++) {
-                for (m = 0; m < NUM_YEARS; m++) {
-                    count[i][j][k][m] = 1;
-                }
+            pthread_mutex_init(&region->fp_lock, NULL);
+            if (warp_fp_read(&region->fp, region->fp_fname) == 0) {
+                printf("Using the footprint weights in %s\n", region->fp_fname);
+                for (i = 0; i < (size_t)region->fp.head.num_cols; i++)
+                    region->fp_near[region->fp.col_gpi[i]] = 1;
+                region->fp_ready = 1;
+            } else {
+                printf("No footprint weights for %s yet, they are made in the first pass\n",
+                        region->name);
+                tables_read = 0;
             }
         }
     }
-    printf("Done\n");
-
     // get list of files to be opened
     char warp_fname[] = "/home/lindell/workspace/soil_moisture/sm_gen_warp_images/warp.list";
     FILE* file_id = fopen(warp_fname,"r");
@@ -558,130 +1526,259 @@ int main (int argc, char **argv)
         ++fname_i;
     }
 
-    printf("Preparing for processing...\n");
-
-    // sort through pixels/images
-    // split up row processing based on number of threads/files
-    ind_per_thread = (list_len-1) / NUM_THREADS;
-
-    if ((ind_per_thread % 2) == 0) {
-        ind_per_thread--;
-    }
-
-    start_index = 0;
-    stop_index = 0;
-    for (i = 0; i < NUM_THREADS; i++) {
-        if (i == NUM_THREADS - 1) {
-            stop_index = list_len-1;
-        } else {
-            stop_index = start_index + ind_per_thread;
-        }
-        t_args[i].storage = storage;
-        t_args[i].count = count;
-        t_args[i].start_i = start_index;
-        t_args[i].stop_i = stop_index;
-        t_args[i].num_rows = num_rows;
-        t_args[i].num_columns = num_columns;
-        t_args[i].region = region;
-        t_args[i].fopen_lock = &fopen_lock;
-        t_args[i].warp_list = warp_list;
-        t_args[i].head = &head;
-        start_index = stop_index + 1;
-    }
-
-    // submit threads
-    for (i = 0; i < NUM_THREADS; i++) {
-        pthread_create(&thread_id[i], NULL, mthreadLoadImg, &t_args[i]);
+    // bounding boxes of the files, from the index or worked out as the new
+    // files are read
+    char index_fname[] = "/auto/temp/lindell/soilmoisture/warp/warp_index.txt";
+    warp_bbox *boxes = malloc(sizeof(warp_bbox)*list_len);
+    if (warp_index_read(index_fname, warp_list, list_len, boxes))
+        printf("No WARP file index yet, every file is read\n");
+
+    // start the readers and writers before anything big is allocated,
+    // they are forked. Without readers the threads read under fopen_lock,
+    // the same lock as the files too big for a slot.
+    int num_read_slots = NUM_THREADS;
+    if (arguments.readers && SLOTS_PER_READER*arguments.readers < NUM_THREADS)
+        num_read_slots = SLOTS_PER_READER*arguments.readers;
+    reader_ctx r_ctx = {warp_list, regions, num_regions};
+    reader_pool *readers = reader_pool_start(arguments.readers, num_read_slots,
+            READ_SLOT_LEN, read_warp_file, &r_ctx, &fopen_lock);
+
+    // every region and window has its own writers, the writers are split
+    // between them. A region's days are written while the next one is
+    // merged. The standard window keeps the plain region names.
+    int num_products = num_regions*num_windows;
+    int product_writers = arguments.writers / num_products;
+    if (arguments.writers && product_writers < 1)
+        product_writers = 1;
+    int product_slots = product_writers ? SLOTS_PER_WRITER*product_writers : 1;
+    writer_ctx w_ctx[MAX_REGIONS*MAX_WINDOWS];
+    day_writer *writer[MAX_REGIONS*MAX_WINDOWS];
+    float *slot[MAX_REGIONS*MAX_WINDOWS];
+    FILE *empty_fid[MAX_REGIONS*MAX_WINDOWS];
+    double slot_bytes = (double)num_read_slots*READ_SLOT_LEN;
+    for (i = 0; i < (size_t)num_products; i++) {
+        warp_region *region = &regions[i / num_windows];
+        const warp_window *window = &windows[i % num_windows];
+        memset(&w_ctx[i], 0, sizeof(writer_ctx));
+        if (window->offset)
+            sprintf(w_ctx[i].name,"%s",region->name);
+        else
+            sprintf(w_ctx[i].name,"%s_w%ds%d",region->name,window->len,window->step);
+        w_ctx[i].num_rows = region->num_rows;
+        w_ctx[i].num_columns = region->num_columns;
+        w_ctx[i].step = window->step;
+        for (j = 0; j < NUM_YEARS; j++)
+            w_ctx[i].num_days[j] = window_days(window, j+YEAR_START);
+        w_ctx[i].deflate = arguments.deflate;
+        if (arguments.zarr)
+            create_zarr_stores(&w_ctx[i]);
+        writer[i] = day_writer_start(product_writers, product_slots,
+                (size_t)region->num_rows*region->num_columns,
+                arguments.zarr ? write_zarr_slot : write_day_slot, &w_ctx[i]);
+        slot[i] = NULL;
+        slot_bytes += (double)product_slots*region->num_rows*region->num_columns*sizeof(float);
+
+        char empty_fname[100];
+        empty_fid[i] = NULL;
+        if (snprintf(empty_fname,sizeof(empty_fname),"/auto/temp/lindell/soilmoisture/warp/%s_empty.txt",
+                w_ctx[i].name) < (int)sizeof(empty_fname))
+            empty_fid[i] = fopen(empty_fname,"w");
+        if (empty_fid[i] == NULL) {
+            fprintf(stderr,"*** could not write empty day index %s\n",empty_fname);
+            exit(-1);
+        }
+        fprintf(empty_fid[i], "# days without data, not written (year doy)\n");
     }
 
-    // join threads
-    for (i = 0; i < NUM_THREADS; i++) {
-        pthread_join(thread_id[i], NULL);
-    }
+    setvbuf (stdout, NULL, _IONBF, 0);
 
-    // save storage array to netcdf file
-    printf("Done processing, preparing to save files\n");
+    printf("Preparing for processing...\n");
 
-    // malloc a temp array;
-    float **tmp_arr = malloc(sizeof(float**)*num_rows);
-    tmp_arr[0] = malloc(sizeof(float)*num_rows*num_columns);
-    for (i = 0; i < num_rows; i++) {
-        tmp_arr[i] = tmp_arr[0] + i*num_columns;
+    // split the years into blocks that fit the memory budget, each block is
+    // one pass over the files for all of the regions
+    int complete = tables_read;
+    for (i = 0; i < list_len; i++) {
+        if (!boxes[i].known)
+            complete = 0;
     }
-    memset(tmp_arr[0],0,num_rows*num_columns*sizeof(float));
-
-    int year_i;
-    int day_i;
-    for (year_i = 0; year_i < NUM_YEARS; year_i++) {
-        for (day_i = 0; day_i < NUM_DAYS; day_i++){
-            printf("Saving data for %03d %d...\n",day_i*2+1,year_i+2007);
-
-            // copy data from storage into temp array
-            for (i = 0; i < num_rows; i++) {
-                for (j = 0; j < num_columns; j++) {
-                    tmp_arr[i][j] = storage[i][j][day_i][year_i];
-                    if (count[i][j][day_i][year_i] == 1) {
-                        tmp_arr[i][j] = -1; // set nodata flag
-                    }
+    int block_years = NUM_YEARS;
+    if (arguments.memory > 0)
+        block_years = fit_years(regions, num_regions, windows, num_windows, complete,
+                arguments.memory*1e9 - slot_bytes);
+
+    int *queue = malloc(sizeof(int)*list_len);
+    int queue_len;
+    int next_i;
+    int index_dirty = 0;
+    pthread_mutex_t queue_lock;
+    pthread_mutex_init(&queue_lock, NULL);
+    int year0, num_years;
+    for (year0 = 0; year0 < NUM_YEARS; year0 += num_years) {
+        num_years = NUM_YEARS - year0 < block_years ? NUM_YEARS - year0 : block_years;
+        if (num_years < NUM_YEARS)
+            printf("Block: Year %04d-%04d\n", year0+YEAR_START, year0+num_years-1+YEAR_START);
+
+        // only queue the files whose box overlaps one of the regions, and
+        // the ones that aren't in the index yet
+        queue_len = 0;
+        next_i = 0;
+        int fp_build = 0;
+        for (reg = 0; reg < num_regions; reg++) {
+            if (regions[reg].footprint && !regions[reg].fp_ready)
+                fp_build = 1;
+        }
+        for (i = 0; i < list_len; i++) {
+            for (reg = 0; reg < num_regions; reg++) {
+                int margin = regions[reg].footprint ?
+                        (int)ceilf(warp_fp_radius(regions[reg].fp.head.sigma)) + 1 : 0;
+                if (!boxes[i].known || warp_bbox_overlaps(&boxes[i], regions[reg].num_rows,
+                        regions[reg].num_columns, margin, &regions[reg].head)) {
+                    queue[queue_len++] = i;
+                    break;
                 }
             }
+        }
+        printf("Reading %d of %zu WARP files, the others are outside the regions\n", queue_len, list_len);
+
+        for (i = 0; i < NUM_THREADS; i++) {
+            t_args[i].locs = NULL;
+            t_args[i].num_locs = 0;
+            t_args[i].max_locs = 0;
+            t_args[i].queue = queue;
+            t_args[i].queue_len = queue_len;
+            t_args[i].next_i = &next_i;
+            t_args[i].queue_lock = &queue_lock;
+            t_args[i].boxes = boxes;
+            t_args[i].index_dirty = &index_dirty;
+            t_args[i].year0 = year0;
+            t_args[i].num_years = num_years;
+            t_args[i].fopen_lock = &fopen_lock;
+            t_args[i].warp_list = warp_list;
+            t_args[i].regions = regions;
+            t_args[i].num_regions = num_regions;
+            t_args[i].fp_build = fp_build;
+            t_args[i].readers = readers;
+        }
 
-            sprintf(FILE_NAME,"/auto/temp/lindell/soilmoisture/warp/%s_%04d_%03d.nc",region,year_i+2007,day_i*2+1);
+        // submit threads
+        for (i = 0; i < NUM_THREADS; i++) {
+            pthread_create(&thread_id[i], NULL, mthreadLoadImg, &t_args[i]);
+        }
 
-            if ((retval = nc_create(FILE_NAME, NC_NETCDF4, &ncid))){
-                ERR(retval);
-                continue;
-            }
-            /* Define the dimensions. */
-            if ((retval = nc_def_dim(ncid, "row", num_rows, &row_dimid))) {
-                ERR(retval);
-                continue;
+        // join threads
+        for (i = 0; i < NUM_THREADS; i++) {
+            pthread_join(thread_id[i], NULL);
+        }
+        for (reg = 0; reg < num_regions; reg++) {
+            warp_pix_table *pix_table = &regions[reg].pix_table;
+            if (pix_table->dirty) {
+                printf("Saving the grid point pixels to %s\n", regions[reg].pix_fname);
+                if (warp_pix_write(pix_table, regions[reg].pix_fname))
+                    printf("ERROR, could not save %s!\n", regions[reg].pix_fname);
+                pix_table->dirty = 0;
             }
-            if ((retval = nc_def_dim(ncid, "column", num_columns, &col_dimid))){
-                ERR(retval);
+        }
+        for (reg = 0; reg < num_regions; reg++) {
+            warp_region *region = &regions[reg];
+            if (!region->footprint || region->fp_ready)
                 continue;
+            printf("Building the footprint weights of %s from %zu grid points\n",
+                    region->name, region->num_fp_points);
+            if (warp_fp_build(&region->fp, region->fp_points, region->num_fp_points)) {
+                fprintf(stderr, "Memory Error!\n");
+                exit(-1);
             }
+            free(region->fp_points);
+            region->fp_points = NULL;
+            printf("Saving the footprint weights to %s\n", region->fp_fname);
+            if (warp_fp_write(&region->fp, region->fp_fname))
+                printf("ERROR, could not save %s!\n", region->fp_fname);
+            for (i = 0; i < (size_t)region->fp.head.num_cols; i++)
+                region->fp_near[region->fp.col_gpi[i]] = 1;
+            region->fp_ready = 1;
+        }
+        if (index_dirty) {
+            printf("Saving the WARP file index to %s\n", index_fname);
+            if (warp_index_write(index_fname, warp_list, list_len, boxes))
+                printf("ERROR, could not save %s!\n", index_fname);
+            index_dirty = 0;
+        }
 
-            /* Define the netCDF variables. The dimids array is used to pass
-               the dimids of the dimensions of the variables.*/
-            dimids[0] = row_dimid;
-            dimids[1] = col_dimid;
-
-            /* define the variable */
-            if ((retval = nc_def_var(ncid, "sm", NC_FLOAT, NDIMS, dimids, &varid)))
-                ERR(retval);
-
-            /* End define mode. */
-            if ((retval = nc_enddef(ncid)))
-                ERR(retval);
-
-            /* Write the data. */
-            if ((retval = nc_put_var_float(ncid, varid, &tmp_arr[0][0])))
-                ERR(retval);
-
-            /* Close the file. */
-            if ((retval = nc_close(ncid)))
-                ERR(retval);
+        // the sums of all the threads, then one region after the other
+        size_t num_locs = 0;
+        for (i = 0; i < NUM_THREADS; i++)
+            num_locs += t_args[i].num_locs;
+        loc_acc **locs = malloc(sizeof(loc_acc*)*(num_locs+1));
+        if (!locs) {
+            fprintf(stderr, "Memory Error!\n");
+            exit(-1);
+        }
+        num_locs = 0;
+        for (i = 0; i < NUM_THREADS; i++) {
+            for (j = 0; j < t_args[i].num_locs; j++)
+                locs[num_locs++] = t_args[i].locs[j];
+            free(t_args[i].locs);
+        }
 
-            // clear the tmp array
-            memset(tmp_arr[0],0,num_rows*num_columns*sizeof(float));
+        // daily bins to prefix sums, for the sums over the windows
+        prefix_args p_args[NUM_THREADS];
+        for (i = 0; i < NUM_THREADS; i++) {
+            p_args[i].locs = locs;
+            p_args[i].num_years = num_years;
+            p_args[i].start_i = num_locs * i / NUM_THREADS;
+            p_args[i].stop_i = num_locs * (i+1) / NUM_THREADS;
+            pthread_create(&thread_id[i], NULL, mthreadPrefix, &p_args[i]);
+        }
+        for (i = 0; i < NUM_THREADS; i++)
+            pthread_join(thread_id[i], NULL);
+
+        printf("Done processing, preparing to save files\n");
+        for (reg = 0; reg < num_regions; reg++) {
+            j = (size_t)reg*num_windows;
+            if (regions[reg].footprint)
+                write_region_fp(&regions[reg], locs, num_locs, year0, num_years, windows,
+                        num_windows, &writer[j], &slot[j], &empty_fid[j], arguments.zarr);
+            else
+                write_region(&regions[reg], reg, locs, num_locs, year0, num_years, windows,
+                        num_windows, &writer[j], &slot[j], &empty_fid[j], arguments.zarr);
+        }
+        for (i = 0; i < num_locs; i++)
+            free(locs[i]);
+        free(locs);
+
+        // every point of the files read is in the tables now
+        if (arguments.memory > 0 && !complete) {
+            block_years = fit_years(regions, num_regions, windows, num_windows, 1,
+                    arguments.memory*1e9 - slot_bytes);
+            complete = 1;
         }
     }
+    if (reader_pool_finish(readers))
+        printf("ERROR, a reader failed!\n");
+    free(queue);
+    free(boxes);
+
+    printf("Waiting for the writers...\n");
+    int failed = 0;
+    for (i = 0; i < (size_t)num_products; i++) {
+        fclose(empty_fid[i]);
+        if (day_writer_finish(writer[i])) {
+            printf("ERROR, not all of the daily files of %s were written!\n", w_ctx[i].name);
+            failed = 1;
+        }
+    }
+    if (failed)
+        exit(2);
 
-    free(tmp_arr[0]);
-    free(tmp_arr);
-
-    // Free memory for 3D image timeseries array
     printf("Finishing up...");
-    free(storage[0][0][0]);
-    free(storage[0][0]);
-    free(storage[0]);
-    free(storage);
-
-    free(count[0][0][0]);
-    free(count[0][0]);
-    free(count[0]);
-    free(count);
+    for (reg = 0; reg < num_regions; reg++) {
+        warp_pix_free(&regions[reg].pix_table);
+        if (regions[reg].footprint) {
+            warp_fp_free(&regions[reg].fp);
+            munmap(regions[reg].fp_near, WARP_MAX_GPI);
+        }
+    }
+    free(regions);
 
     for (i = 0; i < list_len; i++)
         free((void*)warp_list[i]);
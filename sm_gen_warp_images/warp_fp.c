@@ -0,0 +1,233 @@
+/*
+ * warp_fp.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Footprint weights of the WARP grid points. Instead of dropping each
+ *  grid point into the one pixel it falls in, a point is spread over the
+ *  pixels around it with a Gaussian weight, exp(-d^2 / 2 sigma^2) with d
+ *  the distance from the point to the pixel center, out to 3 sigma. The
+ *  weights only depend on the grid and the projection of the region, so
+ *  they are worked out once into a CSR matrix (a row per pixel, a column
+ *  per grid point) and saved, and every day of the images is then one
+ *  sparse matrix vector product. The file is the header, with the region
+ *  size, the projection of the SIR head and sigma, followed by the arrays
+ *  of the matrix. Weights made for something else don't match and are
+ *  made again.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "warp_fp.h"
+
+/* Pixels out from a grid point that still get a weight */
+float warp_fp_radius(float sigma) {
+    return 3*sigma;
+}
+
+/* An empty matrix for the region */
+void warp_fp_init(warp_fp_matrix *m, int num_rows, int num_columns, float sigma, const sir_head *head) {
+    memset(m, 0, sizeof(warp_fp_matrix));
+    memcpy(m->head.magic, WARP_FP_MAGIC, sizeof(m->head.magic));
+    m->head.num_rows = num_rows;
+    m->head.num_columns = num_columns;
+    m->head.sigma = sigma;
+    m->head.nsx = head->nsx;
+    m->head.nsy = head->nsy;
+    m->head.iopt = head->iopt;
+    m->head.xdeg = head->xdeg;
+    m->head.ydeg = head->ydeg;
+    m->head.ascale = head->ascale;
+    m->head.bscale = head->bscale;
+    m->head.a0 = head->a0;
+    m->head.b0 = head->b0;
+    return;
+}
+
+void warp_fp_free(warp_fp_matrix *m) {
+    free(m->row_start);
+    free(m->col);
+    free(m->weight);
+    free(m->col_gpi);
+    m->row_start = NULL;
+    m->col = NULL;
+    m->weight = NULL;
+    m->col_gpi = NULL;
+    return;
+}
+
+/* Could a point at x, y (pixels) get a weight in the image? */
+int warp_fp_near(const warp_fp_matrix *m, float x, float y) {
+    float radius = warp_fp_radius(m->head.sigma);
+
+    return x >= 0.5f - radius && x <= m->head.num_columns - 0.5f + radius &&
+            y >= 0.5f - radius && y <= m->head.num_rows - 0.5f + radius;
+}
+
+static int cmp_point(const void *a, const void *b) {
+    const warp_fp_point *x = (const warp_fp_point*)a;
+    const warp_fp_point *y = (const warp_fp_point*)b;
+
+    return x->gpi < y->gpi ? -1 : (x->gpi > y->gpi);
+}
+
+/* The pixels around a point that get a weight, clipped to the image */
+static void point_range(const warp_fp_matrix *m, const warp_fp_point *p, float radius,
+        int *x0, int *x1, int *y0, int *y1) {
+    *x0 = (int)ceilf(p->x - 0.5f - radius);
+    *x1 = (int)floorf(p->x - 0.5f + radius);
+    *y0 = (int)ceilf(p->y - 0.5f - radius);
+    *y1 = (int)floorf(p->y - 0.5f + radius);
+    if (*x0 < 0)
+        *x0 = 0;
+    if (*x1 > m->head.num_columns - 1)
+        *x1 = m->head.num_columns - 1;
+    if (*y0 < 0)
+        *y0 = 0;
+    if (*y1 > m->head.num_rows - 1)
+        *y1 = m->head.num_rows - 1;
+    return;
+}
+
+/* Make the matrix from the grid points near the image. The points are put
+ * in grid point order first, so the matrix is the same whatever order they
+ * were found in. Returns -1 if it doesn't fit in memory. */
+int warp_fp_build(warp_fp_matrix *m, warp_fp_point *points, size_t num_points) {
+    size_t num_pix = (size_t)m->head.num_rows*m->head.num_columns;
+    float radius = warp_fp_radius(m->head.sigma);
+    float two_sigma2 = 2*m->head.sigma*m->head.sigma;
+    int64_t *fill;
+    size_t i, n;
+    int x, y, x0, x1, y0, y1, used;
+    float dx, dy, d2;
+    int32_t num_cols = 0;
+
+    qsort(points, num_points, sizeof(warp_fp_point), cmp_point);
+    /* a grid point is only in one file, drop it if it was found twice */
+    for (i = 0, n = 0; i < num_points; i++) {
+        if (n == 0 || points[i].gpi != points[n-1].gpi)
+            points[n++] = points[i];
+    }
+    num_points = n;
+
+    warp_fp_free(m);
+    m->row_start = (int64_t*)calloc(num_pix + 1, sizeof(int64_t));
+    m->col_gpi = (int32_t*)malloc(sizeof(int32_t)*(num_points + 1));
+    if (!m->row_start || !m->col_gpi)
+        return -1;
+
+    /* count the weights of each pixel */
+    for (i = 0; i < num_points; i++) {
+        point_range(m, &points[i], radius, &x0, &x1, &y0, &y1);
+        used = 0;
+        for (y = y0; y <= y1; y++) {
+            dy = y + 0.5f - points[i].y;
+            for (x = x0; x <= x1; x++) {
+                dx = x + 0.5f - points[i].x;
+                if (dx*dx + dy*dy <= radius*radius) {
+                    m->row_start[(size_t)y*m->head.num_columns + x + 1]++;
+                    used = 1;
+                }
+            }
+        }
+        if (used)
+            m->col_gpi[num_cols++] = points[i].gpi;
+    }
+    for (i = 0; i < num_pix; i++)
+        m->row_start[i+1] += m->row_start[i];
+    m->head.num_cols = num_cols;
+    m->head.num_weights = m->row_start[num_pix];
+
+    /* and fill them in, by column within each row */
+    m->col = (int32_t*)malloc(sizeof(int32_t)*(m->head.num_weights + 1));
+    m->weight = (float*)malloc(sizeof(float)*(m->head.num_weights + 1));
+    fill = (int64_t*)malloc(sizeof(int64_t)*(num_pix + 1));
+    if (!m->col || !m->weight || !fill) {
+        free(fill);
+        return -1;
+    }
+    memcpy(fill, m->row_start, sizeof(int64_t)*num_pix);
+    num_cols = 0;
+    for (i = 0; i < num_points; i++) {
+        point_range(m, &points[i], radius, &x0, &x1, &y0, &y1);
+        used = 0;
+        for (y = y0; y <= y1; y++) {
+            dy = y + 0.5f - points[i].y;
+            for (x = x0; x <= x1; x++) {
+                dx = x + 0.5f - points[i].x;
+                d2 = dx*dx + dy*dy;
+                if (d2 <= radius*radius) {
+                    size_t pix = (size_t)y*m->head.num_columns + x;
+                    m->col[fill[pix]] = num_cols;
+                    m->weight[fill[pix]++] = expf(-d2 / two_sigma2);
+                    used = 1;
+                }
+            }
+        }
+        if (used)
+            num_cols++;
+    }
+    free(fill);
+    return 0;
+}
+
+/* Read a saved matrix, if it was made for the same region, projection and
+ * sigma */
+int warp_fp_read(warp_fp_matrix *m, const char *fname) {
+    size_t num_pix = (size_t)m->head.num_rows*m->head.num_columns;
+    warp_fp_header head;
+    FILE *fid = fopen(fname, "rb");
+
+    if (!fid)
+        return -1;
+    if (fread(&head, sizeof(head), 1, fid) != 1 ||
+            memcmp(&head, &m->head, offsetof(warp_fp_header, num_cols)) != 0) {
+        fclose(fid);
+        return -1;
+    }
+    warp_fp_free(m);
+    m->head = head;
+    m->row_start = (int64_t*)malloc(sizeof(int64_t)*(num_pix + 1));
+    m->col = (int32_t*)malloc(sizeof(int32_t)*(head.num_weights + 1));
+    m->weight = (float*)malloc(sizeof(float)*(head.num_weights + 1));
+    m->col_gpi = (int32_t*)malloc(sizeof(int32_t)*(head.num_cols + 1));
+    if (!m->row_start || !m->col || !m->weight || !m->col_gpi ||
+            fread(m->row_start, sizeof(int64_t), num_pix + 1, fid) != num_pix + 1 ||
+            fread(m->col, sizeof(int32_t), head.num_weights, fid) != (size_t)head.num_weights ||
+            fread(m->weight, sizeof(float), head.num_weights, fid) != (size_t)head.num_weights ||
+            fread(m->col_gpi, sizeof(int32_t), head.num_cols, fid) != (size_t)head.num_cols) {
+        fclose(fid);
+        warp_fp_free(m);
+        return -1;
+    }
+    fclose(fid);
+    return 0;
+}
+
+/* Written to a temporary file first so an interrupted run never leaves a
+ * half written matrix behind */
+int warp_fp_write(const warp_fp_matrix *m, const char *fname) {
+    size_t num_pix = (size_t)m->head.num_rows*m->head.num_columns;
+    char tmp_fname[300];
+    FILE *fid;
+
+    snprintf(tmp_fname, sizeof(tmp_fname), "%s.tmp", fname);
+    fid = fopen(tmp_fname, "wb");
+    if (!fid)
+        return -1;
+    if (fwrite(&m->head, sizeof(m->head), 1, fid) != 1 ||
+            fwrite(m->row_start, sizeof(int64_t), num_pix + 1, fid) != num_pix + 1 ||
+            fwrite(m->col, sizeof(int32_t), m->head.num_weights, fid) != (size_t)m->head.num_weights ||
+            fwrite(m->weight, sizeof(float), m->head.num_weights, fid) != (size_t)m->head.num_weights ||
+            fwrite(m->col_gpi, sizeof(int32_t), m->head.num_cols, fid) != (size_t)m->head.num_cols) {
+        fclose(fid);
+        return -1;
+    }
+    if (fclose(fid))
+        return -1;
+    return rename(tmp_fname, fname);
+}
@@ -0,0 +1,63 @@
+/*
+ * warp_fp.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef WARP_FP_H_
+#define WARP_FP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sir_ez.h>
+
+#define WARP_FP_MAGIC "WARPFP01"
+
+/* The region, projection and footprint the weights were made for */
+typedef struct {
+    char magic[8];
+    int32_t num_rows;
+    int32_t num_columns;
+    float sigma;
+    int32_t nsx;
+    int32_t nsy;
+    int32_t iopt;
+    float xdeg;
+    float ydeg;
+    float ascale;
+    float bscale;
+    float a0;
+    float b0;
+    int32_t num_cols;       /* grid points with a weight */
+    int64_t num_weights;
+} warp_fp_header;
+
+/* A grid point and where it falls in the image, in pixels */
+typedef struct {
+    int32_t gpi;
+    float x;
+    float y;
+} warp_fp_point;
+
+/* Footprint weights of the grid points in each image pixel, a CSR matrix
+ * with one row per pixel (row*num_columns + column) and one column per
+ * grid point, the columns in grid point order */
+typedef struct {
+    warp_fp_header head;
+    int64_t *row_start;     /* [num_rows*num_columns + 1] */
+    int32_t *col;           /* [num_weights] */
+    float *weight;          /* [num_weights] */
+    int32_t *col_gpi;       /* [num_cols] */
+} warp_fp_matrix;
+
+float warp_fp_radius(float sigma);
+void warp_fp_init(warp_fp_matrix *m, int num_rows, int num_columns, float sigma, const sir_head *head);
+void warp_fp_free(warp_fp_matrix *m);
+int warp_fp_near(const warp_fp_matrix *m, float x, float y);
+int warp_fp_build(warp_fp_matrix *m, warp_fp_point *points, size_t num_points);
+int warp_fp_read(warp_fp_matrix *m, const char *fname);
+int warp_fp_write(const warp_fp_matrix *m, const char *fname);
+
+#endif /* WARP_FP_H_ */
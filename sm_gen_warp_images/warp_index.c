@@ -0,0 +1,136 @@
+/*
+ * warp_index.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Spatial index of the WARP cell files: the lat/lon bounding box of the
+ *  grid points in each file. Most of the cells are nowhere near a region,
+ *  so with the index they are left out without being opened. The index is
+ *  the same for every region and is kept as a text file, one line per
+ *  file: "lat_min lat_max lon_min lon_max filename". Files that aren't in
+ *  it yet are read and added by the next run.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "warp_index.h"
+
+/* points along each side of a box projected to find its footprint */
+#define BBOX_SAMPLES 9
+
+/* pixels added around the footprint, grid points inside the box can be a
+ * little outside the footprint of the samples */
+#define BBOX_MARGIN 2
+
+/* Fill in the boxes of the files in the index, the others are left
+ * unknown. Returns -1 if there is no index. */
+int warp_index_read(const char *fname, char **warp_list, size_t list_len, warp_bbox *boxes) {
+    FILE *fid = fopen(fname, "r");
+    char line[400], name[300];
+    warp_bbox box;
+    size_t i, guess = 0;
+
+    for (i = 0; i < list_len; i++)
+        boxes[i].known = 0;
+    if (!fid)
+        return -1;
+
+    while (fgets(line, sizeof(line), fid) != NULL) {
+        if (line[0] == '#' || sscanf(line, "%f %f %f %f %299s", &box.lat_min, &box.lat_max,
+                &box.lon_min, &box.lon_max, name) != 5)
+            continue;
+        box.known = 1;
+        /* the index is usually in list order */
+        if (guess < list_len && strcmp(warp_list[guess], name) == 0) {
+            boxes[guess++] = box;
+            continue;
+        }
+        for (i = 0; i < list_len; i++) {
+            if (strcmp(warp_list[i], name) == 0) {
+                boxes[i] = box;
+                guess = i + 1;
+                break;
+            }
+        }
+    }
+    fclose(fid);
+    return 0;
+}
+
+/* Written to a temporary file first so an interrupted run never leaves a
+ * half written index behind */
+int warp_index_write(const char *fname, char **warp_list, size_t list_len, const warp_bbox *boxes) {
+    char tmp_fname[300];
+    FILE *fid;
+    size_t i;
+
+    snprintf(tmp_fname, sizeof(tmp_fname), "%s.tmp", fname);
+    fid = fopen(tmp_fname, "w");
+    if (!fid)
+        return -1;
+    fprintf(fid, "# lat_min lat_max lon_min lon_max file\n");
+    for (i = 0; i < list_len; i++) {
+        if (!boxes[i].known)
+            continue;
+        fprintf(fid, "%.4f %.4f %.4f %.4f %s\n", boxes[i].lat_min, boxes[i].lat_max,
+                boxes[i].lon_min, boxes[i].lon_max, warp_list[i]);
+    }
+    if (fclose(fid))
+        return -1;
+    return rename(tmp_fname, fname);
+}
+
+/* Bounding box of n grid points, empty (min > max) without any */
+void warp_bbox_of(const double *lon, const double *lat, size_t n, warp_bbox *box) {
+    size_t i;
+
+    box->lat_min = box->lon_min = 1000;
+    box->lat_max = box->lon_max = -1000;
+    for (i = 0; i < n; i++) {
+        if (lat[i] < box->lat_min)
+            box->lat_min = lat[i];
+        if (lat[i] > box->lat_max)
+            box->lat_max = lat[i];
+        if (lon[i] < box->lon_min)
+            box->lon_min = lon[i];
+        if (lon[i] > box->lon_max)
+            box->lon_max = lon[i];
+    }
+    box->known = 1;
+    return;
+}
+
+/* Could any point in the box be in the image, or within margin pixels of
+ * it? The box is sampled along and across and projected, and the pixel
+ * bounding box of the samples is compared with the image. Boxes near the
+ * edge are kept. */
+int warp_bbox_overlaps(const warp_bbox *box, int num_rows, int num_columns, int margin,
+        sir_head *head) {
+    float x, y, lat, lon;
+    float x_min = INFINITY, x_max = -INFINITY, y_min = INFINITY, y_max = -INFINITY;
+    int i, j;
+
+    if (box->lat_min > box->lat_max)
+        return 0;
+
+    for (i = 0; i < BBOX_SAMPLES; i++) {
+        lat = box->lat_min + (box->lat_max - box->lat_min) * i / (BBOX_SAMPLES - 1);
+        for (j = 0; j < BBOX_SAMPLES; j++) {
+            lon = box->lon_min + (box->lon_max - box->lon_min) * j / (BBOX_SAMPLES - 1);
+            sir_latlon2pix(lon, lat, &x, &y, head);
+            if (!isfinite(x) || !isfinite(y))
+                continue;
+            x_min = x < x_min ? x : x_min;
+            x_max = x > x_max ? x : x_max;
+            y_min = y < y_min ? y : y_min;
+            y_max = y > y_max ? y : y_max;
+        }
+    }
+    margin += BBOX_MARGIN;
+    return x_max >= -margin && x_min < num_columns + margin &&
+            y_max >= -margin && y_min < num_rows + margin;
+}
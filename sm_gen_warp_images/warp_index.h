@@ -0,0 +1,30 @@
+/*
+ * warp_index.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef WARP_INDEX_H_
+#define WARP_INDEX_H_
+
+#include <stddef.h>
+
+#include <sir_ez.h>
+
+/* lat/lon bounding box of the grid points of one WARP cell file */
+typedef struct {
+    float lat_min;
+    float lat_max;
+    float lon_min;
+    float lon_max;
+    int known;          /* in the index, or worked out from the file */
+} warp_bbox;
+
+int warp_index_read(const char *fname, char **warp_list, size_t list_len, warp_bbox *boxes);
+int warp_index_write(const char *fname, char **warp_list, size_t list_len, const warp_bbox *boxes);
+void warp_bbox_of(const double *lon, const double *lat, size_t n, warp_bbox *box);
+int warp_bbox_overlaps(const warp_bbox *box, int num_rows, int num_columns, int margin,
+        sir_head *head);
+
+#endif /* WARP_INDEX_H_ */
@@ -0,0 +1,115 @@
+/*
+ * warp_pix.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Lookup table from WARP grid point id (location_id in the cell files)
+ *  to the pixel of the region image it falls in. The WARP grid and the
+ *  SIR projection of a region never change, so the points only have to
+ *  be projected once: the first run fills the table as the threads go
+ *  through the cell files and saves it, and later runs look the pixels
+ *  up instead. The file is the header, with the region size and the
+ *  projection of the SIR head, followed by one int32 per grid point. A
+ *  table made for another projection doesn't match and is made again.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "warp_pix.h"
+
+/* An empty table for the region, every point still unknown. It is kept in
+ * shared memory so the reader processes see the points added to it. */
+int warp_pix_init(warp_pix_table *t, int num_rows, int num_columns, const sir_head *head) {
+    size_t i;
+
+    memset(&t->head, 0, sizeof(t->head));
+    memcpy(t->head.magic, WARP_PIX_MAGIC, sizeof(t->head.magic));
+    t->head.num_rows = num_rows;
+    t->head.num_columns = num_columns;
+    t->head.num_gpi = WARP_MAX_GPI;
+    t->head.nsx = head->nsx;
+    t->head.nsy = head->nsy;
+    t->head.iopt = head->iopt;
+    t->head.xdeg = head->xdeg;
+    t->head.ydeg = head->ydeg;
+    t->head.ascale = head->ascale;
+    t->head.bscale = head->bscale;
+    t->head.a0 = head->a0;
+    t->head.b0 = head->b0;
+    t->dirty = 0;
+
+    t->map_len = sizeof(int32_t)*WARP_MAX_GPI;
+    t->pix = (int32_t*)mmap(NULL, t->map_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (t->pix == MAP_FAILED) {
+        t->pix = NULL;
+        return -1;
+    }
+    for (i = 0; i < WARP_MAX_GPI; i++)
+        t->pix[i] = WARP_PIX_UNKNOWN;
+    return 0;
+}
+
+void warp_pix_free(warp_pix_table *t) {
+    if (t->pix)
+        munmap(t->pix, t->map_len);
+    t->pix = NULL;
+    return;
+}
+
+/* Fill the table from a saved one, if it was made for the same region
+ * and projection */
+int warp_pix_read(warp_pix_table *t, const char *fname) {
+    warp_pix_header head;
+    FILE *fid = fopen(fname, "rb");
+
+    if (!fid)
+        return -1;
+    if (fread(&head, sizeof(head), 1, fid) != 1 ||
+            memcmp(&head, &t->head, sizeof(head)) != 0 ||
+            fread(t->pix, sizeof(int32_t), head.num_gpi, fid) != (size_t)head.num_gpi) {
+        fclose(fid);
+        return -1;
+    }
+    fclose(fid);
+    t->dirty = 0;
+    return 0;
+}
+
+/* Written to a temporary file first so an interrupted run never leaves a
+ * half written table behind */
+int warp_pix_write(const warp_pix_table *t, const char *fname) {
+    char tmp_fname[300];
+    FILE *fid;
+
+    snprintf(tmp_fname, sizeof(tmp_fname), "%s.tmp", fname);
+    fid = fopen(tmp_fname, "wb");
+    if (!fid)
+        return -1;
+    if (fwrite(&t->head, sizeof(t->head), 1, fid) != 1 ||
+            fwrite(t->pix, sizeof(int32_t), t->head.num_gpi, fid) != (size_t)t->head.num_gpi) {
+        fclose(fid);
+        return -1;
+    }
+    if (fclose(fid))
+        return -1;
+    return rename(tmp_fname, fname);
+}
+
+/* The pixel a point falls in, or WARP_PIX_OUTSIDE */
+int32_t warp_pix_project(double lon, double lat, int num_rows, int num_columns, sir_head *head) {
+    float x, y;
+    int x_int, y_int;
+
+    sir_latlon2pix(lon, lat, &x, &y, head);
+    x_int = (int)x;
+    y_int = (int)y;
+    if (x_int < num_columns && x_int >= 0 && y_int < num_rows && y_int >= 0)
+        return y_int*num_columns + x_int;
+    return WARP_PIX_OUTSIDE;
+}
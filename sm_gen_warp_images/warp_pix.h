@@ -0,0 +1,56 @@
+/*
+ * warp_pix.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef WARP_PIX_H_
+#define WARP_PIX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sir_ez.h>
+
+#define WARP_PIX_MAGIC "WARPPIX1"
+
+/* WARP grid point ids go up to about 3.3 million */
+#define WARP_MAX_GPI (4*1024*1024)
+
+/* table entries that aren't a pixel */
+#define WARP_PIX_OUTSIDE -1         /* not in the region */
+#define WARP_PIX_UNKNOWN -2         /* not projected yet */
+
+/* The region and projection the table was made for */
+typedef struct {
+    char magic[8];
+    int32_t num_rows;
+    int32_t num_columns;
+    int32_t num_gpi;
+    int32_t nsx;
+    int32_t nsy;
+    int32_t iopt;
+    float xdeg;
+    float ydeg;
+    float ascale;
+    float bscale;
+    float a0;
+    float b0;
+} warp_pix_header;
+
+/* Image pixel (row*num_columns + column) of every WARP grid point */
+typedef struct {
+    warp_pix_header head;
+    int32_t *pix;                   /* [num_gpi], in shared memory */
+    size_t map_len;
+    int dirty;                      /* entries were added since it was read */
+} warp_pix_table;
+
+int warp_pix_init(warp_pix_table *t, int num_rows, int num_columns, const sir_head *head);
+void warp_pix_free(warp_pix_table *t);
+int warp_pix_read(warp_pix_table *t, const char *fname);
+int warp_pix_write(const warp_pix_table *t, const char *fname);
+int32_t warp_pix_project(double lon, double lat, int num_rows, int num_columns, sir_head *head);
+
+#endif /* WARP_PIX_H_ */
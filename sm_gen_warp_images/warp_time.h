@@ -0,0 +1,32 @@
+/*
+ * warp_time.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ */
+
+#ifndef WARP_TIME_H_
+#define WARP_TIME_H_
+
+/* Year and day of year (0 based, like tm_yday) of a WARP time, days since
+ * 1900-01-01 00:00:00. The time is cut to whole seconds since 1970 the
+ * same way as for gmtime_r, and the date is worked out from the day number
+ * with the civil from days algorithm (H. Hinnant), which counts years from
+ * March so the leap day is the last day of the year. check_warp_time
+ * compares it with gmtime_r for every second of 2007-2030. */
+static inline void warp_time_to_day(double time, int *year, int *yday) {
+    long long secs = (long long)(time * 86400 - 2208988800);
+    long long days = secs / 86400 + 719468;     /* days since 0000-03-01 */
+    int era = (int)(days / 146097);
+    int doe = (int)(days - (long long)era * 146097);
+    int yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+    int y = yoe + era * 400;
+    int doy = doe - (365*yoe + yoe/4 - yoe/100);  /* from March 1 */
+    int jan_feb = doy >= 306;
+    int leap = y % 4 == 0 && (y % 100 != 0 || y % 400 == 0);
+
+    *year = y + jan_feb;
+    *yday = jan_feb ? doy - 306 : doy + 59 + leap;
+}
+
+#endif /* WARP_TIME_H_ */
@@ -0,0 +1,466 @@
+/*
+ * merge_shards.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Assembles the row shard files written by the --rows option of
+ *  sm_gen_time_series, sm_gen_c0 and sm_gen_img back into the full files.
+ *  A shard of <base>.nc is named <base>.rSSSS-EEEE.nc and every variable
+ *  that has the row dimension first is copied into the output at the shard's
+ *  row offset. The output files are split between forked worker processes,
+ *  since the netCDF library can only be used from one thread per process.
+ */
+
+#include <stdlib.h>
+#include <argp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <netcdf.h>
+
+#define MAX_FILES 100000
+
+/* rows copied per hyperslab, keeps a ts shard from being read in one go */
+#define COPY_ROWS 16
+
+/* Handle errors by printing an error message and exiting with a
+ * non-zero status. */
+#define ERR(e) {printf("Error: %s\n", nc_strerror(e)); exit(2);}
+
+/* Program documentation. */
+static char doc[] =
+  "sm_merge_shards.c-- Program to merge row shard files into whole files\n\
+ Every <base>.rSSSS-EEEE.nc file in the directories is merged into <base>.nc";
+
+/* A description of the arguments we accept. */
+static char args_doc[] = "DIR [DIR...]";
+
+/* The options we understand. */
+static struct argp_option options[] = {
+  {"verbose",  'v', 0,      0,  "Produce verbose output" },
+  {"jobs",  'j', "N",      0,  "Number of merge processes (default 8)" },
+  {"prefix",  'p', "PREFIX", 0,  "Only merge files whose name starts with PREFIX" },
+  {"remove",  'x', 0,      0,  "Remove the shard files after a successful merge" },
+  { 0 }
+};
+
+/* Used by main to communicate with parse_opt. */
+struct arguments
+{
+  char **dirs;
+  int num_dirs;
+  int verbose;
+  int jobs;
+  char *prefix;
+  int remove;
+};
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  /* Get the input argument from argp_parse, which we
+     know is a pointer to our arguments structure. */
+  struct arguments *arguments = state->input;
+
+  switch (key)
+    {
+    case 'v':
+      arguments->verbose = 1;
+      break;
+    case 'j':
+      arguments->jobs = atoi(arg);
+      if (arguments->jobs < 1)
+          argp_failure(state, 1, 0, "ERROR, need at least one merge process!");
+      break;
+    case 'p':
+      arguments->prefix = arg;
+      break;
+    case 'x':
+      arguments->remove = 1;
+      break;
+    case ARGP_KEY_ARG:
+      arguments->dirs = &state->argv[state->next - 1];
+      arguments->num_dirs = state->argc - state->next + 1;
+      state->next = state->argc;
+      break;
+
+    case ARGP_KEY_END:
+      if (state->arg_num < 1) {
+        /* Not enough arguments. */
+        argp_usage (state);
+      }
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+/* Our argp parser. */
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+typedef struct {
+    char *dir;
+    char base[256];     /* file name without the .rSSSS-EEEE.nc */
+    int row_start;
+    int row_end;
+} shard;
+
+/* Split a shard file name into its base name and row range.
+ * Returns 0 if fname is a shard file. */
+int parse_shard_name(const char *fname, shard *s) {
+    const char *r = strrchr(fname, '.');
+    int n = 0;
+
+    /* back up from the ".nc" to the ".r" */
+    if (!r || strcmp(r, ".nc") != 0)
+        return -1;
+    for (r = r - 1; r > fname && *r != '.'; r--);
+    if (r == fname || r[1] != 'r' || (size_t)(r - fname) >= sizeof(s->base))
+        return -1;
+    if (sscanf(r, ".r%d-%d.nc%n", &s->row_start, &s->row_end, &n) != 2 || r[n] != '\0')
+        return -1;
+    if (s->row_start < 1 || s->row_end < s->row_start)
+        return -1;
+    memcpy(s->base, fname, r - fname);
+    s->base[r - fname] = '\0';
+    return 0;
+}
+
+int compare_shards(const void *a, const void *b) {
+    const shard *sa = (const shard*)a;
+    const shard *sb = (const shard*)b;
+    int c = strcmp(sa->dir, sb->dir);
+
+    if (c == 0)
+        c = strcmp(sa->base, sb->base);
+    if (c == 0)
+        c = sa->row_start - sb->row_start;
+    return c;
+}
+
+/* Copy every variable of one shard into the merged file */
+void copy_shard(int in_ncid, int out_ncid, int row_dimid, int first, int row_offset) {
+    char name[NC_MAX_NAME+1];
+    int dimids[NC_MAX_VAR_DIMS];
+    int ndims, nvars, natts, out_varid;
+    size_t start[NC_MAX_VAR_DIMS], count[NC_MAX_VAR_DIMS];
+    size_t type_size, slab_len, num_rows, row;
+    nc_type type;
+    void *buf;
+    int retval, varid, d, offset;
+
+    if ((retval = nc_inq(in_ncid, NULL, &nvars, NULL, NULL)))
+        ERR(retval);
+
+    for (varid = 0; varid < nvars; varid++) {
+        if ((retval = nc_inq_var(in_ncid, varid, name, &type, &ndims, dimids, &natts)))
+            ERR(retval);
+        if ((retval = nc_inq_varid(out_ncid, name, &out_varid)))
+            ERR(retval);
+
+        /* variables without rows are the same in every shard */
+        offset = row_offset;
+        if (ndims == 0 || dimids[0] != row_dimid) {
+            if (!first)
+                continue;
+            offset = 0;
+        }
+
+        if ((retval = nc_inq_type(in_ncid, type, NULL, &type_size)))
+            ERR(retval);
+        slab_len = type_size;
+        for (d = 0; d < ndims; d++) {
+            if ((retval = nc_inq_dim(in_ncid, dimids[d], NULL, &count[d])))
+                ERR(retval);
+            start[d] = 0;
+            if (d > 0)
+                slab_len *= count[d];
+        }
+        num_rows = ndims > 0 ? count[0] : 1;
+
+        buf = malloc(slab_len * (num_rows < COPY_ROWS ? num_rows : COPY_ROWS));
+        if (!buf) {
+            fprintf(stderr, "Memory Error!\n");
+            exit(-1);
+        }
+        for (row = 0; row < num_rows; row += COPY_ROWS) {
+            if (ndims > 0) {
+                start[0] = row;
+                count[0] = num_rows - row < COPY_ROWS ? num_rows - row : COPY_ROWS;
+            }
+            if ((retval = nc_get_vara(in_ncid, varid, start, count, buf)))
+                ERR(retval);
+            if (ndims > 0)
+                start[0] = row + offset;
+            if ((retval = nc_put_vara(out_ncid, out_varid, start, count, buf)))
+                ERR(retval);
+        }
+        free(buf);
+    }
+    return;
+}
+
+/* Define the merged file with the dimensions, variables and attributes of
+ * the first shard, the row dimension grown to the whole image */
+void define_merged(int in_ncid, int out_ncid, int total_rows, int *row_dimid) {
+    char name[NC_MAX_NAME+1];
+    int dimids[NC_MAX_VAR_DIMS];
+    int ndims, nvars, ngatts, natts, out_id, storage;
+    int shuffle, deflate, level;
+    size_t len, chunks[NC_MAX_VAR_DIMS];
+    nc_type type;
+    int retval, i, j;
+
+    if ((retval = nc_inq(in_ncid, &ndims, &nvars, &ngatts, NULL)))
+        ERR(retval);
+
+    *row_dimid = -1;
+    for (i = 0; i < ndims; i++) {
+        if ((retval = nc_inq_dim(in_ncid, i, name, &len)))
+            ERR(retval);
+        if (strcmp(name, "row") == 0) {
+            *row_dimid = i;
+            len = total_rows;
+        }
+        if ((retval = nc_def_dim(out_ncid, name, len, &out_id)))
+            ERR(retval);
+    }
+
+    for (i = 0; i < ngatts; i++) {
+        if ((retval = nc_inq_attname(in_ncid, NC_GLOBAL, i, name)))
+            ERR(retval);
+        if (strncmp(name, "shard_", 6) == 0)
+            continue;
+        if ((retval = nc_copy_att(in_ncid, NC_GLOBAL, name, out_ncid, NC_GLOBAL)))
+            ERR(retval);
+    }
+
+    for (i = 0; i < nvars; i++) {
+        if ((retval = nc_inq_var(in_ncid, i, name, &type, &ndims, dimids, &natts)))
+            ERR(retval);
+        for (j = 1; j < ndims; j++) {
+            if (dimids[j] == *row_dimid) {
+                fprintf(stderr, "*** variable %s has rows that are not the first dimension\n", name);
+                exit(-1);
+            }
+        }
+        if ((retval = nc_def_var(out_ncid, name, type, ndims, dimids, &out_id)))
+            ERR(retval);
+        /* keep the chunk layout and compression, the yearly image cubes
+         * depend on the chunks */
+        if (ndims > 0) {
+            if ((retval = nc_inq_var_chunking(in_ncid, i, &storage, chunks)))
+                ERR(retval);
+            if (storage == NC_CHUNKED &&
+                    (retval = nc_def_var_chunking(out_ncid, out_id, NC_CHUNKED, chunks)))
+                ERR(retval);
+            if ((retval = nc_inq_var_deflate(in_ncid, i, &shuffle, &deflate, &level)))
+                ERR(retval);
+            if (deflate &&
+                    (retval = nc_def_var_deflate(out_ncid, out_id, shuffle, deflate, level)))
+                ERR(retval);
+        }
+        for (j = 0; j < natts; j++) {
+            char att_name[NC_MAX_NAME+1];
+            if ((retval = nc_inq_attname(in_ncid, i, j, att_name)))
+                ERR(retval);
+            if ((retval = nc_copy_att(in_ncid, i, att_name, out_ncid, out_id)))
+                ERR(retval);
+        }
+    }
+
+    if ((retval = nc_enddef(out_ncid)))
+        ERR(retval);
+    return;
+}
+
+/* Merge the shards of one file, which are sorted by row.
+ * Returns 0 on success. */
+int merge_file(shard *shards, int num_shards, int verbose, int remove_shards) {
+    char fname[600], out_fname[600], tmp_fname[610];
+    int in_ncid, out_ncid, row_dimid;
+    int total_rows, shard_total, i, retval;
+
+    /* the shards have to cover every row exactly once */
+    sprintf(fname, "%s/%s.r%04d-%04d.nc", shards[0].dir, shards[0].base,
+            shards[0].row_start, shards[0].row_end);
+    if ((retval = nc_open(fname, NC_NOWRITE, &in_ncid)))
+        ERR(retval);
+    if ((retval = nc_get_att_int(in_ncid, NC_GLOBAL, "shard_total_rows", &total_rows)))
+        ERR(retval);
+    if ((retval = nc_close(in_ncid)))
+        ERR(retval);
+
+    if (shards[0].row_start != 1 || shards[num_shards-1].row_end != total_rows) {
+        fprintf(stderr, "*** %s/%s: shards cover rows %d-%d of %d, skipping\n",
+                shards[0].dir, shards[0].base, shards[0].row_start,
+                shards[num_shards-1].row_end, total_rows);
+        return -1;
+    }
+    for (i = 1; i < num_shards; i++) {
+        if (shards[i].row_start != shards[i-1].row_end + 1) {
+            fprintf(stderr, "*** %s/%s: rows %d-%d overlap or leave a gap, skipping\n",
+                    shards[i].dir, shards[i].base, shards[i].row_start, shards[i].row_end);
+            return -1;
+        }
+    }
+
+    /* written to a temporary name so a partial merge never looks finished */
+    sprintf(out_fname, "%s/%s.nc", shards[0].dir, shards[0].base);
+    sprintf(tmp_fname, "%s.tmp", out_fname);
+    if ((retval = nc_create(tmp_fname, NC_NETCDF4, &out_ncid)))
+        ERR(retval);
+
+    for (i = 0; i < num_shards; i++) {
+        sprintf(fname, "%s/%s.r%04d-%04d.nc", shards[i].dir, shards[i].base,
+                shards[i].row_start, shards[i].row_end);
+        if (verbose)
+            printf("    %s\n", fname);
+        if ((retval = nc_open(fname, NC_NOWRITE, &in_ncid)))
+            ERR(retval);
+        if ((retval = nc_get_att_int(in_ncid, NC_GLOBAL, "shard_total_rows", &shard_total)))
+            ERR(retval);
+        if (shard_total != total_rows) {
+            fprintf(stderr, "*** %s is a shard of a %d row image, not %d\n",
+                    fname, shard_total, total_rows);
+            exit(-1);
+        }
+        if (i == 0)
+            define_merged(in_ncid, out_ncid, total_rows, &row_dimid);
+        copy_shard(in_ncid, out_ncid, row_dimid, i == 0, shards[i].row_start - 1);
+        if ((retval = nc_close(in_ncid)))
+            ERR(retval);
+    }
+
+    if ((retval = nc_close(out_ncid)))
+        ERR(retval);
+    if (rename(tmp_fname, out_fname)) {
+        perror(out_fname);
+        return -1;
+    }
+    printf("Merged %s\n", out_fname);
+
+    if (remove_shards) {
+        for (i = 0; i < num_shards; i++) {
+            sprintf(fname, "%s/%s.r%04d-%04d.nc", shards[i].dir, shards[i].base,
+                    shards[i].row_start, shards[i].row_end);
+            unlink(fname);
+        }
+    }
+    return 0;
+}
+
+int main (int argc, char **argv)
+{
+    struct arguments arguments;
+
+    /* Default values. */
+    arguments.verbose = 0;
+    arguments.jobs = 8;
+    arguments.prefix = NULL;
+    arguments.remove = 0;
+    arguments.dirs = NULL;
+    arguments.num_dirs = 0;
+
+    /* Parse our arguments; every option seen by parse_opt will
+     be reflected in arguments. */
+    argp_parse (&argp, argc, argv, 0, 0, &arguments);
+
+    shard *shards = (shard*)malloc(sizeof(shard)*MAX_FILES);
+    int *groups = (int*)malloc(sizeof(int)*(MAX_FILES+1));
+    int num_shards = 0, num_groups = 0;
+    struct dirent *entry;
+    DIR *dir;
+    int i, j;
+
+    if (!shards || !groups) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+
+    printf ("MERGE_SHARDS\n---------------\nBeginning processing with options:\n");
+    printf ("JOBS = %d\nPREFIX = %s\nREMOVE = %s\n---------------\n",
+      arguments.jobs,
+      arguments.prefix ? arguments.prefix : "(none)",
+      arguments.remove ? "yes" : "no");
+
+    /* find all the shard files */
+    for (i = 0; i < arguments.num_dirs; i++) {
+        dir = opendir(arguments.dirs[i]);
+        if (!dir) {
+            perror(arguments.dirs[i]);
+            exit(1);
+        }
+        while ((entry = readdir(dir)) != NULL) {
+            if (arguments.prefix &&
+                    strncmp(entry->d_name, arguments.prefix, strlen(arguments.prefix)) != 0)
+                continue;
+            if (parse_shard_name(entry->d_name, &shards[num_shards]))
+                continue;
+            shards[num_shards].dir = arguments.dirs[i];
+            if (++num_shards == MAX_FILES) {
+                fprintf(stderr, "Too many shard files!\n");
+                exit(-1);
+            }
+        }
+        closedir(dir);
+    }
+
+    /* group the shards of each output file, sorted by row */
+    qsort(shards, num_shards, sizeof(shard), compare_shards);
+    for (i = 0; i < num_shards; i++) {
+        if (i == 0 || strcmp(shards[i].dir, shards[i-1].dir) != 0 ||
+                strcmp(shards[i].base, shards[i-1].base) != 0)
+            groups[num_groups++] = i;
+    }
+    groups[num_groups] = num_shards;
+    printf("Found %d shard files of %d files\n", num_shards, num_groups);
+
+    /* every process merges every jobs-th file */
+    int num_jobs = arguments.jobs < num_groups ? arguments.jobs : num_groups;
+    pid_t *pids = (pid_t*)malloc(sizeof(pid_t)*(num_jobs > 0 ? num_jobs : 1));
+    fflush(stdout);
+    for (i = 0; i < num_jobs; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            perror("fork");
+            exit(1);
+        }
+        if (pids[i] == 0) {
+            int failed = 0;
+            setvbuf (stdout, NULL, _IONBF, 0);
+            for (j = i; j < num_groups; j += num_jobs) {
+                if (merge_file(&shards[groups[j]], groups[j+1] - groups[j],
+                        arguments.verbose, arguments.remove))
+                    failed = 1;
+            }
+            _exit(failed);
+        }
+    }
+
+    int status, failed = 0;
+    for (i = 0; i < num_jobs; i++) {
+        if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+    }
+
+    free(pids);
+    free(groups);
+    free(shards);
+
+    if (failed) {
+        printf("Some files could not be merged.\n");
+        exit(1);
+    }
+    printf("Finished.\n");
+    exit (0);
+}
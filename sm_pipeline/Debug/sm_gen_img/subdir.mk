@@ -0,0 +1,24 @@
+################################################################################
+# Automatically-generated file. Do not edit!
+################################################################################
+
+# Add inputs and outputs from these tool invocations to the build variables 
+C_SRCS += \
+../../sm_gen_img/transpose.c 
+
+OBJS += \
+./sm_gen_img/transpose.o 
+
+C_DEPS += \
+./sm_gen_img/transpose.d 
+
+
+# Each subdirectory must supply rules for building sources it contributes
+sm_gen_img/%.o: ../../sm_gen_img/%.c
+	@echo 'Building file: $<'
+	@echo 'Invoking: GCC C Compiler'
+	gcc -I/home/lindell/local/include/sir -O3 -march=native -g3 -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$(@:%.o=%.d)" -o "$@" "$<"
+	@echo 'Finished building: $<'
+	@echo ' '
+
+
@@ -0,0 +1,30 @@
+################################################################################
+# Automatically-generated file. Do not edit!
+################################################################################
+
+# Add inputs and outputs from these tool invocations to the build variables 
+C_SRCS += \
+../../sm_gen_swi/swi_filter.c \
+../../sm_gen_swi/fourier_fit.c \
+../../sm_gen_swi/swi_pixel.c 
+
+OBJS += \
+./sm_gen_swi/swi_filter.o \
+./sm_gen_swi/fourier_fit.o \
+./sm_gen_swi/swi_pixel.o 
+
+C_DEPS += \
+./sm_gen_swi/swi_filter.d \
+./sm_gen_swi/fourier_fit.d \
+./sm_gen_swi/swi_pixel.d 
+
+
+# Each subdirectory must supply rules for building sources it contributes
+sm_gen_swi/%.o: ../../sm_gen_swi/%.c
+	@echo 'Building file: $<'
+	@echo 'Invoking: GCC C Compiler'
+	gcc -I/home/lindell/local/include/sir -O3 -march=native -g3 -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$(@:%.o=%.d)" -o "$@" "$<"
+	@echo 'Finished building: $<'
+	@echo ' '
+
+
@@ -0,0 +1,722 @@
+/*
+ * pipeline.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Runs sm_gen_time_series, sm_gen_c0, sm_gen_swi and sm_gen_img for one
+ *  region in a single process, without writing the intermediate files
+ *  between them. The a and b time series cubes are parsed into memory,
+ *  c0 is computed from them, and then every row is turned into ms and SWI
+ *  in place: the ms series overwrites the a series of the row and the SWI
+ *  overwrites the b series, since neither is needed again once the row is
+ *  done. The daily images are then gathered straight out of the cubes.
+ *  Only the images asked for are written, the intermediate files can still
+ *  be written with --keep for debugging.
+ */
+
+#include <stdlib.h>
+#include <argp.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include <netcdf.h>
+
+#include "../sm_gen_time_series/ts_ingest.h"
+#include "../sm_gen_c0/c0_pixel.h"
+#include "../sm_gen_swi/swi_filter.h"
+#include "../sm_gen_swi/fourier_fit.h"
+#include "../sm_gen_swi/swi_pixel.h"
+#include "../sm_gen_img/transpose.h"
+
+#define NUM_THREADS 24
+#define NDIMS 4
+
+/* consecutive days of a pixel gathered at a time for the daily images,
+ * every other one is written, so one transpose tile of images */
+#define DAY_BLOCK (2*TRANSPOSE_TILE)
+
+/* threads gathering daily images, the writes are one at a time anyway */
+#define DAY_THREADS 8
+
+/* floats between the images of a block, padded to whole cache lines */
+#define PLANE_LEN(rows, cols) (((size_t)(rows)*(cols) + TRANSPOSE_TILE-1) / TRANSPOSE_TILE * TRANSPOSE_TILE)
+
+/* products and intermediate files */
+#define PRODUCT_SWI 1
+#define PRODUCT_MS 2
+#define PRODUCT_DRY 4
+#define KEEP_TS 1
+#define KEEP_C0 2
+#define KEEP_ROWS 4
+
+/* Handle errors by printing an error message and exiting with a
+ * non-zero status. */
+#define ERR(e) {printf("Error: %s\n", nc_strerror(e)); exit(2);}
+
+/* some global mutexes */
+pthread_mutex_t fopen_lock;
+pthread_mutex_t row_lock;
+
+/* Program documentation. */
+static char doc[] =
+  "sm_pipeline.c-- Program to go from the sir images to the daily soil\
+ moisture images of a region in one process.\n\
+ Region must be a defined type 'NAm','SAm', etc.";
+
+/* A description of the arguments we accept. */
+static char args_doc[] = "Region";
+
+/* The options we understand. */
+static struct argp_option options[] = {
+  {"verbose",  'v', 0,      0,  "Produce verbose output" },
+  {"grd",  'g', 0,      0,  "Process the grd images" },
+  {"products",  'p', "LIST",   0,  "Comma separated daily images to write: swi,ms,dry (default all)" },
+  {"keep",  'k', "LIST",   0,  "Comma separated intermediate files to also write: ts,c0,rows" },
+  {"swi-t",  't', "T",      0,  "SWI characteristic time in days (default 20)" },
+  { 0 }
+};
+
+/* Used by main to communicate with parse_opt. */
+struct arguments
+{
+  char *region;                /* Region */
+  int grd;
+  int verbose;
+  int products;
+  int keep;
+  float t_char;
+};
+
+/* Parse a comma separated list of names into flags.
+ * Returns -1 on a name that is not in the list. */
+int parse_flags(char *arg, const char **names, const int *flags, int num_names, int *out) {
+    char list[200];
+    char *name, *save;
+    int i;
+
+    *out = 0;
+    snprintf(list, sizeof(list), "%s", arg);
+    for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+        for (i = 0; i < num_names && strcmp(name, names[i]) != 0; i++);
+        if (i == num_names)
+            return -1;
+        *out |= flags[i];
+    }
+    return 0;
+}
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  /* Get the input argument from argp_parse, which we
+     know is a pointer to our arguments structure. */
+  struct arguments *arguments = state->input;
+  static const char *product_names[] = {"swi", "ms", "dry"};
+  static const int product_flags[] = {PRODUCT_SWI, PRODUCT_MS, PRODUCT_DRY};
+  static const char *keep_names[] = {"ts", "c0", "rows"};
+  static const int keep_flags[] = {KEEP_TS, KEEP_C0, KEEP_ROWS};
+
+  switch (key)
+    {
+    case 'v':
+      arguments->verbose = 1;
+      break;
+    case 'g':
+      arguments->grd = 1;
+      break;
+    case 'p':
+      if (parse_flags(arg, product_names, product_flags, 3, &arguments->products))
+          argp_failure(state, 1, 0, "ERROR, could not parse product list %s!", arg);
+      break;
+    case 'k':
+      if (parse_flags(arg, keep_names, keep_flags, 3, &arguments->keep))
+          argp_failure(state, 1, 0, "ERROR, could not parse intermediate file list %s!", arg);
+      break;
+    case 't':
+      arguments->t_char = atof(arg);
+      if (arguments->t_char <= 0)
+          argp_failure(state, 1, 0, "ERROR, SWI characteristic time must be positive!");
+      break;
+    case ARGP_KEY_ARG:
+      if (state->arg_num >= 1) {
+        /* Too many arguments. */
+        argp_usage (state);
+      } else if (arguments->region == NULL) {
+          arguments->region = arg;
+      }
+      break;
+
+    case ARGP_KEY_END:
+      if (state->arg_num < 1) {
+        /* Not enough arguments. */
+        argp_usage (state);
+      }
+      else if (arguments->region == NULL) {
+          argp_failure(state, 1, 0, "ERROR, region not defined!");
+      }
+      else if (
+      strcmp(arguments->region,"Ama") != 0 &&
+      strcmp(arguments->region,"Aus") != 0 &&
+      strcmp(arguments->region,"Ber") != 0 &&
+      strcmp(arguments->region,"CAm") != 0 &&
+      strcmp(arguments->region,"ChJ") != 0 &&
+      strcmp(arguments->region,"Eur") != 0 &&
+      strcmp(arguments->region,"Ind") != 0 &&
+      strcmp(arguments->region,"NAf") != 0 &&
+      strcmp(arguments->region,"NAm") != 0 &&
+      strcmp(arguments->region,"SAf") != 0 &&
+      strcmp(arguments->region,"SAm") != 0 &&
+      strcmp(arguments->region,"SAs") != 0) {
+          argp_failure(state, 1, 0, "ERROR, inputted region not defined!");
+      }
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+/* Our argp parser. */
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+/* slope fit setup, shared by all threads */
+static fourier_fit slope_fit;
+
+typedef struct {
+    float *ts_a;        /* becomes ms */
+    float *ts_b;        /* becomes swi */
+    float *dry_ts;      /* NULL if dry isn't written */
+    float *c0_dry;
+    float *c0_wet;
+    float *dry_slope;
+    unsigned char *arid;
+    float *t_char;
+    float *dry;
+    float *scratch;
+    float *filter_scratch;
+    float *fit_data;
+    float *slope;
+    unsigned char *fit_ok;
+    float *day_img[3];  /* [product][DAY_BLOCK/2][PLANE_LEN] images */
+    int *next;
+    int start_i;
+    int stop_i;
+    int num_rows;
+    int num_columns;
+    int products;
+    int keep;
+    char *region;
+    pthread_mutex_t *fopen_lock;
+    pthread_mutex_t *row_lock;
+} thread_args;
+
+/* c0 of every pixel of a range of rows, same columns as sm_gen_c0 */
+void *mthreadGenC0(void *arg) {
+    thread_args *t_args = (thread_args*)arg;
+    int num_columns = t_args->num_columns;
+    size_t px;
+    int i, j;
+
+    for (i = t_args->start_i; i <= t_args->stop_i; i++) {
+        for (j = 0; j < num_columns-1; j++) {
+            px = (size_t)i * num_columns + j;
+            find_min_max(t_args->ts_a + px * NUM_TS, t_args->ts_b + px * NUM_TS,
+                    &t_args->c0_dry[px], &t_args->c0_wet[px], &t_args->dry_slope[px], "a");
+        }
+    }
+    return NULL;
+}
+
+/* ms, sigma0-dry and SWI of whole rows, written over the time series */
+void *mthreadGenSwi(void *arg) {
+    thread_args *t_args = (thread_args*)arg;
+    int num_columns = t_args->num_columns;
+    size_t t, px, row_len = (size_t)num_columns * NUM_TS;
+    float *ts_a, *ts_b, *dry, *swi[1];
+    int row, col;
+
+    for (;;) {
+        /* grab the next row */
+        pthread_mutex_lock(t_args->row_lock);
+        row = (*t_args->next)++;
+        pthread_mutex_unlock(t_args->row_lock);
+        if (row >= t_args->num_rows)
+            break;
+
+        if (row % 50 == 0)
+            printf("    Row: %04d\n", row+1);
+
+        ts_a = t_args->ts_a + (size_t)row * row_len;
+        ts_b = t_args->ts_b + (size_t)row * row_len;
+        dry = t_args->dry_ts ? t_args->dry_ts + (size_t)row * row_len : t_args->dry;
+        clean_row(ts_a, ts_b, t_args->scratch, num_columns);
+
+        /* seasonal slope curve of the whole row in one batch */
+        yearly_mean(ts_b, t_args->fit_data, num_columns);
+        fourier_fit_batch(&slope_fit, t_args->fit_data, num_columns, t_args->slope,
+                NULL, t_args->fit_ok);
+
+        /* ms goes where the a series was, each day is read before it's written */
+        for (col = 0; col < num_columns; col++) {
+            px = (size_t)row * num_columns + col;
+            if (isnan(t_args->c0_dry[px]) || isnan(t_args->c0_wet[px]) || !t_args->fit_ok[col]) {
+                for (t = 0; t < NUM_TS; t++) {
+                    ts_a[col * NUM_TS + t] = NAN;
+                    dry[col * NUM_TS + t] = NAN;
+                }
+                continue;
+            }
+            process_pixel(ts_a + col * NUM_TS, t_args->slope + col * NUM_DAYS,
+                    t_args->c0_dry[px], t_args->c0_wet[px], t_args->arid[px],
+                    ts_a + col * NUM_TS, dry + col * NUM_TS);
+        }
+
+        /* the b series is not needed after the fit, SWI goes there */
+        swi[0] = ts_b;
+        swi_filter_pixels(ts_a, swi, num_columns, NUM_TS, t_args->t_char, 1,
+                t_args->filter_scratch, NULL, NULL);
+
+        if (t_args->keep & KEEP_ROWS) {
+            pthread_mutex_lock(t_args->fopen_lock);
+            write_row(t_args->region, row, num_columns, swi, t_args->t_char, 1, ts_a, dry);
+            pthread_mutex_unlock(t_args->fopen_lock);
+        }
+    }
+    return NULL;
+}
+
+/* Write one day of images, same layout as sm_gen_img */
+void write_day(char *region, int year, int doy, int num_rows, int num_columns,
+        int products, float t_char, float *swi, float *ms, float *dry) {
+    char fname[150];
+    char swi_name[NC_MAX_NAME];
+    int ncid, row_dimid, col_dimid;
+    int swi_varid, ms_varid, dry_varid;
+    int dimids[2];
+    int retval;
+
+    sprintf(fname,"/auto/temp/lindell/soilmoisture/swi/combined/swi_%s_%04d_%03d.nc",region,year,doy);
+    if ((retval = nc_create(fname, NC_NETCDF4, &ncid)))
+        ERR(retval);
+
+    /* Define the dimensions. */
+    if ((retval = nc_def_dim(ncid, "row", num_rows, &row_dimid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(ncid, "column", num_columns, &col_dimid)))
+        ERR(retval);
+    dimids[0] = row_dimid;
+    dimids[1] = col_dimid;
+
+    /* define the variables */
+    swi_var_name(swi_name, t_char);
+    if ((products & PRODUCT_SWI) && (retval = nc_def_var(ncid, swi_name, NC_FLOAT, 2, dimids, &swi_varid)))
+        ERR(retval);
+    if ((products & PRODUCT_MS) && (retval = nc_def_var(ncid, "ms", NC_FLOAT, 2, dimids, &ms_varid)))
+        ERR(retval);
+    if ((products & PRODUCT_DRY) && (retval = nc_def_var(ncid, "dry", NC_FLOAT, 2, dimids, &dry_varid)))
+        ERR(retval);
+
+    /* End define mode. */
+    if ((retval = nc_enddef(ncid)))
+        ERR(retval);
+
+    /* Write the data. */
+    if ((products & PRODUCT_SWI) && (retval = nc_put_var_float(ncid, swi_varid, swi)))
+        ERR(retval);
+    if ((products & PRODUCT_MS) && (retval = nc_put_var_float(ncid, ms_varid, ms)))
+        ERR(retval);
+    if ((products & PRODUCT_DRY) && (retval = nc_put_var_float(ncid, dry_varid, dry)))
+        ERR(retval);
+
+    /* Close the file. */
+    if ((retval = nc_close(ncid)))
+        ERR(retval);
+    return;
+}
+
+/* Gather blocks of DAY_BLOCK days out of the cubes into daily images and
+ * write every other day, like sm_gen_img */
+void *mthreadWriteDays(void *arg) {
+    thread_args *t_args = (thread_args*)arg;
+    int num_rows = t_args->num_rows;
+    int num_columns = t_args->num_columns;
+    size_t img_len = (size_t)num_rows * num_columns;
+    size_t plane_len = PLANE_LEN(num_rows, num_columns);
+    int blocks_per_year = (NUM_DAYS + DAY_BLOCK - 1) / DAY_BLOCK;
+    const float *cube[3] = {t_args->ts_b, t_args->ts_a, t_args->dry_ts};
+    int block, year, day0, num_days, p, d;
+
+    for (;;) {
+        pthread_mutex_lock(t_args->row_lock);
+        block = (*t_args->next)++;
+        pthread_mutex_unlock(t_args->row_lock);
+        if (block >= NUM_YEARS * blocks_per_year)
+            break;
+
+        year = block / blocks_per_year;
+        day0 = (block % blocks_per_year) * DAY_BLOCK;
+        num_days = NUM_DAYS - day0 < DAY_BLOCK ? NUM_DAYS - day0 : DAY_BLOCK;
+
+        /* the even days of the block, from [pixel][day] to [day][pixel] */
+        for (p = 0; p < 3; p++) {
+            if (!(t_args->products & (1 << p)))
+                continue;
+            transpose_f32(cube[p] + year * NUM_DAYS + day0, NUM_TS, 2,
+                    t_args->day_img[p], plane_len, img_len, (num_days + 1) / 2);
+        }
+
+        for (d = 0; d < num_days; d += 2) {
+            printf("    Day: %03d Year: %04d\n", day0+d+1, year+YEAR_START);
+            pthread_mutex_lock(t_args->fopen_lock);
+            write_day(t_args->region, year+YEAR_START, day0+d+1, num_rows, num_columns,
+                    t_args->products, t_args->t_char[0],
+                    t_args->day_img[0] + (d/2) * plane_len,
+                    t_args->day_img[1] + (d/2) * plane_len,
+                    t_args->day_img[2] + (d/2) * plane_len);
+            pthread_mutex_unlock(t_args->fopen_lock);
+        }
+    }
+    return NULL;
+}
+
+/* Write a time series cube to a ts file like sm_gen_time_series */
+void write_ts(char *region, char *type, float *ts, int num_rows, int num_columns) {
+    char fname[150];
+    int ncid, row_dimid, col_dimid, year_dimid, day_dimid, varid;
+    int dimids[NDIMS];
+    int retval;
+
+    sprintf(fname,"/auto/temp/lindell/soilmoisture/ts/ts_%s_%s.nc",region,type);
+    if ((retval = nc_create(fname, NC_NETCDF4, &ncid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(ncid, "row", num_rows, &row_dimid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(ncid, "column", num_columns, &col_dimid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(ncid, "year", NUM_YEARS, &year_dimid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(ncid, "day", NUM_DAYS, &day_dimid)))
+        ERR(retval);
+    dimids[0] = row_dimid;
+    dimids[1] = col_dimid;
+    dimids[2] = year_dimid;
+    dimids[3] = day_dimid;
+    if ((retval = nc_def_var(ncid, "data", NC_FLOAT, NDIMS, dimids, &varid)))
+        ERR(retval);
+    if ((retval = nc_enddef(ncid)))
+        ERR(retval);
+    if ((retval = nc_put_var_float(ncid, varid, ts)))
+        ERR(retval);
+    if ((retval = nc_close(ncid)))
+        ERR(retval);
+    return;
+}
+
+/* Write the c0 images like sm_gen_c0 */
+void write_c0(char *region, float *c0_dry, float *c0_wet, float *dry_slope,
+        int num_rows, int num_columns) {
+    char fname[150];
+    int ncid, row_dimid, col_dimid, dry_varid, wet_varid, slope_varid;
+    int dimids[2];
+    int retval;
+
+    sprintf(fname,"/auto/temp/lindell/soilmoisture/c0/c0_%s.nc",region);
+    if ((retval = nc_create(fname, NC_NETCDF4, &ncid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(ncid, "row", num_rows, &row_dimid)))
+        ERR(retval);
+    if ((retval = nc_def_dim(ncid, "column", num_columns, &col_dimid)))
+        ERR(retval);
+    dimids[0] = row_dimid;
+    dimids[1] = col_dimid;
+    if ((retval = nc_def_var(ncid, "dry", NC_FLOAT, 2, dimids, &dry_varid)))
+        ERR(retval);
+    if ((retval = nc_def_var(ncid, "wet", NC_FLOAT, 2, dimids, &wet_varid)))
+        ERR(retval);
+    if ((retval = nc_def_var(ncid, "dry_slope", NC_FLOAT, 2, dimids, &slope_varid)))
+        ERR(retval);
+    if ((retval = nc_enddef(ncid)))
+        ERR(retval);
+    if ((retval = nc_put_var_float(ncid, dry_varid, c0_dry)))
+        ERR(retval);
+    if ((retval = nc_put_var_float(ncid, wet_varid, c0_wet)))
+        ERR(retval);
+    if ((retval = nc_put_var_float(ncid, slope_varid, dry_slope)))
+        ERR(retval);
+    if ((retval = nc_close(ncid)))
+        ERR(retval);
+    return;
+}
+
+int main (int argc, char **argv)
+{
+    struct arguments arguments;
+
+    /* Default values. */
+    arguments.verbose = 0;
+    arguments.grd = 0;
+    arguments.region = NULL;
+    arguments.products = PRODUCT_SWI | PRODUCT_MS | PRODUCT_DRY;
+    arguments.keep = 0;
+    arguments.t_char = SWI_T;
+
+    /* Parse our arguments; every option seen by parse_opt will
+     be reflected in arguments. */
+    argp_parse (&argp, argc, argv, 0, 0, &arguments);
+
+    /* Set up variables */
+    int num_columns;
+    int num_rows;
+    int grd = arguments.grd;
+    char* region = arguments.region;
+    int i, k, next;
+
+    /* multithread args */
+    thread_args t_args[NUM_THREADS];
+    pthread_t thread_id[NUM_THREADS];
+    int ind_per_thread;
+    int start_index;
+    int stop_index;
+
+    printf ("PIPELINE\n---------------\nBeginning processing with options:\n");
+
+    printf ("Region = %s\nVERBOSE = %s\nGRD = %s\nPRODUCTS =%s%s%s\nKEEP =%s%s%s\nSWI T = %g\n---------------\n",
+      arguments.region,
+      arguments.verbose ? "yes" : "no",
+      arguments.grd ? "yes" : "no",
+      arguments.products & PRODUCT_SWI ? " swi" : "",
+      arguments.products & PRODUCT_MS ? " ms" : "",
+      arguments.products & PRODUCT_DRY ? " dry" : "",
+      arguments.keep & KEEP_TS ? " ts" : "",
+      arguments.keep & KEEP_C0 ? " c0" : "",
+      arguments.keep & KEEP_ROWS ? " rows" : "",
+      arguments.t_char);
+
+    /* define image areas based on region */
+    if (!grd) {
+        if (strcmp(region,"Ama") == 0) {
+            num_columns = 1128;
+            num_rows = 744;
+        } else if (strcmp(region,"Ber") == 0) {
+            num_columns = 1350;
+            num_rows = 750;
+        } else if (strcmp(region,"CAm") == 0) {
+              num_columns = 1440;
+              num_rows = 700;
+        } else if (strcmp(region,"ChJ") == 0) {
+              num_columns = 1980;
+              num_rows = 950;
+        } else if (strcmp(region,"Eur") == 0) {
+              num_columns = 1530;
+              num_rows = 1040;
+        } else if (strcmp(region,"Ind") == 0) {
+              num_columns = 1800;
+              num_rows = 680;
+        } else if (strcmp(region,"NAf") == 0) {
+              num_columns = 2120;
+              num_rows = 1130;
+        } else if (strcmp(region,"NAm") == 0) {
+              num_columns = 1890;
+              num_rows = 1150;
+        } else if (strcmp(region,"SAf") == 0) {
+              num_columns = 1220;
+              num_rows = 1260;
+        } else if (strcmp(region,"SAm") == 0) {
+              num_columns = 1310;
+              num_rows = 1850;
+        }  else if (strcmp(region,"SAs") == 0) {
+              num_columns = 1760;
+              num_rows = 720;
+        } else {
+            printf("ERROR SETTING REGION SIZES!");
+            exit(-1);
+        }
+    } else {
+        if (strcmp(region,"NAm") == 0) {
+            num_columns = 672;
+            num_rows = 410;
+        } else {
+            printf("ERROR SETTING REGION SIZES!");
+            exit(-1);
+        }
+    }
+
+    /* two cubes, three if dry is written, plus the day images */
+    setvbuf (stdout, NULL, _IONBF, 0);
+    size_t row_len = (size_t)num_columns * NUM_TS;
+    size_t img_len = (size_t)num_rows * num_columns;
+    size_t cube_len = img_len * NUM_TS;
+    int num_cubes = arguments.products & PRODUCT_DRY ? 3 : 2;
+    printf("Allocating Memory (%.1f GB)...",
+            (num_cubes * cube_len + DAY_THREADS * 3 * (DAY_BLOCK/2) * img_len) * sizeof(float) / 1e9);
+
+    float *ts_a = (float*)malloc(sizeof(float)*cube_len);
+    float *ts_b = (float*)malloc(sizeof(float)*cube_len);
+    float *dry_ts = NULL;
+    if (arguments.products & PRODUCT_DRY)
+        dry_ts = (float*)malloc(sizeof(float)*cube_len);
+    float *c0_dry = (float*)calloc(img_len, sizeof(float));
+    float *c0_wet = (float*)calloc(img_len, sizeof(float));
+    float *dry_slope = (float*)calloc(img_len, sizeof(float));
+    unsigned char *arid = (unsigned char*)malloc(img_len);
+    if (!ts_a || !ts_b || ((arguments.products & PRODUCT_DRY) && !dry_ts) ||
+            !c0_dry || !c0_wet || !dry_slope || !arid) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+    memset(ts_a, 0, sizeof(float)*cube_len);
+    memset(ts_b, 0, sizeof(float)*cube_len);
+    printf("done\n");
+
+    /* ***** TIME SERIES ***** */
+    printf("Parsing a images...\n");
+    ingest_time_series(ts_a, region, "a", grd, 1, num_rows, num_columns);
+    printf("Parsing b images...\n");
+    ingest_time_series(ts_b, region, "b", grd, 1, num_rows, num_columns);
+    if (arguments.keep & KEEP_TS) {
+        printf("Saving time series files...");
+        write_ts(region, "a", ts_a, num_rows, num_columns);
+        write_ts(region, "b", ts_b, num_rows, num_columns);
+        printf("done\n");
+    }
+
+    /* ***** C0 ***** */
+    printf("Computing c0...");
+    ind_per_thread = num_rows / NUM_THREADS -1;
+    start_index = 0;
+    stop_index = 0;
+    for (i = 0; i < NUM_THREADS; i++) {
+        if (i == NUM_THREADS - 1) {
+            stop_index = num_rows-1;
+        } else {
+            stop_index = start_index + ind_per_thread;
+        }
+        t_args[i].ts_a = ts_a;
+        t_args[i].ts_b = ts_b;
+        t_args[i].dry_ts = dry_ts;
+        t_args[i].c0_dry = c0_dry;
+        t_args[i].c0_wet = c0_wet;
+        t_args[i].dry_slope = dry_slope;
+        t_args[i].arid = arid;
+        t_args[i].t_char = &arguments.t_char;
+        t_args[i].next = &next;
+        t_args[i].start_i = start_index;
+        t_args[i].stop_i = stop_index;
+        t_args[i].num_rows = num_rows;
+        t_args[i].num_columns = num_columns;
+        t_args[i].products = arguments.products;
+        t_args[i].keep = arguments.keep;
+        t_args[i].region = region;
+        t_args[i].fopen_lock = &fopen_lock;
+        t_args[i].row_lock = &row_lock;
+        start_index = stop_index + 1;
+    }
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&thread_id[i], NULL, mthreadGenC0, &t_args[i]);
+    }
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_join(thread_id[i], NULL);
+    }
+    printf("done\n");
+    if (arguments.keep & KEEP_C0) {
+        printf("Saving c0 file...");
+        write_c0(region, c0_dry, c0_wet, dry_slope, num_rows, num_columns);
+        printf("done\n");
+    }
+
+    /* 0 is no data, same as when sm_gen_swi reads the c0 file */
+    for (i = 0; i < img_len; i++) {
+        if (c0_dry[i] == 0)
+            c0_dry[i] = NAN;
+        if (c0_wet[i] == 0)
+            c0_wet[i] = NAN;
+    }
+    free(dry_slope);
+    load_arid(region, grd, arid, num_rows, num_columns);
+
+    /* ***** MS AND SWI ***** */
+    if (fourier_fit_init(&slope_fit, NUM_DAYS, FIT_HARMONICS, EVAL_HARMONICS, MIN_FIT_DAYS)) {
+        fprintf(stderr, "Error setting up the slope fit!\n");
+        exit(-1);
+    }
+    for (i = 0; i < NUM_THREADS; i++) {
+        t_args[i].dry = (float*)malloc(sizeof(float)*row_len);
+        t_args[i].scratch = (float*)malloc(sizeof(float)*row_len);
+        t_args[i].filter_scratch = (float*)malloc(sizeof(float)*SWI_SCRATCH_LEN(NUM_TS, 1));
+        t_args[i].fit_data = (float*)malloc(sizeof(float)*num_columns*NUM_DAYS);
+        t_args[i].slope = (float*)malloc(sizeof(float)*num_columns*NUM_DAYS);
+        t_args[i].fit_ok = (unsigned char*)malloc(num_columns);
+        if (!t_args[i].dry || !t_args[i].scratch || !t_args[i].filter_scratch ||
+                !t_args[i].fit_data || !t_args[i].slope || !t_args[i].fit_ok) {
+            fprintf(stderr, "Memory Error!\n");
+            exit(-1);
+        }
+    }
+
+    printf("Computing ms and SWI\n");
+    next = 0;
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&thread_id[i], NULL, mthreadGenSwi, &t_args[i]);
+    }
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_join(thread_id[i], NULL);
+    }
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        free(t_args[i].dry);
+        free(t_args[i].scratch);
+        free(t_args[i].filter_scratch);
+        free(t_args[i].fit_data);
+        free(t_args[i].slope);
+        free(t_args[i].fit_ok);
+    }
+    fourier_fit_free(&slope_fit);
+    free(c0_dry);
+    free(c0_wet);
+    free(arid);
+
+    /* ***** DAILY IMAGES ***** */
+    printf("Writing NetCDF Files!\n");
+    for (i = 0; i < DAY_THREADS; i++) {
+        for (k = 0; k < 3; k++) {
+            t_args[i].day_img[k] = NULL;
+            if (!(arguments.products & (1 << k)))
+                continue;
+            if (posix_memalign((void**)&t_args[i].day_img[k], 64,
+                    sizeof(float)*(DAY_BLOCK/2)*PLANE_LEN(num_rows, num_columns))) {
+                fprintf(stderr, "Memory Error!\n");
+                exit(-1);
+            }
+        }
+    }
+    next = 0;
+    for (i = 0; i < DAY_THREADS; i++) {
+        pthread_create(&thread_id[i], NULL, mthreadWriteDays, &t_args[i]);
+    }
+    for (i = 0; i < DAY_THREADS; i++) {
+        pthread_join(thread_id[i], NULL);
+    }
+
+    printf("Freeing memory.\n");
+    for (i = 0; i < DAY_THREADS; i++) {
+        for (k = 0; k < 3; k++)
+            free(t_args[i].day_img[k]);
+    }
+    free(ts_a);
+    free(ts_b);
+    free(dry_ts);
+
+    printf("Finished.\n");
+    exit (0);
+}
@@ -0,0 +1,990 @@
+/*
+ * run_jobs.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: lindell
+ *
+ *  Runs the processing stages of a region on the local node without a
+ *  scheduler, in place of submitting one sbatch job per row. The work is a
+ *  list of tasks, each with the cores and memory it needs, the tasks it
+ *  depends on, and its input and output files. Tasks are started as soon as
+ *  their dependencies are done and there are enough free cores and memory
+ *  for them, so several small tasks share the node while a big one waits
+ *  for room. A task is skipped if its outputs exist and nothing about its
+ *  command or inputs changed since it last finished, and a task that fails
+ *  (e.g. segfaults) is retried a few times before its dependents are given up.
+ *
+ *  The task file has one task per line:
+ *
+ *      stage name cores mem_mb deps inputs outputs command...
+ *
+ *  deps, inputs and outputs are comma separated lists, or - for none. A dep
+ *  is a task name, or @stage for every task of a stage. Tasks can only
+ *  depend on tasks listed before them.
+ */
+
+#include <stdlib.h>
+#include <argp.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MAX_TASKS 20000
+#define MAX_LINE 8192
+
+/* threads used by each of the processing programs */
+#define PROGRAM_THREADS 24
+#define NUM_TS (6*365)
+
+#define TEMP_DIR "/auto/temp/lindell/soilmoisture"
+
+enum {
+    TASK_WAITING,
+    TASK_RUNNING,
+    TASK_DONE,
+    TASK_FAILED,
+    TASK_BLOCKED    /* a dependency failed */
+};
+
+typedef struct {
+    char stage[32];
+    char name[64];
+    int cores;
+    long mem_mb;
+    char *deps;
+    char *inputs;
+    char *outputs;
+    char *command;
+    int *dep;
+    int num_deps;
+    int status;
+    int attempts;
+    int skipped;
+    pid_t pid;
+    unsigned long long fingerprint;
+} task;
+
+/* Program documentation. */
+static char doc[] =
+  "sm_run_jobs.c-- Program to run the processing tasks of a region on one node\n\
+ Runs the tasks in TASK_FILE, or the standard processing of a region given\n\
+ with --region. Tasks that are up to date are skipped.";
+
+/* A description of the arguments we accept. */
+static char args_doc[] = "[TASK_FILE]";
+
+/* The options we understand. */
+static struct argp_option options[] = {
+  {"verbose",  'v', 0,      0,  "Produce verbose output" },
+  {"region",  'R', "REGION", 0,  "Run the standard processing of a region instead of a task file" },
+  {"grd",  'g', 0,      0,  "Process the grd images of the region" },
+  {"shards",  'S', "N",      0,  "Split the region into N row shards (default 1)" },
+  {"cores",  'c', "N",      0,  "Cores to use (default all of the node)" },
+  {"mem",  'm', "MB",     0,  "Memory to use in MB (default all of the node)" },
+  {"retries",  'r', "N",      0,  "Times to retry a failed task (default 2)" },
+  {"state-dir",  's', "DIR",    0,  "Where finished task fingerprints and logs go (default " TEMP_DIR "/jobs)" },
+  {"only",  'o', "TASK",   0,  "Only run TASK, or every task of a stage given as @stage" },
+  {"dry-run",  'n', 0,      0,  "Only print what would be run" },
+  {"print",  'p', 0,      0,  "Print the task list and exit" },
+  {"slurm",  'a', "DIR",    0,  "Write slurm job array scripts for the tasks to DIR instead of running them" },
+  { 0 }
+};
+
+/* Used by main to communicate with parse_opt. */
+struct arguments
+{
+  char *task_file;
+  char *region;
+  int grd;
+  int shards;
+  int cores;
+  long mem_mb;
+  int retries;
+  char *state_dir;
+  char *only;
+  int dry_run;
+  int print;
+  char *slurm_dir;
+  int verbose;
+};
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  /* Get the input argument from argp_parse, which we
+     know is a pointer to our arguments structure. */
+  struct arguments *arguments = state->input;
+
+  switch (key)
+    {
+    case 'v':
+      arguments->verbose = 1;
+      break;
+    case 'R':
+      arguments->region = arg;
+      break;
+    case 'g':
+      arguments->grd = 1;
+      break;
+    case 'S':
+      arguments->shards = atoi(arg);
+      if (arguments->shards < 1)
+          argp_failure(state, 1, 0, "ERROR, need at least one shard!");
+      break;
+    case 'c':
+      arguments->cores = atoi(arg);
+      if (arguments->cores < 1)
+          argp_failure(state, 1, 0, "ERROR, need at least one core!");
+      break;
+    case 'm':
+      arguments->mem_mb = atol(arg);
+      if (arguments->mem_mb < 1)
+          argp_failure(state, 1, 0, "ERROR, memory must be positive!");
+      break;
+    case 'r':
+      arguments->retries = atoi(arg);
+      break;
+    case 's':
+      arguments->state_dir = arg;
+      break;
+    case 'o':
+      arguments->only = arg;
+      break;
+    case 'n':
+      arguments->dry_run = 1;
+      break;
+    case 'p':
+      arguments->print = 1;
+      break;
+    case 'a':
+      arguments->slurm_dir = arg;
+      break;
+    case ARGP_KEY_ARG:
+      if (state->arg_num >= 1) {
+        /* Too many arguments. */
+        argp_usage (state);
+      } else {
+        arguments->task_file = arg;
+      }
+      break;
+
+    case ARGP_KEY_END:
+      if ((arguments->task_file == NULL) == (arguments->region == NULL)) {
+        argp_failure(state, 1, 0, "ERROR, give either a task file or --region!");
+      }
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+/* Our argp parser. */
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+static volatile sig_atomic_t interrupted = 0;
+
+void handle_signal(int sig) {
+    interrupted = 1;
+}
+
+/* Check to see if a directory exists */
+void checkdir(char* dirname) {
+// http://stackoverflow.com/questions/9314586/c-faster-way-to-check-if-a-directory-exists
+    struct stat s;
+    int err = stat(dirname, &s);
+    if(-1 == err) {
+        if(ENOENT == errno) {
+            /* does not exist-- creating dir */
+            mkdir(dirname, 0700);
+        } else {
+            perror("stat error");
+            exit(1);
+        }
+    } else {
+        if(S_ISDIR(s.st_mode)) {
+            /* it's a dir */
+        } else {
+            /* exists but is no dir */
+            perror("Error creating directory (already exists as file?)");
+        }
+    }
+    return;
+}
+
+/* Region image sizes, same as the processing programs */
+int region_size(char *region, int grd, int *num_rows, int *num_columns) {
+    if (!grd) {
+        if (strcmp(region,"Ama") == 0) {
+            *num_columns = 1128;
+            *num_rows = 744;
+        } else if (strcmp(region,"Ber") == 0) {
+            *num_columns = 1350;
+            *num_rows = 750;
+        } else if (strcmp(region,"CAm") == 0) {
+            *num_columns = 1440;
+            *num_rows = 700;
+        } else if (strcmp(region,"ChJ") == 0) {
+            *num_columns = 1980;
+            *num_rows = 950;
+        } else if (strcmp(region,"Eur") == 0) {
+            *num_columns = 1530;
+            *num_rows = 1040;
+        } else if (strcmp(region,"Ind") == 0) {
+            *num_columns = 1800;
+            *num_rows = 680;
+        } else if (strcmp(region,"NAf") == 0) {
+            *num_columns = 2120;
+            *num_rows = 1130;
+        } else if (strcmp(region,"NAm") == 0) {
+            *num_columns = 1890;
+            *num_rows = 1150;
+        } else if (strcmp(region,"SAf") == 0) {
+            *num_columns = 1220;
+            *num_rows = 1260;
+        } else if (strcmp(region,"SAm") == 0) {
+            *num_columns = 1310;
+            *num_rows = 1850;
+        } else if (strcmp(region,"SAs") == 0) {
+            *num_columns = 1760;
+            *num_rows = 720;
+        } else {
+            return -1;
+        }
+    } else {
+        if (strcmp(region,"NAm") == 0) {
+            *num_columns = 672;
+            *num_rows = 410;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Write the standard processing of a region as a task file: time series,
+ * c0, SWI and the daily images, split into row shards that are merged
+ * back together between the stages. Memory is estimated from the size of
+ * the time series cube of the rows each task holds. */
+void write_region_tasks(FILE *fid, char *region, int grd, int num_shards) {
+    int num_rows, num_columns;
+    int s, row_start, row_end;
+    long cube_mb, shard_mb;
+    char rows[32], range[32], outputs[300];
+    char *g = grd ? "-g " : "";
+    char *ts = TEMP_DIR "/ts";
+    char *swi = TEMP_DIR "/swi";
+    char *img = TEMP_DIR "/swi/combined";
+    char *c0 = TEMP_DIR "/c0";
+
+    if (region_size(region, grd, &num_rows, &num_columns)) {
+        printf("ERROR SETTING REGION SIZES!");
+        exit(-1);
+    }
+    if (num_shards > num_rows)
+        num_shards = num_rows;
+    cube_mb = (long)((double)num_rows * num_columns * NUM_TS * sizeof(float) / (1 << 20)) + 1;
+
+    fprintf(fid, "# stage name cores mem_mb deps inputs outputs command\n");
+    fprintf(fid, "# %s, %d rows in %d shards\n", region, num_rows, num_shards);
+    for (s = 0; s < num_shards; s++) {
+        row_start = s * num_rows / num_shards + 1;
+        row_end = (s + 1) * num_rows / num_shards;
+        shard_mb = cube_mb * (row_end - row_start + 1) / num_rows + 1;
+        rows[0] = '\0';
+        range[0] = '\0';
+        if (num_shards > 1) {
+            sprintf(rows, "-r %d:%d ", row_start, row_end);
+            sprintf(range, ".r%04d-%04d", row_start, row_end);
+        }
+
+        /* the time series keeps the cube plus the images being read */
+        fprintf(fid, "ts ts_a%s %d %ld - - %s/ts_%s_a%s.nc sm_gen_time_series %s%s%s a\n",
+                range, PROGRAM_THREADS, 2*shard_mb + 1024, ts, region, range, g, rows, region);
+        fprintf(fid, "ts ts_b%s %d %ld - - %s/ts_%s_b%s.nc sm_gen_time_series %s%s%s b\n",
+                range, PROGRAM_THREADS, 2*shard_mb + 1024, ts, region, range, g, rows, region);
+    }
+    if (num_shards > 1)
+        fprintf(fid, "merge_ts merge_ts 8 2048 @ts - %s/ts_%s_a.nc,%s/ts_%s_b.nc sm_merge_shards -p ts_%s_ %s\n",
+                ts, region, ts, region, region, ts);
+
+    for (s = 0; s < num_shards; s++) {
+        row_start = s * num_rows / num_shards + 1;
+        row_end = (s + 1) * num_rows / num_shards;
+        shard_mb = cube_mb * (row_end - row_start + 1) / num_rows + 1;
+        rows[0] = '\0';
+        range[0] = '\0';
+        if (num_shards > 1) {
+            sprintf(rows, "-r %d:%d ", row_start, row_end);
+            sprintf(range, ".r%04d-%04d", row_start, row_end);
+        }
+
+        /* both time series cubes of the rows */
+        fprintf(fid, "c0 c0%s %d %ld %s %s/ts_%s_a.nc,%s/ts_%s_b.nc %s/c0_%s%s.nc sm_gen_c0 %s%s%s a\n",
+                range, PROGRAM_THREADS, 2*shard_mb + 1024, num_shards > 1 ? "merge_ts" : "@ts",
+                ts, region, ts, region, c0, region, range, g, rows, region);
+    }
+    if (num_shards > 1)
+        fprintf(fid, "merge_c0 merge_c0 8 2048 @c0 - %s/c0_%s.nc sm_merge_shards -p c0_%s. %s\n",
+                c0, region, region, c0);
+
+    for (s = 0; s < num_shards; s++) {
+        row_start = s * num_rows / num_shards + 1;
+        row_end = (s + 1) * num_rows / num_shards;
+        shard_mb = cube_mb * (row_end - row_start + 1) / num_rows + 1;
+        rows[0] = '\0';
+        range[0] = '\0';
+        if (num_shards > 1) {
+            sprintf(rows, "-r %d:%d ", row_start, row_end);
+            sprintf(range, ".r%04d-%04d", row_start, row_end);
+        }
+
+        /* sm_gen_swi streams bands of rows, its memory does not grow
+         * with the image, the per-row files need no merging */
+        fprintf(fid, "swi swi%s %d %ld %s %s/ts_%s_a.nc,%s/ts_%s_b.nc,%s/c0_%s.nc "
+                "%s/swi_%s_%04d.nc,%s/swi_%s_%04d.nc sm_gen_swi %s%s%s\n",
+                range, PROGRAM_THREADS, 4*cube_mb*96/num_rows + 2048,
+                num_shards > 1 ? "merge_c0" : "@c0",
+                ts, region, ts, region, c0, region,
+                swi, region, row_start, swi, region, row_end, g, rows, region);
+    }
+
+    for (s = 0; s < num_shards; s++) {
+        row_start = s * num_rows / num_shards + 1;
+        row_end = (s + 1) * num_rows / num_shards;
+        shard_mb = cube_mb * (row_end - row_start + 1) / num_rows + 1;
+        rows[0] = '\0';
+        range[0] = '\0';
+        if (num_shards > 1) {
+            sprintf(rows, "-r %d:%d ", row_start, row_end);
+            sprintf(range, ".r%04d-%04d", row_start, row_end);
+        }
+
+        /* swi, ms, dry and the rearranging buffer. Shards write every
+         * day, a whole run skips the days without data and always ends
+         * with the index of them */
+        if (num_shards > 1)
+            sprintf(outputs, "%s/swi_%s_2009_001%s.nc,%s/swi_%s_2014_365%s.nc",
+                    img, region, range, img, region, range);
+        else
+            sprintf(outputs, "%s/swi_%s_empty.txt", img, region);
+        fprintf(fid, "img img%s %d %ld @swi %s/swi_%s_%04d.nc,%s/swi_%s_%04d.nc "
+                "%s sm_gen_img %s%s%s\n",
+                range, PROGRAM_THREADS, 4*shard_mb + 1024,
+                swi, region, row_start, swi, region, row_end,
+                outputs, g, rows, region);
+    }
+    if (num_shards > 1)
+        fprintf(fid, "merge_img merge_img 8 2048 @img - %s/swi_%s_2009_001.nc,%s/swi_%s_2014_365.nc "
+                "sm_merge_shards -j 8 -p swi_%s_ %s\n",
+                img, region, img, region, region, img);
+    return;
+}
+
+/* Split off the next whitespace separated field of a line */
+char *next_field(char **line) {
+    char *field = *line;
+
+    while (*field == ' ' || *field == '\t')
+        field++;
+    if (*field == '\0' || *field == '\n')
+        return NULL;
+    *line = field;
+    while (**line && **line != ' ' && **line != '\t' && **line != '\n')
+        (*line)++;
+    if (**line)
+        *(*line)++ = '\0';
+    return field;
+}
+
+/* Read the tasks and resolve their dependencies.
+ * Returns the number of tasks. */
+int read_tasks(FILE *fid, task *tasks) {
+    char line[MAX_LINE];
+    char *rest, *field[7], *dep, *save;
+    int num_tasks = 0, line_num = 0;
+    int i, j, k, *dep_buf;
+
+    while (fgets(line, sizeof(line), fid)) {
+        line_num++;
+        rest = line;
+        while (*rest == ' ' || *rest == '\t')
+            rest++;
+        if (*rest == '#' || *rest == '\n' || *rest == '\0')
+            continue;
+
+        for (i = 0; i < 7; i++) {
+            field[i] = next_field(&rest);
+            if (!field[i])
+                break;
+        }
+        while (*rest == ' ' || *rest == '\t')
+            rest++;
+        rest[strcspn(rest, "\n")] = '\0';
+        if (i < 7 || *rest == '\0') {
+            fprintf(stderr, "*** line %d: expected stage name cores mem_mb deps inputs outputs command\n", line_num);
+            exit(-1);
+        }
+        if (num_tasks == MAX_TASKS) {
+            fprintf(stderr, "Too many tasks!\n");
+            exit(-1);
+        }
+
+        task *t = &tasks[num_tasks];
+        memset(t, 0, sizeof(task));
+        snprintf(t->stage, sizeof(t->stage), "%s", field[0]);
+        snprintf(t->name, sizeof(t->name), "%s", field[1]);
+        t->cores = atoi(field[2]);
+        t->mem_mb = atol(field[3]);
+        t->deps = strdup(field[4]);
+        t->inputs = strdup(field[5]);
+        t->outputs = strdup(field[6]);
+        t->command = strdup(rest);
+        t->status = TASK_WAITING;
+        if (t->cores < 1)
+            t->cores = 1;
+        for (i = 0; i < num_tasks; i++) {
+            if (strcmp(tasks[i].name, t->name) == 0) {
+                fprintf(stderr, "*** line %d: task %s is listed twice\n", line_num, t->name);
+                exit(-1);
+            }
+        }
+        num_tasks++;
+    }
+
+    /* dependencies can only be on earlier tasks, so there are no cycles */
+    dep_buf = (int*)malloc(sizeof(int)*(num_tasks > 0 ? num_tasks : 1));
+    for (i = 0; i < num_tasks; i++) {
+        char deps[MAX_LINE];
+        int num_deps = 0;
+
+        if (strcmp(tasks[i].deps, "-") != 0) {
+            snprintf(deps, sizeof(deps), "%s", tasks[i].deps);
+            for (dep = strtok_r(deps, ",", &save); dep; dep = strtok_r(NULL, ",", &save)) {
+                int found = 0;
+                for (j = 0; j < i; j++) {
+                    if ((dep[0] == '@' && strcmp(tasks[j].stage, dep + 1) == 0) ||
+                            strcmp(tasks[j].name, dep) == 0) {
+                        for (k = 0; k < num_deps && dep_buf[k] != j; k++);
+                        if (k == num_deps)
+                            dep_buf[num_deps++] = j;
+                        found = 1;
+                    }
+                }
+                if (!found) {
+                    fprintf(stderr, "*** task %s depends on %s, which is not an earlier task\n",
+                            tasks[i].name, dep);
+                    exit(-1);
+                }
+            }
+        }
+        tasks[i].num_deps = num_deps;
+        tasks[i].dep = (int*)malloc(sizeof(int)*(num_deps > 0 ? num_deps : 1));
+        memcpy(tasks[i].dep, dep_buf, sizeof(int)*num_deps);
+    }
+    free(dep_buf);
+    return num_tasks;
+}
+
+/* 64 bit FNV-1a hash */
+unsigned long long hash_bytes(unsigned long long h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char*)data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Fingerprint of a task: its command and the name, size and modification
+ * time of each input. Taken once the dependencies are done, so the inputs
+ * they write are already in place. */
+unsigned long long task_fingerprint(task *t) {
+    unsigned long long h = 14695981039346656037ULL;
+    char inputs[MAX_LINE];
+    char *input, *save;
+    struct stat s;
+    long long stamp[3];
+
+    h = hash_bytes(h, t->command, strlen(t->command) + 1);
+    if (strcmp(t->inputs, "-") == 0)
+        return h;
+
+    snprintf(inputs, sizeof(inputs), "%s", t->inputs);
+    for (input = strtok_r(inputs, ",", &save); input; input = strtok_r(NULL, ",", &save)) {
+        h = hash_bytes(h, input, strlen(input) + 1);
+        if (stat(input, &s)) {
+            stamp[0] = stamp[1] = stamp[2] = -1;
+        } else {
+            stamp[0] = s.st_size;
+            stamp[1] = s.st_mtim.tv_sec;
+            stamp[2] = s.st_mtim.tv_nsec;
+        }
+        h = hash_bytes(h, stamp, sizeof(stamp));
+    }
+    return h;
+}
+
+int outputs_exist(task *t) {
+    char outputs[MAX_LINE];
+    char *output, *save;
+
+    if (strcmp(t->outputs, "-") == 0)
+        return 1;
+    snprintf(outputs, sizeof(outputs), "%s", t->outputs);
+    for (output = strtok_r(outputs, ",", &save); output; output = strtok_r(NULL, ",", &save)) {
+        if (access(output, F_OK))
+            return 0;
+    }
+    return 1;
+}
+
+/* A task is up to date if it finished before with the same fingerprint
+ * and its outputs are still there */
+int task_up_to_date(task *t, char *state_dir) {
+    char fname[600];
+    unsigned long long done_fingerprint;
+    FILE *fid;
+    int ok;
+
+    sprintf(fname, "%s/done/%s.done", state_dir, t->name);
+    fid = fopen(fname, "r");
+    if (!fid)
+        return 0;
+    ok = fscanf(fid, "%llx", &done_fingerprint) == 1 && done_fingerprint == t->fingerprint;
+    fclose(fid);
+    return ok && outputs_exist(t);
+}
+
+void mark_done(task *t, char *state_dir) {
+    char fname[600];
+    FILE *fid;
+
+    sprintf(fname, "%s/done/%s.done", state_dir, t->name);
+    fid = fopen(fname, "w");
+    if (!fid) {
+        perror(fname);
+        return;
+    }
+    fprintf(fid, "%016llx\n", t->fingerprint);
+    fclose(fid);
+    return;
+}
+
+void clear_done(task *t, char *state_dir) {
+    char fname[600];
+
+    sprintf(fname, "%s/done/%s.done", state_dir, t->name);
+    unlink(fname);
+    return;
+}
+
+/* Start a task with its output going to its log file */
+pid_t start_task(task *t, char *state_dir) {
+    char fname[600];
+    time_t now = time(NULL);
+    pid_t pid;
+    int fd;
+
+    sprintf(fname, "%s/logs/%s.out", state_dir, t->name);
+    fflush(stdout);
+    pid = fork();
+    if (pid != 0)
+        return pid;
+
+    fd = open(fname, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd >= 0) {
+        dprintf(fd, "==== attempt %d, %s%s\n", t->attempts + 1, ctime(&now), t->command);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    execl("/bin/sh", "sh", "-c", t->command, (char*)NULL);
+    perror("execl");
+    _exit(127);
+}
+
+/* Run the tasks, only_done tasks are taken as already done.
+ * Returns the number of tasks that failed or were blocked. */
+int run_tasks(task *tasks, int num_tasks, struct arguments *arguments,
+        int total_cores, long total_mem_mb) {
+    int free_cores = total_cores;
+    long free_mem_mb = total_mem_mb;
+    int num_finished = 0, num_running = 0, num_failed = 0;
+    int i, j, status, ready, blocked;
+    char *state_dir = arguments->state_dir;
+    pid_t pid;
+
+    for (i = 0; i < num_tasks; i++) {
+        if (tasks[i].status != TASK_WAITING) {
+            num_finished++;
+            continue;
+        }
+        /* a task bigger than the node gets the whole node to itself */
+        if (tasks[i].cores > total_cores) {
+            printf("Task %s wants %d cores, running it with %d\n", tasks[i].name,
+                    tasks[i].cores, total_cores);
+            tasks[i].cores = total_cores;
+        }
+        if (tasks[i].mem_mb > total_mem_mb) {
+            printf("Task %s wants %ld MB, running it with %ld\n", tasks[i].name,
+                    tasks[i].mem_mb, total_mem_mb);
+            tasks[i].mem_mb = total_mem_mb;
+        }
+    }
+
+    while (num_finished < num_tasks) {
+        /* start whatever is ready and fits, in task order */
+        for (i = 0; i < num_tasks && !interrupted; i++) {
+            if (tasks[i].status != TASK_WAITING)
+                continue;
+            ready = 1;
+            blocked = 0;
+            for (j = 0; j < tasks[i].num_deps; j++) {
+                status = tasks[tasks[i].dep[j]].status;
+                if (status == TASK_FAILED || status == TASK_BLOCKED)
+                    blocked = 1;
+                else if (status != TASK_DONE)
+                    ready = 0;
+            }
+            if (blocked) {
+                printf("Giving up on %s, a dependency failed\n", tasks[i].name);
+                tasks[i].status = TASK_BLOCKED;
+                num_finished++;
+                num_failed++;
+                continue;
+            }
+            if (!ready || tasks[i].cores > free_cores || tasks[i].mem_mb > free_mem_mb)
+                continue;
+
+            if (tasks[i].attempts == 0) {
+                tasks[i].fingerprint = task_fingerprint(&tasks[i]);
+                if (task_up_to_date(&tasks[i], state_dir)) {
+                    if (arguments->verbose)
+                        printf("Up to date: %s\n", tasks[i].name);
+                    tasks[i].status = TASK_DONE;
+                    tasks[i].skipped = 1;
+                    num_finished++;
+                    continue;
+                }
+            }
+            if (arguments->dry_run) {
+                printf("Would run %s: %s\n", tasks[i].name, tasks[i].command);
+                tasks[i].status = TASK_DONE;
+                num_finished++;
+                continue;
+            }
+
+            clear_done(&tasks[i], state_dir);
+            tasks[i].pid = start_task(&tasks[i], state_dir);
+            if (tasks[i].pid < 0) {
+                perror("fork");
+                break;
+            }
+            printf("Started %s (%d cores, %ld MB)\n", tasks[i].name, tasks[i].cores, tasks[i].mem_mb);
+            tasks[i].status = TASK_RUNNING;
+            free_cores -= tasks[i].cores;
+            free_mem_mb -= tasks[i].mem_mb;
+            num_running++;
+        }
+
+        /* nothing running means nothing else can start */
+        if (num_running == 0)
+            break;
+
+        pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno != EINTR)
+                break;
+            if (interrupted) {
+                printf("Interrupted, stopping the running tasks\n");
+                for (i = 0; i < num_tasks; i++) {
+                    if (tasks[i].status == TASK_RUNNING)
+                        kill(tasks[i].pid, SIGTERM);
+                }
+            }
+            continue;
+        }
+        for (i = 0; i < num_tasks && !(tasks[i].status == TASK_RUNNING && tasks[i].pid == pid); i++);
+        if (i == num_tasks)
+            continue;
+
+        free_cores += tasks[i].cores;
+        free_mem_mb += tasks[i].mem_mb;
+        num_running--;
+        tasks[i].attempts++;
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            printf("Finished %s\n", tasks[i].name);
+            mark_done(&tasks[i], state_dir);
+            tasks[i].status = TASK_DONE;
+            num_finished++;
+        } else {
+            if (WIFSIGNALED(status))
+                printf("Task %s died with signal %d\n", tasks[i].name, WTERMSIG(status));
+            else
+                printf("Task %s exited with status %d\n", tasks[i].name, WEXITSTATUS(status));
+            if (!interrupted && tasks[i].attempts <= arguments->retries) {
+                printf("Retrying %s (attempt %d)\n", tasks[i].name, tasks[i].attempts + 1);
+                tasks[i].status = TASK_WAITING;
+            } else {
+                tasks[i].status = TASK_FAILED;
+                num_finished++;
+                num_failed++;
+            }
+        }
+    }
+
+    for (i = 0; i < num_tasks; i++) {
+        if (tasks[i].status == TASK_WAITING || tasks[i].status == TASK_RUNNING)
+            num_failed++;
+    }
+    return num_failed;
+}
+
+/* Write one job array script per stage and a script that submits them
+ * with stage dependencies. Each array element runs one task through
+ * sm_run_jobs --only, so finished tasks are still skipped and failures
+ * retried. */
+void write_slurm(task *tasks, int num_tasks, struct arguments *arguments, char *task_file) {
+    char fname[600];
+    char stages[64][32];
+    int stage_deps[64][64];
+    int num_stage_deps[64];
+    int num_stages = 0;
+    int i, j, k, s, d, n, max_cores;
+    long max_mem_mb;
+    FILE *fid, *submit;
+
+    /* stages in the order they first show up, with the stages they need */
+    for (i = 0; i < num_tasks; i++) {
+        for (s = 0; s < num_stages && strcmp(stages[s], tasks[i].stage) != 0; s++);
+        if (s == num_stages) {
+            if (num_stages == 64) {
+                fprintf(stderr, "Too many stages!\n");
+                exit(-1);
+            }
+            strcpy(stages[num_stages], tasks[i].stage);
+            num_stage_deps[num_stages] = 0;
+            num_stages++;
+        }
+        for (j = 0; j < tasks[i].num_deps; j++) {
+            for (d = 0; strcmp(stages[d], tasks[tasks[i].dep[j]].stage) != 0; d++);
+            if (d == s)
+                continue;
+            if (d > s) {
+                fprintf(stderr, "*** stage %s needs the later stage %s, give them different stage names\n",
+                        stages[s], stages[d]);
+                exit(-1);
+            }
+            for (k = 0; k < num_stage_deps[s] && stage_deps[s][k] != d; k++);
+            if (k == num_stage_deps[s])
+                stage_deps[s][num_stage_deps[s]++] = d;
+        }
+    }
+
+    checkdir(arguments->slurm_dir);
+    sprintf(fname, "%s/submit.sh", arguments->slurm_dir);
+    submit = fopen(fname, "w");
+    if (!submit) {
+        perror(fname);
+        exit(1);
+    }
+    fprintf(submit, "#!/usr/bin/env bash\n");
+
+    for (s = 0; s < num_stages; s++) {
+        max_cores = 1;
+        max_mem_mb = 1;
+        for (i = 0, n = 0; i < num_tasks; i++) {
+            if (strcmp(tasks[i].stage, stages[s]) != 0)
+                continue;
+            if (tasks[i].cores > max_cores)
+                max_cores = tasks[i].cores;
+            if (tasks[i].mem_mb > max_mem_mb)
+                max_mem_mb = tasks[i].mem_mb;
+            n++;
+        }
+
+        sprintf(fname, "%s/%s.job", arguments->slurm_dir, stages[s]);
+        fid = fopen(fname, "w");
+        if (!fid) {
+            perror(fname);
+            exit(1);
+        }
+        fprintf(fid, "#!/usr/bin/env bash\n");
+        fprintf(fid, "#SBATCH -J %s --array=0-%d --time=24:00:00 --cpus-per-task=%d --mem=%ld "
+                "--ntasks=1 --output=%s/slurm-%%A_%%a.out\n",
+                stages[s], n - 1, max_cores, max_mem_mb, arguments->slurm_dir);
+        fprintf(fid, "hostname\n");
+        fprintf(fid, "case $SLURM_ARRAY_TASK_ID in\n");
+        for (i = 0, n = 0; i < num_tasks; i++) {
+            if (strcmp(tasks[i].stage, stages[s]) != 0)
+                continue;
+            fprintf(fid, "%d) sm_run_jobs -c %d -m %ld -r %d -s %s -o %s %s ;;\n",
+                    n++, max_cores, max_mem_mb, arguments->retries,
+                    arguments->state_dir, tasks[i].name, task_file);
+        }
+        fprintf(fid, "esac\n");
+        fclose(fid);
+
+        fprintf(submit, "jid_%s=$(sbatch --parsable", stages[s]);
+        for (k = 0; k < num_stage_deps[s]; k++)
+            fprintf(submit, "%s$jid_%s", k == 0 ? " --dependency=afterok:" : ":",
+                    stages[stage_deps[s][k]]);
+        fprintf(submit, " %s/%s.job)\n", arguments->slurm_dir, stages[s]);
+        fprintf(submit, "echo \"%s: $jid_%s\"\n", stages[s], stages[s]);
+    }
+    fclose(submit);
+    sprintf(fname, "%s/submit.sh", arguments->slurm_dir);
+    chmod(fname, 0755);
+    printf("Wrote %d job arrays, submit them with %s\n", num_stages, fname);
+    return;
+}
+
+int main (int argc, char **argv)
+{
+    struct arguments arguments;
+
+    /* Default values. */
+    arguments.task_file = NULL;
+    arguments.region = NULL;
+    arguments.grd = 0;
+    arguments.shards = 1;
+    arguments.cores = 0;
+    arguments.mem_mb = 0;
+    arguments.retries = 2;
+    arguments.state_dir = TEMP_DIR "/jobs";
+    arguments.only = NULL;
+    arguments.dry_run = 0;
+    arguments.print = 0;
+    arguments.slurm_dir = NULL;
+    arguments.verbose = 0;
+
+    /* Parse our arguments; every option seen by parse_opt will
+     be reflected in arguments. */
+    argp_parse (&argp, argc, argv, 0, 0, &arguments);
+
+    char fname[600];
+    char task_file[600];
+    FILE *fid;
+    int num_tasks, num_failed, num_skipped;
+    int i;
+
+    setvbuf (stdout, NULL, _IONBF, 0);
+    task *tasks = (task*)malloc(sizeof(task)*MAX_TASKS);
+    if (!tasks) {
+        fprintf(stderr, "Memory Error!\n");
+        exit(-1);
+    }
+
+    checkdir(arguments.state_dir);
+    sprintf(fname, "%s/done", arguments.state_dir);
+    checkdir(fname);
+    sprintf(fname, "%s/logs", arguments.state_dir);
+    checkdir(fname);
+
+    /* the standard processing is written out as a task file, so slurm
+     * array elements can read the same tasks back */
+    if (arguments.region) {
+        sprintf(task_file, "%s/tasks_%s%s.txt", arguments.state_dir,
+                arguments.region, arguments.grd ? "_grd" : "");
+        fid = fopen(task_file, "w");
+        if (!fid) {
+            perror(task_file);
+            exit(1);
+        }
+        write_region_tasks(fid, arguments.region, arguments.grd, arguments.shards);
+        fclose(fid);
+    } else {
+        snprintf(task_file, sizeof(task_file), "%s", arguments.task_file);
+    }
+
+    fid = fopen(task_file, "r");
+    if (!fid) {
+        perror(task_file);
+        exit(1);
+    }
+    num_tasks = read_tasks(fid, tasks);
+    fclose(fid);
+
+    if (arguments.print) {
+        for (i = 0; i < num_tasks; i++) {
+            printf("%-6s %-24s %3d cores %7ld MB %4d deps: %s\n", tasks[i].stage, tasks[i].name,
+                    tasks[i].cores, tasks[i].mem_mb, tasks[i].num_deps, tasks[i].command);
+        }
+        exit(0);
+    }
+
+    if (arguments.slurm_dir) {
+        write_slurm(tasks, num_tasks, &arguments, task_file);
+        exit(0);
+    }
+
+    /* with --only the other tasks are taken as done */
+    if (arguments.only) {
+        int found = 0;
+        for (i = 0; i < num_tasks; i++) {
+            if ((arguments.only[0] == '@' && strcmp(tasks[i].stage, arguments.only + 1) == 0) ||
+                    strcmp(tasks[i].name, arguments.only) == 0)
+                found = 1;
+            else
+                tasks[i].status = TASK_DONE;
+        }
+        if (!found) {
+            fprintf(stderr, "No task %s!\n", arguments.only);
+            exit(-1);
+        }
+    }
+
+    int total_cores = arguments.cores ? arguments.cores : sysconf(_SC_NPROCESSORS_ONLN);
+    long total_mem_mb = arguments.mem_mb ? arguments.mem_mb :
+            (long)((double)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / (1 << 20));
+
+    printf ("RUN_JOBS\n---------------\nBeginning processing with options:\n");
+    printf ("TASKS = %s (%d tasks)\nCORES = %d\nMEMORY = %ld MB\nRETRIES = %d\nSTATE = %s\n---------------\n",
+      task_file, num_tasks, total_cores, total_mem_mb, arguments.retries, arguments.state_dir);
+
+    /* no SA_RESTART, so waitpid returns and the tasks can be stopped */
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    num_failed = run_tasks(tasks, num_tasks, &arguments, total_cores, total_mem_mb);
+
+    num_skipped = 0;
+    for (i = 0; i < num_tasks; i++) {
+        if (tasks[i].skipped)
+            num_skipped++;
+        if (tasks[i].status == TASK_FAILED)
+            printf("FAILED: %s, see %s/logs/%s.out\n", tasks[i].name, arguments.state_dir, tasks[i].name);
+    }
+    printf("%d tasks, %d up to date, %d failed or not run\n", num_tasks, num_skipped, num_failed);
+
+    for (i = 0; i < num_tasks; i++) {
+        free(tasks[i].deps);
+        free(tasks[i].inputs);
+        free(tasks[i].outputs);
+        free(tasks[i].command);
+        free(tasks[i].dep);
+    }
+    free(tasks);
+
+    if (num_failed)
+        exit(1);
+    printf("Finished.\n");
+    exit (0);
+}